@@ -0,0 +1,754 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// a headless load generator for the chat server. it opens many connections
+// from a single event loop, logs each one in, then sends a mix of broadcasts
+// and whispers at a fixed rate (whether or not the server keeps up), while
+// users leave and rejoin, and reports the throughput, how many of the
+// messages it expected to arrive did, and how long they took.
+//
+// usage: tinychat_bench <port> [--address A] [--users N] [--rate N] [--whispers F] [--size N]
+//        [--churn N] [--duration S] [--drain S] [--ramp N] [--text] [--prefix P]
+//
+// every message carries the (monotonic) time it was sent, so its latency is
+// measured by whichever connection receives it. broadcasts are expected to
+// reach every other logged in connection (of this bench), and whispers their
+// recipient. messages that arrive as history, from before the recipient
+// logged in, are not counted.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "protocol.h"
+
+// the states a connection goes through
+#define STATE_IDLE 0
+#define STATE_CONNECTING 1
+#define STATE_JOINING 2
+#define STATE_JOINED 3
+#define STATE_FAILED 4
+
+// the phases of a run
+#define PHASE_RAMP 0
+#define PHASE_RUN 1
+#define PHASE_DRAIN 2
+
+// the most messages sent (or users churned) per pass of the event loop, so
+// a bench that falls behind still reads what it is sent
+#define MAX_BURST 1024
+
+// a user whose connection has this many bytes waiting to be written is
+// skipped, rather than queueing more (the server is pushing back)
+#define MAX_PENDING (64 * 1024)
+
+// how long the ramp (logging everyone in) may take before the run starts anyway
+#define RAMP_TIMEOUT_SECONDS 30
+
+#define MAX_EVENTS 256
+
+// a single simulated user
+struct conn {
+	int fd;
+	int state;
+	int joined_pos;
+	unsigned generation;
+	uint64_t started_at;
+	uint64_t joined_at;
+	char name[MAX_USERNAME_LEN + 1];
+	struct frame_decoder decoder;
+
+	// bytes waiting to be written, and whether the socket is being watched for room
+	char *out;
+	size_t out_len;
+	size_t out_cap;
+	int watching_out;
+};
+
+// a growable list of samples (in microseconds)
+struct samples {
+	uint32_t *values;
+	size_t count;
+	size_t cap;
+};
+
+// the benchmark's settings, and its state
+struct bench {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int users;
+	double rate;
+	double whispers;
+	int size;
+	double churn;
+	double duration;
+	double drain;
+	int ramp;
+	int binary;
+	const char *prefix;
+
+	int epoll_fd;
+	struct conn *conns;
+
+	// the connections waiting to (re)connect, and those logged in (to pick from)
+	int *idle;
+	int idle_count;
+	int *joined;
+	int joined_count;
+	int pending;
+
+	int phase;
+	uint64_t phase_at;
+	uint64_t run_at;
+
+	uint64_t attempted;
+	uint64_t skipped;
+	uint64_t sent_whispers;
+	uint64_t sent_broadcasts;
+	uint64_t expected;
+	uint64_t delivered;
+	uint64_t replayed;
+	uint64_t churned;
+	uint64_t joins;
+	uint64_t join_failures;
+	uint64_t disconnects;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+
+	struct samples latency;
+	struct samples join_time;
+};
+
+// returns the current (monotonic) time in nanoseconds
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// exits, out of memory
+static void out_of_memory(void) {
+	perror("allocation failed");
+	exit(-1);
+}
+
+// adds a sample (of ns nanoseconds) to the list
+static void samples_add(struct samples *samples, uint64_t ns) {
+	if (samples->count == samples->cap) {
+		samples->cap = samples->cap == 0 ? 4096 : samples->cap * 2;
+		if ((samples->values = realloc(samples->values, samples->cap * sizeof(uint32_t))) == NULL) {
+			out_of_memory();
+		}
+	}
+	uint64_t us = ns / 1000;
+	samples->values[samples->count++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static int compare_samples(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// returns the p'th percentile of the (sorted) samples, in milliseconds
+static double samples_percentile(const struct samples *samples, double p) {
+	if (samples->count == 0) {
+		return 0.0;
+	}
+	return samples->values[(size_t)(p / 100.0 * (samples->count - 1))] / 1e3;
+}
+
+// prints the percentiles of the samples
+static void samples_print(const char *label, struct samples *samples) {
+	qsort(samples->values, samples->count, sizeof(uint32_t), compare_samples);
+	printf("%-10s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  p99.9 %8.3f ms  max %8.3f ms  (%zu samples)\n",
+		label, samples_percentile(samples, 50), samples_percentile(samples, 90),
+		samples_percentile(samples, 99), samples_percentile(samples, 99.9),
+		samples_percentile(samples, 100), samples->count);
+}
+
+
+
+//
+// CONNECTION function(s)
+//
+
+// watches the connection's socket for room to write, if it has bytes waiting (or stops)
+static void conn_watch(struct bench *bench, int c) {
+	struct conn *conn = &bench->conns[c];
+	int want = conn->out_len > 0 || conn->state == STATE_CONNECTING;
+	if (want == conn->watching_out) {
+		return;
+	}
+
+	struct epoll_event event;
+	event.events = EPOLLIN | (want ? EPOLLOUT : 0);
+	event.data.u32 = c;
+	epoll_ctl(bench->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+	conn->watching_out = want;
+}
+
+// writes as much of what is waiting as the socket takes
+// (ret: 1 success, 0 the connection failed)
+static int conn_flush(struct bench *bench, int c) {
+	struct conn *conn = &bench->conns[c];
+	size_t written = 0;
+	while (written < conn->out_len) {
+		ssize_t nwritten = write(conn->fd, conn->out + written, conn->out_len - written);
+		if (nwritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return 0;
+		}
+		written += nwritten;
+	}
+
+	bench->bytes_sent += written;
+	memmove(conn->out, conn->out + written, conn->out_len - written);
+	conn->out_len -= written;
+	conn_watch(bench, c);
+	return 1;
+}
+
+// returns room for a frame of len bytes at the end of the connection's output
+static char *conn_reserve(struct conn *conn, size_t len) {
+	size_t needed = conn->out_len + FRAME_HEADER_LEN + len;
+	if (needed > conn->out_cap) {
+		conn->out_cap = needed * 2;
+		if ((conn->out = realloc(conn->out, conn->out_cap)) == NULL) {
+			out_of_memory();
+		}
+	}
+
+	char *frame = conn->out + conn->out_len;
+	frame_put_header(frame, len);
+	conn->out_len = needed;
+	return frame + FRAME_HEADER_LEN;
+}
+
+// queues the packet, in whichever encoding the connection uses
+static void conn_queue(struct bench *bench, int c, const struct protocol_packet *packet) {
+	struct conn *conn = &bench->conns[c];
+	if (bench->binary) {
+		protocol_encode(packet, conn_reserve(conn, protocol_encoded_len(packet)));
+	}
+	else {
+		protocol_format_text(packet, conn_reserve(conn, protocol_text_len(packet)));
+	}
+}
+
+// forgets that the connection is logged in
+static void conn_unjoin(struct bench *bench, int c) {
+	struct conn *conn = &bench->conns[c];
+	if (conn->joined_pos < 0) {
+		return;
+	}
+
+	int last = bench->joined[--bench->joined_count];
+	bench->joined[conn->joined_pos] = last;
+	bench->conns[last].joined_pos = conn->joined_pos;
+	conn->joined_pos = -1;
+}
+
+// closes the connection. unless it failed to log in, it is queued to
+// connect again (under a new name, so it never races its old self)
+static void conn_close(struct bench *bench, int c, int state) {
+	struct conn *conn = &bench->conns[c];
+	if (conn->state == STATE_CONNECTING || conn->state == STATE_JOINING) {
+		bench->pending--;
+	}
+	conn_unjoin(bench, c);
+
+	close(conn->fd);
+	conn->fd = -1;
+	conn->out_len = 0;
+	conn->watching_out = 0;
+	frame_decoder_free(&conn->decoder);
+	conn->generation++;
+
+	conn->state = state;
+	if (state == STATE_IDLE) {
+		bench->idle[bench->idle_count++] = c;
+	}
+}
+
+// starts connecting (and then logging in) an idle connection
+static void conn_open(struct bench *bench, int c) {
+	struct conn *conn = &bench->conns[c];
+	snprintf(conn->name, sizeof(conn->name), "%s%d.%u", bench->prefix, c, conn->generation % 100);
+	conn->started_at = now_ns();
+	conn->joined_pos = -1;
+	frame_decoder_initialize(&conn->decoder);
+
+	if ((conn->fd = socket(bench->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+		perror("socket() failed");
+		exit(-1);
+	}
+
+	if (connect(conn->fd, (struct sockaddr*)&bench->addr, bench->addr_len) < 0 && errno != EINPROGRESS) {
+		perror("connect() failed");
+		exit(-1);
+	}
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.u32 = c;
+	if (epoll_ctl(bench->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) < 0) {
+		perror("epoll_ctl() failed");
+		exit(-1);
+	}
+
+	conn->state = STATE_CONNECTING;
+	conn->watching_out = 1;
+	bench->pending++;
+}
+
+// sends the join request, once the connection is established
+static void conn_connected(struct bench *bench, int c) {
+	struct conn *conn = &bench->conns[c];
+	int err = 0;
+	getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &(socklen_t){sizeof(err)});
+	if (err != 0) {
+		fprintf(stderr, "connect() failed: %s\n", strerror(err));
+		bench->join_failures++;
+		conn_close(bench, c, STATE_FAILED);
+		return;
+	}
+
+	// the join is always text; the reply says whether binary was accepted
+	char join[64];
+	int len = snprintf(join, sizeof(join), "/join %s%s", conn->name,
+		bench->binary ? " " PROTOCOL_BINARY_VERSION : "");
+	memcpy(conn_reserve(conn, len), join, len);
+
+	conn->state = STATE_JOINING;
+	if (!conn_flush(bench, c)) {
+		conn_close(bench, c, STATE_IDLE);
+	}
+}
+
+// handles the reply to the join request
+static void conn_join_response(struct bench *bench, int c, const char *payload) {
+	struct conn *conn = &bench->conns[c];
+	if (strncmp(payload, "/joinresponse ok", 16) != 0) {
+		fprintf(stderr, "%s was refused: %s\n", conn->name, payload);
+		bench->join_failures++;
+		conn_close(bench, c, STATE_FAILED);
+		return;
+	}
+
+	bench->pending--;
+	conn->state = STATE_JOINED;
+	conn->joined_at = now_ns();
+	conn->joined_pos = bench->joined_count;
+	bench->joined[bench->joined_count++] = c;
+	bench->joins++;
+	samples_add(&bench->join_time, conn->joined_at - conn->started_at);
+}
+
+// handles a single frame received by a logged in connection
+static void conn_receive(struct bench *bench, int c, const char *payload, size_t len) {
+	struct conn *conn = &bench->conns[c];
+	struct protocol_packet packet;
+	if (!protocol_read(bench->binary, payload, len, &packet)) {
+		return;
+	}
+
+	if (packet.opcode == OP_PING) {
+		struct protocol_packet pong;
+		protocol_packet_initialize(&pong, OP_PONG, NULL, NULL, "");
+		conn_queue(bench, c, &pong);
+		return;
+	}
+
+	if (packet.opcode != OP_BROADCASTED && packet.opcode != OP_WHISPERED) {
+		return;
+	}
+
+	// note: the payload ends the frame, so it is nul-terminated
+	char *end;
+	uint64_t sent_at = strtoull(packet.payload, &end, 10);
+	if (end == packet.payload || *end != ' ') {
+		return;
+	}
+
+	if (sent_at < conn->joined_at) {
+		bench->replayed++;
+		return;
+	}
+	bench->delivered++;
+	samples_add(&bench->latency, now_ns() - sent_at);
+}
+
+// reads whatever is available on the connection, and handles every complete frame
+static void conn_read(struct bench *bench, int c) {
+	struct conn *conn = &bench->conns[c];
+	while (1) {
+		ssize_t nread = frame_decoder_read(&conn->decoder, conn->fd);
+		if (nread == 0 || (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			if (conn->state == STATE_JOINED) {
+				bench->disconnects++;
+			}
+			conn_close(bench, c, STATE_IDLE);
+			return;
+		}
+		if (nread < 0) {
+			break;
+		}
+		bench->bytes_received += nread;
+	}
+
+	char *payload;
+	size_t len;
+	int ret;
+	while ((ret = frame_decoder_next(&conn->decoder, &payload, &len)) == 1) {
+		if (conn->state == STATE_JOINING) {
+			conn_join_response(bench, c, payload);
+			if (conn->state != STATE_JOINED) {
+				return;
+			}
+		}
+		else {
+			conn_receive(bench, c, payload, len);
+		}
+	}
+
+	if (ret < 0 || !conn_flush(bench, c)) {
+		conn_close(bench, c, STATE_IDLE);
+	}
+}
+
+
+
+//
+// LOAD function(s)
+//
+
+// sends a single message from a random user, to everyone or to another random user
+static void send_message(struct bench *bench, char *payload) {
+	bench->attempted++;
+	if (bench->joined_count < 2) {
+		bench->skipped++;
+		return;
+	}
+
+	int c = bench->joined[random() % bench->joined_count];
+	struct conn *conn = &bench->conns[c];
+	if (conn->out_len >= MAX_PENDING) {
+		bench->skipped++;
+		return;
+	}
+
+	// stamp the payload (which is padded out to the message size)
+	int len = sprintf(payload, "%llu ", (unsigned long long)now_ns());
+	payload[len] = 'x';
+
+	struct protocol_packet packet;
+	if (random() < bench->whispers * RAND_MAX) {
+		int r;
+		do {
+			r = bench->joined[random() % bench->joined_count];
+		} while (r == c);
+
+		protocol_packet_initialize(&packet, OP_WHISPER, NULL, bench->conns[r].name, payload);
+		bench->sent_whispers++;
+		bench->expected++;
+	}
+	else {
+		protocol_packet_initialize(&packet, OP_BROADCAST, NULL, NULL, payload);
+		bench->sent_broadcasts++;
+		bench->expected += bench->joined_count - 1;
+	}
+
+	conn_queue(bench, c, &packet);
+	if (!conn_flush(bench, c)) {
+		conn_close(bench, c, STATE_IDLE);
+	}
+}
+
+// disconnects a random user, who logs back in under a new name
+static void churn_user(struct bench *bench) {
+	if (bench->joined_count == 0) {
+		return;
+	}
+	conn_close(bench, bench->joined[random() % bench->joined_count], STATE_IDLE);
+	bench->churned++;
+}
+
+// sends the messages (and churns the users) due by now, and starts logging in
+// as many idle users as the ramp allows
+static void drive(struct bench *bench, char *payload) {
+	uint64_t now = now_ns();
+
+	if (bench->phase == PHASE_RUN) {
+		double elapsed = (now - bench->run_at) / 1e9;
+		uint64_t due = (uint64_t)(elapsed * bench->rate);
+		for (int n = 0; bench->attempted < due && n < MAX_BURST; n++) {
+			send_message(bench, payload);
+		}
+
+		due = (uint64_t)(elapsed * bench->churn);
+		for (int n = 0; bench->churned < due && n < MAX_BURST; n++) {
+			churn_user(bench);
+		}
+	}
+
+	while (bench->pending < bench->ramp && bench->idle_count > 0) {
+		conn_open(bench, bench->idle[--bench->idle_count]);
+	}
+
+	// move on to the next phase when this one is over
+	if (bench->phase == PHASE_RAMP) {
+		if (bench->idle_count == 0 && bench->pending == 0) {
+			printf("ramp: %d of %d users logged in in %.3f s\n", bench->joined_count, bench->users,
+				(now - bench->phase_at) / 1e9);
+		}
+		else if (now - bench->phase_at > RAMP_TIMEOUT_SECONDS * 1000000000ull) {
+			printf("ramp: timed out with %d of %d users logged in\n", bench->joined_count, bench->users);
+		}
+		else {
+			return;
+		}
+
+		bench->phase = PHASE_RUN;
+		bench->phase_at = bench->run_at = now;
+	}
+	else if (bench->phase == PHASE_RUN && now - bench->phase_at >= bench->duration * 1e9) {
+		bench->phase = PHASE_DRAIN;
+		bench->phase_at = now;
+	}
+}
+
+// runs the benchmark, and prints what it measured
+static void bench_run(struct bench *bench) {
+	if ((bench->epoll_fd = epoll_create1(0)) < 0) {
+		perror("epoll_create1() failed");
+		exit(-1);
+	}
+
+	bench->conns = calloc(bench->users, sizeof(struct conn));
+	bench->idle = malloc(bench->users * sizeof(int));
+	bench->joined = malloc(bench->users * sizeof(int));
+	char *payload = malloc(bench->size + 32);
+	if (bench->conns == NULL || bench->idle == NULL || bench->joined == NULL || payload == NULL) {
+		out_of_memory();
+	}
+
+	// (the first user logs in first)
+	for (int c = bench->users - 1; c >= 0; c--) {
+		bench->conns[c].fd = -1;
+		bench->conns[c].joined_pos = -1;
+		bench->idle[bench->idle_count++] = c;
+	}
+	memset(payload, 'x', bench->size);
+	payload[bench->size] = '\0';
+
+	bench->phase = PHASE_RAMP;
+	bench->phase_at = now_ns();
+
+	struct epoll_event events[MAX_EVENTS];
+	while (bench->phase != PHASE_DRAIN || now_ns() - bench->phase_at < bench->drain * 1e9) {
+		drive(bench, payload);
+
+		int n = epoll_wait(bench->epoll_fd, events, MAX_EVENTS, 1);
+		for (int e = 0; e < n; e++) {
+			int c = events[e].data.u32;
+			struct conn *conn = &bench->conns[c];
+			if (conn->fd < 0) {
+				continue;
+			}
+
+			if (conn->state == STATE_CONNECTING) {
+				if (events[e].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+					conn_connected(bench, c);
+				}
+				continue;
+			}
+
+			if ((events[e].events & EPOLLOUT) && !conn_flush(bench, c)) {
+				conn_close(bench, c, STATE_IDLE);
+				continue;
+			}
+			if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				conn_read(bench, c);
+			}
+		}
+	}
+
+	double elapsed = (bench->phase_at - bench->run_at) / 1e9;
+	uint64_t sent = bench->sent_whispers + bench->sent_broadcasts;
+	printf("sent      %llu messages (%llu whispers, %llu broadcasts) in %.3f s, %.1f messages/s"
+		" (%llu skipped)\n", (unsigned long long)sent, (unsigned long long)bench->sent_whispers,
+		(unsigned long long)bench->sent_broadcasts, elapsed, sent / elapsed,
+		(unsigned long long)bench->skipped);
+	printf("delivered %llu of %llu expected (%.2f%%), %.1f deliveries/s (%llu replayed as history)\n",
+		(unsigned long long)bench->delivered, (unsigned long long)bench->expected,
+		bench->expected > 0 ? 100.0 * bench->delivered / bench->expected : 100.0,
+		bench->delivered / elapsed, (unsigned long long)bench->replayed);
+	printf("traffic   %.2f MB sent, %.2f MB received\n", bench->bytes_sent / 1e6, bench->bytes_received / 1e6);
+	printf("users     %llu joins, %llu refused, %llu churned, %llu disconnected by the server\n",
+		(unsigned long long)bench->joins, (unsigned long long)bench->join_failures,
+		(unsigned long long)bench->churned, (unsigned long long)bench->disconnects);
+	samples_print("latency", &bench->latency);
+	samples_print("join", &bench->join_time);
+}
+
+// resolves the server's address
+// (ret: 1 success, 0 failure)
+static int bench_resolve(struct bench *bench, const char *address, const char *port) {
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int err = getaddrinfo(address, port, &hints, &result);
+	if (err != 0) {
+		fprintf(stderr, "getaddrinfo() failed: %s\n", gai_strerror(err));
+		return 0;
+	}
+
+	memcpy(&bench->addr, result->ai_addr, result->ai_addrlen);
+	bench->addr_len = result->ai_addrlen;
+	freeaddrinfo(result);
+	return 1;
+}
+
+// makes sure a descriptor is allowed for every user
+// (ret: 1 success, 0 failure)
+static int bench_raise_fd_limit(int users) {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+		perror("getrlimit() failed");
+		return 0;
+	}
+
+	rlim_t needed = users + 16;
+	if (limit.rlim_cur < needed) {
+		limit.rlim_cur = limit.rlim_max < needed ? limit.rlim_max : needed;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	if (limit.rlim_cur < needed) {
+		fprintf(stderr, "only %llu descriptors are allowed (raise the hard limit with ulimit -Hn)\n",
+			(unsigned long long)limit.rlim_cur);
+		return 0;
+	}
+	return 1;
+}
+
+// prints the usage message and exits
+static void usage(const char *program) {
+	printf("usage: %s <port> [--address A] [--users N] [--rate N] [--whispers F] [--size N] [--churn N]"
+		" [--duration S] [--drain S] [--ramp N] [--text] [--prefix P]\n", program);
+	exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench bench;
+	memset(&bench, 0, sizeof(bench));
+	bench.users = 1000;
+	bench.rate = 1000;
+	bench.whispers = 0.9;
+	bench.size = 64;
+	bench.churn = 0;
+	bench.duration = 10;
+	bench.drain = 2;
+	bench.ramp = 64;
+	bench.binary = 1;
+	bench.prefix = "bench";
+	const char *address = "127.0.0.1";
+
+	static struct option long_options[] = {
+		{"address", required_argument, NULL, 'a'},
+		{"users", required_argument, NULL, 'u'},
+		{"rate", required_argument, NULL, 'r'},
+		{"whispers", required_argument, NULL, 'w'},
+		{"size", required_argument, NULL, 's'},
+		{"churn", required_argument, NULL, 'c'},
+		{"duration", required_argument, NULL, 'd'},
+		{"drain", required_argument, NULL, 'D'},
+		{"ramp", required_argument, NULL, 'R'},
+		{"text", no_argument, NULL, 't'},
+		{"prefix", required_argument, NULL, 'p'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "a:u:r:w:s:c:d:D:R:tp:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'a':
+				address = optarg;
+				break;
+			case 'u':
+				bench.users = atoi(optarg);
+				break;
+			case 'r':
+				bench.rate = atof(optarg);
+				break;
+			case 'w':
+				bench.whispers = atof(optarg);
+				break;
+			case 's':
+				bench.size = atoi(optarg);
+				break;
+			case 'c':
+				bench.churn = atof(optarg);
+				break;
+			case 'd':
+				bench.duration = atof(optarg);
+				break;
+			case 'D':
+				bench.drain = atof(optarg);
+				break;
+			case 'R':
+				bench.ramp = atoi(optarg);
+				break;
+			case 't':
+				bench.binary = 0;
+				break;
+			case 'p':
+				bench.prefix = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	// (a name is the prefix, the user's number and a generation, e.g. "bench12.3")
+	if (optind != argc - 1 || bench.users < 2 || bench.rate < 0 || bench.whispers < 0 || bench.whispers > 1 ||
+		bench.size < 24 || bench.size > MAX_FRAME_LEN / 2 || bench.churn < 0 || bench.duration <= 0 ||
+		bench.drain < 0 || bench.ramp < 1 || strlen(bench.prefix) + 10 > MAX_USERNAME_LEN ||
+		strchr(bench.prefix, ' ') != NULL) {
+		usage(argv[0]);
+	}
+
+	if (!bench_resolve(&bench, address, argv[optind]) || !bench_raise_fd_limit(bench.users)) {
+		return -1;
+	}
+
+	srandom(time(NULL));
+	printf("%d users, %.0f messages/s (%.0f%% whispers) of %d bytes, %.1f churn/s, %s, for %.1f s\n",
+		bench.users, bench.rate, bench.whispers * 100, bench.size, bench.churn,
+		bench.binary ? "binary" : "text", bench.duration);
+	bench_run(&bench);
+	return 0;
+}
@@ -0,0 +1,344 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// times the building blocks of the server's hot path in isolation: parsing
+// and decoding commands, looking up users, formatting the user list,
+// validating usernames, and formatting, encoding and fanning out messages,
+// each at a range of user counts and message sizes.
+//
+// usage: tinychat_micro_bench [--min-time S] [--filter NAME]
+//
+// every case is run (doubling its iterations) for at least --min-time
+// seconds, and printed as a line of csv, so runs from before and after a
+// change can be compared by a script:
+//
+//   case,users,bytes,iterations,ns_per_op
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "protocol.h"
+#include "server/directory.h"
+#include "server/message.h"
+
+// the user counts and message sizes every case that depends on them is run at
+static const int user_counts[] = { 16, 256, 4096, 65536 };
+static const int message_sizes[] = { 16, 64, 256, 1024 };
+
+#define NUM_USER_COUNTS (int)(sizeof(user_counts) / sizeof(user_counts[0]))
+#define NUM_MESSAGE_SIZES (int)(sizeof(message_sizes) / sizeof(message_sizes[0]))
+
+// what a case works on: a directory of users, their names (and as many
+// that are not taken), a payload and a frame to parse
+struct fixture {
+	struct directory directory;
+	int users;
+	char (*names)[MAX_USERNAME_LEN + 1];
+	char (*missing)[MAX_USERNAME_LEN + 1];
+	char *payload;
+	int size;
+	char *frame;
+	size_t frame_len;
+};
+
+// a single case, run iterations times
+typedef uint64_t (*bench_fn)(struct fixture *fixture, uint64_t iterations);
+
+// the benchmark's settings
+static double min_time = 0.2;
+static const char *filter = NULL;
+
+// keeps the compiler from optimizing the measured work away
+static volatile uint64_t sink;
+
+// returns the current time in seconds
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// exits, out of memory
+static void out_of_memory(void) {
+	perror("allocation failed");
+	exit(-1);
+}
+
+// runs the case until it takes at least min_time, and prints how long an iteration took
+static void bench_case(const char *name, bench_fn fn, struct fixture *fixture, int users, int bytes) {
+	if (filter != NULL && strstr(name, filter) == NULL) {
+		return;
+	}
+
+	// (warm up, then double the iterations until the run is long enough to trust)
+	sink += fn(fixture, 1);
+	uint64_t iterations = 1;
+	double elapsed;
+	while (1) {
+		double start = now();
+		sink += fn(fixture, iterations);
+		elapsed = now() - start;
+		if (elapsed >= min_time) {
+			break;
+		}
+		iterations *= 2;
+	}
+
+	printf("%s,%d,%d,%llu,%.2f\n", name, users, bytes, (unsigned long long)iterations,
+		elapsed * 1e9 / iterations);
+	fflush(stdout);
+}
+
+
+
+//
+// FIXTURE function(s)
+//
+
+// fills the directory with users (named as the server's users might be)
+static void fixture_set_users(struct fixture *fixture, int users) {
+	fixture->users = users;
+	if (!directory_initialize(&fixture->directory, users, 0)) {
+		exit(-1);
+	}
+
+	fixture->names = malloc(users * sizeof(*fixture->names));
+	fixture->missing = malloc(users * sizeof(*fixture->missing));
+	if (fixture->names == NULL || fixture->missing == NULL) {
+		out_of_memory();
+	}
+
+	for (int u = 0; u < users; u++) {
+		snprintf(fixture->names[u], MAX_USERNAME_LEN + 1, "user%d", u);
+		snprintf(fixture->missing[u], MAX_USERNAME_LEN + 1, "nobody%d", u);
+		directory_add(&fixture->directory, fixture->names[u], u % 4, u / 4);
+	}
+}
+
+// frees the directory
+static void fixture_clear_users(struct fixture *fixture) {
+	free(fixture->directory.entries);
+	free(fixture->names);
+	free(fixture->missing);
+	fixture->names = NULL;
+	fixture->missing = NULL;
+}
+
+// makes a payload of size bytes
+static void fixture_set_size(struct fixture *fixture, int size) {
+	fixture->size = size;
+	if ((fixture->payload = realloc(fixture->payload, size + 1)) == NULL) {
+		out_of_memory();
+	}
+	memset(fixture->payload, 'x', size);
+	fixture->payload[size] = '\0';
+}
+
+// makes the frame to parse: the packet in the given encoding
+static void fixture_set_frame(struct fixture *fixture, const struct protocol_packet *packet, int binary) {
+	fixture->frame_len = binary ? protocol_encoded_len(packet) : protocol_text_len(packet);
+	if ((fixture->frame = realloc(fixture->frame, fixture->frame_len + 1)) == NULL) {
+		out_of_memory();
+	}
+
+	if (binary) {
+		protocol_encode(packet, fixture->frame);
+	}
+	else {
+		protocol_format_text(packet, fixture->frame);
+	}
+	fixture->frame[fixture->frame_len] = '\0';
+}
+
+
+
+//
+// CASE function(s)
+//
+
+static uint64_t bench_parse_text(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	struct protocol_packet packet;
+	for (uint64_t i = 0; i < iterations; i++) {
+		protocol_parse_text(fixture->frame, fixture->frame_len, &packet);
+		total += packet.opcode + packet.payload_len;
+	}
+	return total;
+}
+
+static uint64_t bench_decode_binary(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	struct protocol_packet packet;
+	for (uint64_t i = 0; i < iterations; i++) {
+		total += protocol_decode(fixture->frame, fixture->frame_len, &packet) + packet.payload_len;
+	}
+	return total;
+}
+
+static uint64_t bench_lookup_hit(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	int shard, index;
+	for (uint64_t i = 0; i < iterations; i++) {
+		total += directory_lookup(&fixture->directory, fixture->names[i % fixture->users], &shard, &index);
+	}
+	return total;
+}
+
+static uint64_t bench_lookup_miss(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	int shard, index;
+	for (uint64_t i = 0; i < iterations; i++) {
+		total += directory_lookup(&fixture->directory, fixture->missing[i % fixture->users], &shard, &index);
+	}
+	return total;
+}
+
+static uint64_t bench_format_userlist(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < iterations; i++) {
+		struct message *message = directory_format_userlist(&fixture->directory);
+		total += message->len;
+		message_unref(message);
+	}
+	return total;
+}
+
+static uint64_t bench_valid_username(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	int err;
+	for (uint64_t i = 0; i < iterations; i++) {
+		total += is_valid_username(fixture->names[i % fixture->users], &err);
+	}
+	return total;
+}
+
+static uint64_t bench_format_message(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < iterations; i++) {
+		struct message *message = message_format("/broadcasted %s %s", fixture->names[0], fixture->payload);
+		total += message->len;
+		message_unref(message);
+	}
+	return total;
+}
+
+static uint64_t bench_encode_message(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < iterations; i++) {
+		struct message *message = message_format("/broadcasted %s %s", fixture->names[0], fixture->payload);
+		total += message_binary(message)->len;
+		message_unref(message);
+	}
+	return total;
+}
+
+// takes (and drops) a reference for every user, as a broadcast's fan-out does
+static uint64_t bench_fanout(struct fixture *fixture, uint64_t iterations) {
+	uint64_t total = 0;
+	struct message **queued = malloc(fixture->users * sizeof(struct message*));
+	if (queued == NULL) {
+		out_of_memory();
+	}
+
+	for (uint64_t i = 0; i < iterations; i++) {
+		struct message *message = message_format("/broadcasted %s %s", fixture->names[0], fixture->payload);
+		for (int u = 0; u < fixture->users; u++) {
+			queued[u] = message_ref(message);
+		}
+		message_unref(message);
+
+		for (int u = 0; u < fixture->users; u++) {
+			total += queued[u]->len;
+			message_unref(queued[u]);
+		}
+	}
+	free(queued);
+	return total;
+}
+
+// prints the usage message and exits
+static void usage(const char *program) {
+	printf("usage: %s [--min-time S] [--filter NAME]\n", program);
+	exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+	static struct option long_options[] = {
+		{"min-time", required_argument, NULL, 't'},
+		{"filter", required_argument, NULL, 'f'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "t:f:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 't':
+				min_time = atof(optarg);
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (min_time <= 0 || optind != argc) {
+		usage(argv[0]);
+	}
+
+	struct fixture fixture;
+	memset(&fixture, 0, sizeof(fixture));
+	printf("case,users,bytes,iterations,ns_per_op\n");
+
+	// parsing depends only on the message size
+	fixture_set_users(&fixture, 1);
+	for (int s = 0; s < NUM_MESSAGE_SIZES; s++) {
+		fixture_set_size(&fixture, message_sizes[s]);
+
+		struct protocol_packet packet;
+		protocol_packet_initialize(&packet, OP_BROADCAST, NULL, NULL, fixture.payload);
+		fixture_set_frame(&fixture, &packet, 0);
+		bench_case("parse_text_broadcast", bench_parse_text, &fixture, 0, fixture.size);
+		fixture_set_frame(&fixture, &packet, 1);
+		bench_case("decode_binary_broadcast", bench_decode_binary, &fixture, 0, fixture.size);
+
+		protocol_packet_initialize(&packet, OP_WHISPER, NULL, "user0", fixture.payload);
+		fixture_set_frame(&fixture, &packet, 0);
+		bench_case("parse_text_whisper", bench_parse_text, &fixture, 0, fixture.size);
+		fixture_set_frame(&fixture, &packet, 1);
+		bench_case("decode_binary_whisper", bench_decode_binary, &fixture, 0, fixture.size);
+
+		protocol_packet_initialize(&packet, OP_ROOMCASTED, "user0", "lobby", fixture.payload);
+		fixture_set_frame(&fixture, &packet, 0);
+		bench_case("parse_text_roomcasted", bench_parse_text, &fixture, 0, fixture.size);
+
+		bench_case("format_message", bench_format_message, &fixture, 0, fixture.size);
+		bench_case("format_encode_message", bench_encode_message, &fixture, 0, fixture.size);
+	}
+	fixture_clear_users(&fixture);
+
+	// then everything that depends on the number of users
+	fixture_set_size(&fixture, 64);
+	for (int u = 0; u < NUM_USER_COUNTS; u++) {
+		fixture_set_users(&fixture, user_counts[u]);
+		bench_case("lookup_hit", bench_lookup_hit, &fixture, fixture.users, 0);
+		bench_case("lookup_miss", bench_lookup_miss, &fixture, fixture.users, 0);
+		bench_case("valid_username", bench_valid_username, &fixture, fixture.users, 0);
+		bench_case("format_userlist", bench_format_userlist, &fixture, fixture.users, 0);
+		bench_case("fanout", bench_fanout, &fixture, fixture.users, fixture.size);
+		fixture_clear_users(&fixture);
+	}
+
+	free(fixture.payload);
+	free(fixture.frame);
+	return 0;
+}
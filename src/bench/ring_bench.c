@@ -0,0 +1,304 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+// measures how many elements per second the lock-free rings (see ring.h) can
+// hand from producers to a single consumer, against a mutex protected ring of
+// the same size as a baseline.
+//
+// usage: tinychat_ring_bench [--items N] [--producers N] [--capacity N] [--processes]
+//
+// with --processes the ring is mapped into shared memory and every producer
+// is a forked process rather than a thread.
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "ring.h"
+
+// the element handed over (about the size of a mail descriptor)
+struct element {
+	uint32_t producer;
+	uint32_t pad;
+	uint64_t sequence;
+	uint64_t payload[2];
+};
+
+// a mutex protected ring, for comparison
+struct locked_ring {
+	pthread_mutex_t lock;
+	uint64_t head;
+	uint64_t tail;
+	uint32_t mask;
+	struct element slots[];
+};
+
+// the kind of ring being measured
+#define KIND_SPSC 0
+#define KIND_MPSC 1
+#define KIND_LOCKED 2
+
+static const char *kind_names[] = { "spsc", "mpsc", "mutex" };
+
+// the benchmark's settings, and the ring being measured
+struct bench {
+	int kind;
+	int producers;
+	uint64_t items;
+	uint32_t capacity;
+	int processes;
+	void *ring;
+};
+
+// returns the current time in seconds
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns size bytes of zeroed memory, shared with forked producers if shared is set
+static void *bench_alloc(size_t size, int shared) {
+	void *memory;
+	if (shared) {
+		memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		memory = memory == MAP_FAILED ? NULL : memory;
+	}
+	else {
+		memory = aligned_alloc(CACHE_LINE_SIZE, (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+	}
+
+	if (memory == NULL) {
+		perror("allocation failed");
+		exit(-1);
+	}
+	return memory;
+}
+
+static int locked_push(struct locked_ring *ring, const struct element *elem) {
+	int pushed = 0;
+	pthread_mutex_lock(&ring->lock);
+	if (ring->tail - ring->head <= ring->mask) {
+		ring->slots[ring->tail++ & ring->mask] = *elem;
+		pushed = 1;
+	}
+	pthread_mutex_unlock(&ring->lock);
+	return pushed;
+}
+
+static int locked_pop(struct locked_ring *ring, struct element *elem) {
+	int popped = 0;
+	pthread_mutex_lock(&ring->lock);
+	if (ring->head != ring->tail) {
+		*elem = ring->slots[ring->head++ & ring->mask];
+		popped = 1;
+	}
+	pthread_mutex_unlock(&ring->lock);
+	return popped;
+}
+
+// creates the ring being measured
+static void bench_create_ring(struct bench *bench) {
+	if (bench->kind == KIND_SPSC) {
+		bench->ring = bench_alloc(spsc_ring_bytes(bench->capacity, sizeof(struct element)), bench->processes);
+		spsc_ring_initialize(bench->ring, bench->capacity, sizeof(struct element));
+	}
+	else if (bench->kind == KIND_MPSC) {
+		bench->ring = bench_alloc(mpsc_ring_bytes(bench->capacity, sizeof(struct element)), bench->processes);
+		mpsc_ring_initialize(bench->ring, bench->capacity, sizeof(struct element));
+	}
+	else {
+		struct locked_ring *ring = bench_alloc(sizeof(struct locked_ring) +
+			bench->capacity * sizeof(struct element), bench->processes);
+
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, bench->processes ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
+		pthread_mutex_init(&ring->lock, &attr);
+		ring->mask = bench->capacity - 1;
+		bench->ring = ring;
+	}
+}
+
+// the argument handed to each producer
+struct producer_arg {
+	struct bench *bench;
+	uint32_t id;
+};
+
+// pushes this producer's share of the items, yielding whenever the ring is full
+static void *produce(void *arg) {
+	struct producer_arg *producer = arg;
+	struct bench *bench = producer->bench;
+	uint64_t items = bench->items / bench->producers;
+
+	struct element elem;
+	memset(&elem, 0, sizeof(elem));
+	elem.producer = producer->id;
+
+	for (uint64_t i = 0; i < items; i++) {
+		elem.sequence = i;
+		int pushed;
+		do {
+			if (bench->kind == KIND_SPSC) {
+				pushed = spsc_ring_push(bench->ring, &elem, sizeof(elem));
+			}
+			else if (bench->kind == KIND_MPSC) {
+				pushed = mpsc_ring_push(bench->ring, &elem, sizeof(elem));
+			}
+			else {
+				pushed = locked_push(bench->ring, &elem);
+			}
+			if (!pushed) {
+				sched_yield();
+			}
+		} while (!pushed);
+	}
+	return NULL;
+}
+
+// runs a single measurement, and prints its throughput
+static void bench_run(struct bench *bench) {
+	bench_create_ring(bench);
+
+	struct producer_arg args[bench->producers];
+	pthread_t threads[bench->producers];
+	pid_t pids[bench->producers];
+	uint64_t expected[bench->producers];
+	uint64_t total = (bench->items / bench->producers) * bench->producers;
+
+	double start = now();
+	for (int p = 0; p < bench->producers; p++) {
+		args[p].bench = bench;
+		args[p].id = p;
+		expected[p] = 0;
+
+		if (bench->processes) {
+			if ((pids[p] = fork()) == 0) {
+				produce(&args[p]);
+				_exit(0);
+			}
+		}
+		else {
+			pthread_create(&threads[p], NULL, produce, &args[p]);
+		}
+	}
+
+	// consume everything, checking that each producer's elements arrive in order
+	struct element elem;
+	for (uint64_t received = 0; received < total; ) {
+		int popped;
+		if (bench->kind == KIND_SPSC) {
+			popped = spsc_ring_pop(bench->ring, &elem, sizeof(elem));
+		}
+		else if (bench->kind == KIND_MPSC) {
+			popped = mpsc_ring_pop(bench->ring, &elem, sizeof(elem));
+		}
+		else {
+			popped = locked_pop(bench->ring, &elem);
+		}
+
+		if (!popped) {
+			sched_yield();
+			continue;
+		}
+
+		if (elem.sequence != expected[elem.producer]++) {
+			printf("producer %u: expected element %llu, got %llu\n", elem.producer,
+				(unsigned long long)expected[elem.producer] - 1, (unsigned long long)elem.sequence);
+			exit(-1);
+		}
+		received++;
+	}
+	double elapsed = now() - start;
+
+	for (int p = 0; p < bench->producers; p++) {
+		if (bench->processes) {
+			waitpid(pids[p], NULL, 0);
+		}
+		else {
+			pthread_join(threads[p], NULL);
+		}
+	}
+
+	printf("%-6s %2d producer%s  %10llu items  %8.3f s  %8.2f M items/s\n", kind_names[bench->kind],
+		bench->producers, bench->producers == 1 ? " " : "s", (unsigned long long)total, elapsed,
+		total / elapsed / 1e6);
+}
+
+// prints the usage message and exits
+static void usage(const char *program) {
+	printf("usage: %s [--items N] [--producers N] [--capacity N] [--processes]\n", program);
+	exit(-1);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench bench;
+	bench.items = 10 * 1000 * 1000;
+	bench.capacity = 4096;
+	bench.processes = 0;
+	int max_producers = 4;
+
+	static struct option long_options[] = {
+		{"items", required_argument, NULL, 'n'},
+		{"producers", required_argument, NULL, 'p'},
+		{"capacity", required_argument, NULL, 'c'},
+		{"processes", no_argument, NULL, 'f'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "n:p:c:f", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'n':
+				bench.items = strtoull(optarg, NULL, 10);
+				break;
+			case 'p':
+				max_producers = atoi(optarg);
+				break;
+			case 'c':
+				bench.capacity = atoi(optarg);
+				break;
+			case 'f':
+				bench.processes = 1;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (bench.items < 1 || max_producers < 1 || bench.capacity == 0 ||
+		(bench.capacity & (bench.capacity - 1)) != 0) {
+		usage(argv[0]);
+	}
+
+	printf("%s, ring capacity %u, %ld cpus\n", bench.processes ? "processes" : "threads", bench.capacity,
+		sysconf(_SC_NPROCESSORS_ONLN));
+
+	// a single producer, on every kind of ring
+	bench.producers = 1;
+	for (bench.kind = KIND_SPSC; bench.kind <= KIND_LOCKED; bench.kind++) {
+		bench_run(&bench);
+	}
+
+	// then contended, on the kinds that allow it
+	for (bench.producers = 2; bench.producers <= max_producers; bench.producers *= 2) {
+		for (bench.kind = KIND_MPSC; bench.kind <= KIND_LOCKED; bench.kind++) {
+			bench_run(&bench);
+		}
+	}
+
+	return 0;
+}
@@ -13,6 +13,9 @@ struct _ChatFrame {
 
     GtkBox *m_messageBox;
     GtkComboBoxText *m_userlist_comboBoxText;
+    GtkComboBoxText *m_room_comboBoxText;
+    GtkEntry *m_room_entry;
+    GtkListStore *m_roomlist_store;
     GtkEntry *m_message_entry;
     GtkLabel *m_character_counter;
 };
@@ -128,14 +131,51 @@ void chat_frame_add_private_message(ChatFrame *self, const char *sender, const c
 
 
 
+/* Adds a message received from another member of a room to the ChatFrame. */
+void chat_frame_add_room_message(ChatFrame *self, const char *room, const char *sender, const char *message) {
+    char title[BUFFER_SIZE];
+    memset(title, '\0', BUFFER_SIZE);
+    sprintf(title, "%s said in %s", sender, room);
+
+    GtkWidget *messageObj = message_display_new(title, message, GTK_ALIGN_START,
+        "broadcast", "broadcast");
+
+    gtk_box_pack_start(self->m_messageBox, messageObj, 0, 0, 0);
+    gtk_widget_show_all(messageObj);
+}
+
+
+
+/* Adds a message you sent to a room to the ChatFrame. */
+void add_sent_room_message(ChatFrame *self, const char *room, const char *message) {
+    char title[BUFFER_SIZE];
+    memset(title, '\0', BUFFER_SIZE);
+    sprintf(title, "you said in %s", room);
+
+    GtkWidget *messageObj = message_display_new(title, message, GTK_ALIGN_END,
+        "broadcast", "broadcast");
+
+    gtk_box_pack_start(self->m_messageBox, messageObj, 0, 0, 0);
+    gtk_widget_show_all(messageObj);
+}
+
+
+
 /* Fires when the user intends to send a message from the ChatFrame. Specifically
 when the send button is pressed or the enter key is hit in the message entry. */
 void on_send_intent(ChatFrame *self) {
     const gchar *recipient = gtk_combo_box_text_get_active_text(self->m_userlist_comboBoxText);
     const gchar *message = gtk_entry_get_text(self->m_message_entry);
 
+    // messages to "Everyone" only go to the selected room, if there is one.
+    const gchar *room = gtk_combo_box_get_active_id(GTK_COMBO_BOX(self->m_room_comboBoxText));
+
     // Parses the recipient and fires the appropriate signal.
-    if (strcmp(recipient, "Everyone") == 0) {
+    if (strcmp(recipient, "Everyone") == 0 && room != NULL) {
+        g_signal_emit_by_name(self, "send-room-message-intent", room, message);
+        add_sent_room_message(self, room, message);
+    }
+    else if (strcmp(recipient, "Everyone") == 0) {
         g_signal_emit_by_name(self, "send-message-intent", message);
         add_sent_message(self, message);
     }
@@ -188,16 +228,147 @@ void chat_frame_update_userlist(ChatFrame *self, const char *userlist) {
     gtk_combo_box_set_active(GTK_COMBO_BOX(self->m_userlist_comboBoxText), 0);
 
     // make a copy of the userlist to tokenize.
-    char tmp_userlist[BUFFER_SIZE];
-    memset(tmp_userlist, '\0', BUFFER_SIZE);
-    strcpy(tmp_userlist, userlist);
+    char *tmp_userlist = g_strdup(userlist);
 
     // add each token back to the userlist combo box.
     char *token = strtok(tmp_userlist, " ");
     while (token != NULL) {
-    	gtk_combo_box_text_append(self->m_userlist_comboBoxText, NULL, token);
+    	gtk_combo_box_text_append(self->m_userlist_comboBoxText, token, token);
     	token = strtok(NULL, " ");
     }
+
+    g_free(tmp_userlist);
+}
+
+
+
+/* Adds a user who joined to the userlist combobox. */
+void chat_frame_add_user(ChatFrame *self, const char *username) {
+    gtk_combo_box_text_append(self->m_userlist_comboBoxText, username, username);
+}
+
+
+
+/* A utility function, finds the combobox entry with the given id.
+(ret: 1 found, 0 not found) */
+int combo_box_find_id(GtkComboBox *combo, const char *id, GtkTreeIter *iter) {
+    GtkTreeModel *model = gtk_combo_box_get_model(combo);
+    gint id_column = gtk_combo_box_get_id_column(combo);
+
+    gboolean valid = gtk_tree_model_get_iter_first(model, iter);
+    while (valid) {
+        gchar *entry_id = NULL;
+        gtk_tree_model_get(model, iter, id_column, &entry_id, -1);
+
+        int found = entry_id != NULL && strcmp(entry_id, id) == 0;
+        g_free(entry_id);
+        if (found) {
+            return 1;
+        }
+
+        valid = gtk_tree_model_iter_next(model, iter);
+    }
+    return 0;
+}
+
+
+
+/* Removes a user who left from the userlist combobox, falling back to the
+"Everyone" recipient if they were selected. */
+void chat_frame_remove_user(ChatFrame *self, const char *username) {
+    GtkComboBox *combo = GTK_COMBO_BOX(self->m_userlist_comboBoxText);
+
+    GtkTreeIter iter;
+    if (combo_box_find_id(combo, username, &iter)) {
+        gboolean was_active = gtk_combo_box_get_active_id(combo) != NULL &&
+            strcmp(gtk_combo_box_get_active_id(combo), username) == 0;
+        gtk_list_store_remove(GTK_LIST_STORE(gtk_combo_box_get_model(combo)), &iter);
+
+        if (was_active) {
+            gtk_combo_box_set_active(combo, 0);
+        }
+    }
+}
+
+
+
+/* Adds a room you joined to the room combobox (once). */
+void chat_frame_add_room(ChatFrame *self, const char *room) {
+    GtkTreeIter iter;
+    if (!combo_box_find_id(GTK_COMBO_BOX(self->m_room_comboBoxText), room, &iter)) {
+        gtk_combo_box_text_append(self->m_room_comboBoxText, room, room);
+    }
+}
+
+
+
+/* Clears the room suggestions and repopulates them based on the updated
+roomlist string. */
+void chat_frame_update_roomlist(ChatFrame *self, const char *roomlist) {
+    gtk_list_store_clear(self->m_roomlist_store);
+
+    char *tmp_roomlist = g_strdup(roomlist);
+
+    char *token = strtok(tmp_roomlist, " ");
+    while (token != NULL) {
+        gtk_list_store_insert_with_values(self->m_roomlist_store, NULL, -1, 0, token, -1);
+        token = strtok(NULL, " ");
+    }
+
+    g_free(tmp_roomlist);
+}
+
+
+
+/* Fires when the user intends to join the room typed into the room entry. */
+void on_join_room_intent(ChatFrame *self) {
+    const gchar *room = gtk_entry_get_text(self->m_room_entry);
+
+    int err;
+    if (!is_valid_room_name(room, &err)) {
+        GtkMessageDialog *dia = GTK_MESSAGE_DIALOG(gtk_message_dialog_new(GTK_WINDOW(
+            gtk_widget_get_toplevel(GTK_WIDGET(self))),
+            GTK_DIALOG_MODAL, GTK_MESSAGE_WARNING, GTK_BUTTONS_CLOSE, "Invalid Room"));
+        gtk_message_dialog_format_secondary_text(dia,
+            "Room names must be 1 to %d characters long, without spaces.", MAX_ROOM_NAME_LEN);
+
+        gtk_dialog_run(GTK_DIALOG(dia));
+        gtk_widget_destroy(GTK_WIDGET(dia));
+        return;
+    }
+
+    g_signal_emit_by_name(self, "join-room-intent", room);
+    gtk_entry_set_text(self->m_room_entry, "");
+}
+
+
+
+/* Fires when the user intends to leave the selected room. */
+void on_leave_room_intent(ChatFrame *self) {
+    GtkComboBox *combo = GTK_COMBO_BOX(self->m_room_comboBoxText);
+    if (gtk_combo_box_get_active_id(combo) == NULL) {
+        return;
+    }
+
+    // the id is freed along with the entry, so keep a copy around.
+    gchar *room = g_strdup(gtk_combo_box_get_active_id(combo));
+    g_signal_emit_by_name(self, "leave-room-intent", room);
+
+    GtkTreeIter iter;
+    if (combo_box_find_id(combo, room, &iter)) {
+        gtk_list_store_remove(GTK_LIST_STORE(gtk_combo_box_get_model(combo)), &iter);
+    }
+    gtk_combo_box_set_active(combo, 0);
+
+    g_free(room);
+}
+
+
+
+/* Fires when the room entry gains focus, to refresh the room suggestions. */
+gboolean on_room_entry_focus_in(ChatFrame *self) {
+    g_signal_emit_by_name(self, "list-rooms-intent");
+    return FALSE;
 }
 
 
@@ -216,6 +387,12 @@ void chat_frame_reset(ChatFrame *self) {
 
     // reset the message entry.
     gtk_entry_set_text(self->m_message_entry, "");
+
+    // forget the rooms from the previous session, leaving only "All Rooms".
+    gtk_combo_box_text_remove_all(self->m_room_comboBoxText);
+    gtk_combo_box_text_append(self->m_room_comboBoxText, NULL, "All Rooms");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(self->m_room_comboBoxText), 0);
+    gtk_list_store_clear(self->m_roomlist_store);
 }
 
 
@@ -229,6 +406,22 @@ static void chat_frame_class_init (ChatFrameClass *class) {
     /* Fires when the user intends to send a message */
     g_signal_new("send-private-message-intent", CHAT_FRAME_TYPE_BIN, G_SIGNAL_RUN_FIRST,
         0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_POINTER);
+
+    /* Fires when the user intends to send a message to a room */
+    g_signal_new("send-room-message-intent", CHAT_FRAME_TYPE_BIN, G_SIGNAL_RUN_FIRST,
+        0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_POINTER);
+
+    /* Fires when the user intends to join a room */
+    g_signal_new("join-room-intent", CHAT_FRAME_TYPE_BIN, G_SIGNAL_RUN_FIRST,
+        0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    /* Fires when the user intends to leave a room */
+    g_signal_new("leave-room-intent", CHAT_FRAME_TYPE_BIN, G_SIGNAL_RUN_FIRST,
+        0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    /* Fires when the ChatFrame wants an up to date list of rooms */
+    g_signal_new("list-rooms-intent", CHAT_FRAME_TYPE_BIN, G_SIGNAL_RUN_FIRST,
+        0, NULL, NULL, NULL, G_TYPE_NONE, 0);
 }
 
 
@@ -252,6 +445,42 @@ static void chat_frame_init (ChatFrame *self) {
     gtk_box_pack_start(commandsBox, GTK_WIDGET(self->m_userlist_comboBoxText), 0, 1, 0);
     gtk_box_reorder_child(commandsBox, GTK_WIDGET(self->m_userlist_comboBoxText), 0);
 
+    /* set the room combo box to a new GtkComboBoxText instance, next to the
+    userlist box. messages to "Everyone" go to the selected room. */
+    self->m_room_comboBoxText = GTK_COMBO_BOX_TEXT(gtk_combo_box_text_new());
+    gtk_widget_set_tooltip_text(GTK_WIDGET(self->m_room_comboBoxText), "Message Room");
+    gtk_combo_box_text_append(self->m_room_comboBoxText, NULL, "All Rooms");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(self->m_room_comboBoxText), 0);
+    gtk_box_pack_start(commandsBox, GTK_WIDGET(self->m_room_comboBoxText), 0, 1, 0);
+    gtk_box_reorder_child(commandsBox, GTK_WIDGET(self->m_room_comboBoxText), 1);
+
+    // the leave button leaves the selected room.
+    GtkWidget *leaveButton = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(leaveButton, "Leave Room");
+    g_signal_connect_swapped(leaveButton, "clicked", (GCallback)on_leave_room_intent, self);
+    gtk_box_pack_start(commandsBox, leaveButton, 0, 1, 0);
+    gtk_box_reorder_child(commandsBox, leaveButton, 2);
+
+    /* the room entry joins the room typed into it, suggesting the rooms that
+    already exist. */
+    self->m_room_entry = GTK_ENTRY(gtk_entry_new());
+    gtk_entry_set_placeholder_text(self->m_room_entry, "Join Room");
+    gtk_entry_set_width_chars(self->m_room_entry, MAX_ROOM_NAME_LEN / 2);
+    gtk_entry_set_max_length(self->m_room_entry, MAX_ROOM_NAME_LEN);
+    g_signal_connect_swapped(self->m_room_entry, "activate",
+        (GCallback)on_join_room_intent, self);
+    g_signal_connect_swapped(self->m_room_entry, "focus-in-event",
+        (GCallback)on_room_entry_focus_in, self);
+    gtk_box_pack_start(commandsBox, GTK_WIDGET(self->m_room_entry), 0, 1, 0);
+    gtk_box_reorder_child(commandsBox, GTK_WIDGET(self->m_room_entry), 3);
+
+    self->m_roomlist_store = gtk_list_store_new(1, G_TYPE_STRING);
+    GtkEntryCompletion *completion = gtk_entry_completion_new();
+    gtk_entry_completion_set_model(completion, GTK_TREE_MODEL(self->m_roomlist_store));
+    gtk_entry_completion_set_text_column(completion, 0);
+    gtk_entry_set_completion(self->m_room_entry, completion);
+    g_object_unref(completion);
+
     // get the message entry, set its properties, and handlers.
     self->m_message_entry = GTK_ENTRY(gtk_builder_get_object(builder, "message_entry"));
     gtk_entry_set_max_length(self->m_message_entry, MAX_MESSAGE_LEN);
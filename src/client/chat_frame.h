@@ -23,15 +23,30 @@ ChatFrame* chat_frame_new(void);
 displayed messages, clears the userlist, etc */
 void chat_frame_reset(ChatFrame *self);
 
-/* Updates the list of users available to send messages to. */
+/* Replaces the list of users available to send messages to. */
 void chat_frame_update_userlist(ChatFrame *self, const char *userlist);
 
+/* Adds a user to the list of users available to send messages to. */
+void chat_frame_add_user(ChatFrame *self, const char *username);
+
+/* Removes a user from the list of users available to send messages to. */
+void chat_frame_remove_user(ChatFrame *self, const char *username);
+
+/* Adds a room you joined to the list of rooms available to send messages to. */
+void chat_frame_add_room(ChatFrame *self, const char *room);
+
+/* Replaces the list of rooms suggested when joining a room. */
+void chat_frame_update_roomlist(ChatFrame *self, const char *roomlist);
+
 /* Adds a message (received from Client) to the ChatFrame and displays it. */
 void chat_frame_add_message(ChatFrame *self, const char *sender, const char *message);
 
 /* Adds a private message (received from Client) to the ChatFrame and displays it. */
 void chat_frame_add_private_message(ChatFrame *self, const char *sender, const char *message);
 
+/* Adds a room message (received from Client) to the ChatFrame and displays it. */
+void chat_frame_add_room_message(ChatFrame *self, const char *room, const char *sender, const char *message);
+
 G_END_DECLS
 
 #endif  // CHAT_FRAME_H_
@@ -6,247 +6,168 @@
 
 #include "client.h"
 
-#include "common.h"
+#include "libtinychat/tinychat.h"
 
-#include <arpa/inet.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <netdb.h>
-#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <string.h>
-#include <unistd.h>
 
 struct _Client {
     GObject parent_instance;
 
-    int m_socketFd;
-    char *m_username;
-    char *m_userlist;
+    // the connection itself (see libtinychat), the main loop's watch on its
+    // socket, and the trace log it was given.
+    struct tinychat_session *m_session;
+    guint m_watch;
+    FILE *m_traceFile;
 };
 
-G_DEFINE_TYPE(Client, client, G_TYPE_OBJECT);
+// the environment variables that turn tracing on, and its default sampling.
+#define TRACE_FILE_ENV "TINYCHAT_TRACE"
+#define TRACE_EVERY_ENV "TINYCHAT_TRACE_EVERY"
+#define DEFAULT_TRACE_EVERY 10
 
+G_DEFINE_TYPE(Client, client, G_TYPE_OBJECT);
 
 
-/* sets up the initial user list */
-void userlist_update(Client *self, const char* buffer) {
-    // buffer is of form "<username1> <username2> ... <usernamei>"
 
-    // clear the userlist, just to be safe.
-    memset(self->m_userlist, '\0', sizeof(char) * BUFFER_SIZE);
+/* Each of the session's callbacks re-emits it as the matching signal. */
+static void on_message_received(void *context, const char *sender, const char *message) {
+    g_signal_emit_by_name(context, "message-received", sender, message);
+}
 
-    // Make a copy of the buffer, to retokenize.
-    char tmp_buffer[BUFFER_SIZE];
-    memset(tmp_buffer, '\0', BUFFER_SIZE);
-    strcpy(tmp_buffer, buffer);
+static void on_private_message_received(void *context, const char *sender, const char *message) {
+    g_signal_emit_by_name(context, "private-message-received", sender, message);
+}
 
-    /* retokenize the buffer to remove your own username from the list, since
-    you shouldn't be able to PM yourself. */
-    char *token = strtok(tmp_buffer, " ");
-    while (token != NULL) {
-        if (strcmp(token, self->m_username) != 0) {
-            strcat(self->m_userlist, token);
-            strcat(self->m_userlist, " ");
-        }
-        token = strtok(NULL, " ");
-    }
+static void on_room_message_received(void *context, const char *room, const char *sender, const char *message) {
+    g_signal_emit_by_name(context, "room-message-received", room, sender, message);
+}
 
-    // Signal that the userlist has been updated.
-    g_signal_emit_by_name(self, "userlist-updated", self->m_userlist);
+static void on_userlist_updated(void *context, const char *userlist) {
+    g_signal_emit_by_name(context, "userlist-updated", userlist);
 }
 
+static void on_user_joined(void *context, const char *username) {
+    g_signal_emit_by_name(context, "user-joined", username);
+}
 
+static void on_user_left(void *context, const char *username) {
+    g_signal_emit_by_name(context, "user-left", username);
+}
 
-/* Parses the incoming whisper and signals that a new private message has arrived. */
-void message_parse_whisper(Client *self, const char *buffer) {
-    // buffer is of format "<sender> <message>"
+static void on_room_joined(void *context, const char *room) {
+    g_signal_emit_by_name(context, "room-joined", room);
+}
 
-    // strtok modifies string, so we first make a copy
-    char tmp[BUFFER_SIZE];
-    memset(tmp, '\0', BUFFER_SIZE);
-    strcpy(tmp, buffer);
+static void on_room_join_failed(void *context, const char *room, const char *reason) {
+    printf("could not join room %s (%s)\n", room, reason);
+}
 
-    char *sender = strtok(tmp, " ");
-    const char *message = buffer + strlen(sender) + 1;
+static void on_roomlist_updated(void *context, const char *roomlist) {
+    g_signal_emit_by_name(context, "roomlist-updated", roomlist);
+}
 
-    g_signal_emit_by_name(self, "private-message-received", sender, message);
+static void on_connection_lost(void *context) {
+    g_signal_emit_by_name(context, "connection-lost");
 }
 
+static const struct tinychat_callbacks client_callbacks = {
+    .message_received = on_message_received,
+    .private_message_received = on_private_message_received,
+    .room_message_received = on_room_message_received,
+    .userlist_updated = on_userlist_updated,
+    .user_joined = on_user_joined,
+    .user_left = on_user_left,
+    .room_joined = on_room_joined,
+    .room_join_failed = on_room_join_failed,
+    .roomlist_updated = on_roomlist_updated,
+    .connection_lost = on_connection_lost,
+};
 
 
-/* Parses the incoming broadcast and signals that a new message has arrived. */
-void message_parse_broadcast(Client *self, const char *buffer) {
-    // buffer is of format "<sender> <message>"
 
-    // strtok modifies string, so we first make a copy
-    char tmp[BUFFER_SIZE];
-    memset(tmp, '\0', BUFFER_SIZE);
-    strcpy(tmp, buffer);
+/* Opens the trace log named by $TINYCHAT_TRACE, if it is set. One in every
+$TINYCHAT_TRACE_EVERY messages sent then carries a trace (in the binary
+protocol), and every traced message received is logged with the latency of
+each hop it took. */
+static void client_trace_open(Client *self) {
+    const char *path = getenv(TRACE_FILE_ENV);
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
 
-    char *sender = strtok(tmp, " ");
-    const char *message = buffer + strlen(sender) + 1;
+    if ((self->m_traceFile = fopen(path, "a")) == NULL) {
+        perror("fopen() failed for the trace log");
+        return;
+    }
+    setvbuf(self->m_traceFile, NULL, _IOLBF, 0);
+    fprintf(self->m_traceFile, "# id type client_sent_ns uplink_us server_us downlink_us handler_us\n");
 
-    g_signal_emit_by_name(self, "message-received", sender, message);
+    const char *every = getenv(TRACE_EVERY_ENV);
+    tinychat_set_trace(self->m_session, self->m_traceFile,
+        every != NULL && atoi(every) > 0 ? atoi(every) : DEFAULT_TRACE_EVERY);
 }
 
 
 
-/* Polls the server for new messages to read and handles them appropriatly. */
-int server_poll(Client *self) {
-    // if the connection was closed between polls, then quit polling.
-    if (self->m_socketFd == -1) {
-        return 0;
+/* Handles everything that arrived from the server, whenever the main loop
+sees the socket become readable. */
+static gboolean server_ready(GIOChannel *channel, GIOCondition condition, Client *self) {
+    if (!tinychat_process(self->m_session)) {
+        // (the connection is gone, so stop watching it)
+        self->m_watch = 0;
+        return G_SOURCE_REMOVE;
     }
+    return G_SOURCE_CONTINUE;
+}
 
-    // tepmorary buffer to hold a potential new message.
-    char tmp[BUFFER_SIZE];
-    memset(tmp, '\0', BUFFER_SIZE);
-    ssize_t nread;
-
-    // read from the socket.
-    if ((nread = read(self->m_socketFd, tmp, BUFFER_SIZE)) != -1) {
-        // if nread == 0, then the socket was closed from the other end.
-        if (nread == 0) {
-            g_signal_emit_by_name(self, "connection-lost");
-            return 0;  // return 0 to quit polling.
-        }
-        else {
-            if (memcmp(tmp, "/whispered", strlen("/whispered")) == 0) {
-				message_parse_whisper(self, tmp + strlen("/whispered") + 1);
-			}
-            else if (memcmp(tmp, "/broadcasted", strlen("/broadcasted")) == 0) {
-				message_parse_broadcast(self, tmp + strlen("/broadcasted") + 1);
-			}
-            else if (memcmp(tmp, "/userlist", strlen("/userlist")) == 0) {
-                userlist_update(self, tmp + strlen("/userlist") + 1);
-			}
-        }
-    }
 
-    // Otherwise, keep polling.
-    return 1;
+
+/* Handles whatever arrived along with the join response (i.e. the userlist),
+which is already buffered, so the socket will not wake the watch for it. */
+static gboolean server_catch_up(Client *self) {
+    if (self->m_watch != 0 && !tinychat_process(self->m_session) && self->m_watch != 0) {
+        g_source_remove(self->m_watch);
+        self->m_watch = 0;
+    }
+    return G_SOURCE_REMOVE;
 }
 
 
 
 /* Attempts to connect to the server. */
 int client_connect(Client *self, const char *port, const char *address, int *err) {
-    struct addrinfo *address_info;
-
-    // verifies that the address and port combo are valid.
-    if (getaddrinfo(address, port, NULL, &address_info) < 0) {
-		perror("getaddrinfo() failed");
-        *err = -1;
-		return 0;
-	}
-
-    // attempts to create an open socket on the system.
-    if ((self->m_socketFd = socket(address_info->ai_family, address_info->ai_socktype, address_info->ai_protocol)) < 0) {
-		perror("socket() failed");
-        *err = -2;
-		return 0;
-	}
-
-    // attempts to connect to the server via socket.
-    if (connect(self->m_socketFd, address_info->ai_addr, address_info->ai_addrlen) < 0) {
-		perror("connect() failed");
-        *err = -3;
-		return 0;
-	}
-
-    // make space for the userlist string and clear it.
-    self->m_userlist = malloc(sizeof(char) * BUFFER_SIZE);
-    memset(self->m_userlist, '\0', sizeof(char) * BUFFER_SIZE);
-
-    // return success.
-    return 1;
+    return tinychat_connect(self->m_session, port, address, err);
 }
 
 
 
 /* Closes the socket and frees the memory, essentially resetting the Client. */
 void client_disconnect(Client *self) {
-    // close the socket, if its still open.
-    if (self->m_socketFd != -1) {
-        close(self->m_socketFd);
-        self->m_socketFd = -1;
-    }
-
-    // free the username memory, if its not been freed yet.
-    if (self->m_username != NULL) {
-        free(self->m_username);
-        self->m_username = NULL;
-    }
-
-    // free the userlist memory, if its not been freed yet.
-    if (self->m_userlist != NULL) {
-        free(self->m_userlist);
-        self->m_userlist = NULL;
+    // stop watching the socket before it is closed (and its number reused).
+    if (self->m_watch != 0) {
+        g_source_remove(self->m_watch);
+        self->m_watch = 0;
     }
+    tinychat_disconnect(self->m_session);
 }
 
 
 
 /* Attempts to login to the server. */
 int client_login(Client *self, const char *username, int *err) {
-    char tmp[BUFFER_SIZE];
-    memset(tmp, '\0', BUFFER_SIZE);
-    sprintf(tmp, "/join %s", username);
-
-    // write to the server to request login
-    if (write(self->m_socketFd, tmp, strlen(tmp)) < 0) {
-        perror("write() failed during handshake");
-        *err = -3;
+    if (!tinychat_login(self->m_session, username, err)) {
         return 0;
     }
 
-    // clear the buffer to reuse it
-    memset(tmp, '\0', BUFFER_SIZE);
-
-    // read response from server
-    if (read(self->m_socketFd, tmp, BUFFER_SIZE) <= 0) {
-		perror("read() failed during handshake");
-		*err = -3;
-		return 0;
-	}
-
-    // check the response
-    if (memcmp(tmp, "/joinresponse ok", strlen("/joinresponse ok")) == 0) {
-        // set the socket to be non-blocking so we can poll it
-		if (fcntl(self->m_socketFd, F_SETFL, O_NONBLOCK) < 0) {
-			perror("fcntl() failed during handshake");
-			*err = -3;
-			return 0;
-		}
-
-        // make space for the username string and fill it.
-        self->m_username = malloc(sizeof(char) * MAX_USERNAME_LEN);
-        memset(self->m_username, '\0', sizeof(char) * MAX_USERNAME_LEN);
-        strcpy(self->m_username, username);
-
-        // install the polling function to run every few hundred ms.
-        g_timeout_add(MILLI_SLEEP_DUR, (void *)server_poll, self);
-
-        // return success.
-        return 1;
-    }
-    else if (memcmp(tmp, "/joinresponse username_taken", strlen("/joinresponse username_taken")) == 0) {
-        *err = -1;
-        return 0;
-	}
-	else if (memcmp(tmp, "/joinresponse server_full", strlen("/joinresponse server_full")) == 0) {
-        *err = -2;
-        return 0;
-	}
-	else {
-        *err = -3;
-        return 0;
-	}
+    /* watch the socket, so the client only wakes up when something arrives
+    (rather than polling it). */
+    GIOChannel *channel = g_io_channel_unix_new(tinychat_get_fd(self->m_session));
+    self->m_watch = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR, (GIOFunc)server_ready, self);
+    g_io_channel_unref(channel);
 
+    // once the main loop runs again, handle what arrived with the response.
+    g_idle_add((GSourceFunc)server_catch_up, self);
     return 1;
 }
 
@@ -254,36 +175,42 @@ int client_login(Client *self, const char *username, int *err) {
 
 /* Sends the message to all connected users. */
 int client_send_broadcast(Client *self, const char *message) {
-    // formats the message so the server can parse it.
-    char outgoing[BUFFER_SIZE];
-    memset(outgoing, '\0', BUFFER_SIZE);
-    sprintf(outgoing, "/broadcast %s", message);
-
-    // writes it to the server.
-    if (write(self->m_socketFd, outgoing, strlen(outgoing)) < 0) {
-        printf("\'write\' failed during broadcast\n");
-        return 0;
-    }
-
-    return 1;
+    return tinychat_send_broadcast(self->m_session, message);
 }
 
 
 
 /* Sends the message to the recipient. */
 int client_send_private_message(Client *self, const char *recipient, const char *message) {
-    // formats the message so the server can parse it.
-    char outgoing[BUFFER_SIZE];
-    memset(outgoing, '\0', BUFFER_SIZE);
-    sprintf(outgoing, "/whisper %s %s", recipient, message);
-
-    // writes it to the server.
-    if (write(self->m_socketFd, outgoing, strlen(outgoing)) < 0) {
-        printf("\'write\' failed during whisper\n");
-        return 0;
-    }
+    return tinychat_send_private_message(self->m_session, recipient, message);
+}
 
-    return 1;
+
+
+/* Sends the message to every member of the room. */
+int client_send_room_message(Client *self, const char *room, const char *message) {
+    return tinychat_send_room_message(self->m_session, room, message);
+}
+
+
+
+/* Asks the server to add you to the room. */
+int client_join_room(Client *self, const char *room) {
+    return tinychat_join_room(self->m_session, room);
+}
+
+
+
+/* Asks the server to remove you from the room. */
+int client_leave_room(Client *self, const char *room) {
+    return tinychat_leave_room(self->m_session, room);
+}
+
+
+
+/* Asks the server for every room with members in it. */
+int client_request_roomlist(Client *self) {
+    return tinychat_request_roomlist(self->m_session);
 }
 
 
@@ -305,10 +232,30 @@ static void client_class_init (ClientClass *class) {
     g_signal_new("private-message-received", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
     	0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_POINTER);
 
-    /* Fires on the client instance when a user has joined or left the chat. */
+    /* Fires on the client instance when the full user list arrives (on login). */
     g_signal_new("userlist-updated", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
     	0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
 
+    /* Fires on the client instance when a user has joined the chat. */
+    g_signal_new("user-joined", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
+    	0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    /* Fires on the client instance when a user has left the chat. */
+    g_signal_new("user-left", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
+    	0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    /* Fires on the client instance when a new room message is received. */
+    g_signal_new("room-message-received", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
+    	0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_POINTER, G_TYPE_POINTER, G_TYPE_POINTER);
+
+    /* Fires on the client instance when the server has added you to a room. */
+    g_signal_new("room-joined", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
+    	0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
+    /* Fires on the client instance when the list of rooms arrives. */
+    g_signal_new("roomlist-updated", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
+    	0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
+
     /* Fires on the client when the connection to the server is lost. */
     g_signal_new("connection-lost", CLIENT_TYPE_OBJECT, G_SIGNAL_RUN_FIRST,
     	0, NULL, NULL, NULL, G_TYPE_NONE, 0);
@@ -318,8 +265,12 @@ static void client_class_init (ClientClass *class) {
 
 /* Initializes the Client instance. */
 static void client_init (Client *self) {
-    // nullify the parameters initially.
-	self->m_socketFd = -1;
-    self->m_username = NULL;
-    self->m_userlist = NULL;
+    // the session lives as long as the client, and calls back into it.
+    self->m_session = tinychat_session_new(&client_callbacks, self);
+    if (self->m_session == NULL) {
+        g_error("could not create a chat session");
+    }
+    self->m_watch = 0;
+    self->m_traceFile = NULL;
+    client_trace_open(self);
 }
@@ -37,6 +37,23 @@ int client_send_broadcast(Client *self, const char *message);
 (ret: 1 success, 0 failure). */
 int client_send_private_message(Client *self, const char *recipient, const char *message);
 
+/* Sends the message to every member of the room (which you must have joined).
+(ret: 1 success, 0 failure). */
+int client_send_room_message(Client *self, const char *room, const char *message);
+
+/* Asks the server to add you to the room. "room-joined" fires once it has.
+(ret: 1 success, 0 failure). */
+int client_join_room(Client *self, const char *room);
+
+/* Asks the server to remove you from the room.
+(ret: 1 success, 0 failure). */
+int client_leave_room(Client *self, const char *room);
+
+/* Asks the server for every room with members in it. "roomlist-updated" fires
+once they arrive.
+(ret: 1 success, 0 failure). */
+int client_request_roomlist(Client *self);
+
 G_END_DECLS
 
 #endif  // CLIENT_H_
@@ -222,6 +222,16 @@ static void client_window_init (ClientWindow *self) {
     g_signal_connect_swapped(self->m_chat_frame, "send-message-intent",
         (GCallback)client_send_broadcast, self->m_client);
 
+    // Send room messages, joins, leaves and room list requests via the Client.
+    g_signal_connect_swapped(self->m_chat_frame, "send-room-message-intent",
+        (GCallback)client_send_room_message, self->m_client);
+    g_signal_connect_swapped(self->m_chat_frame, "join-room-intent",
+        (GCallback)client_join_room, self->m_client);
+    g_signal_connect_swapped(self->m_chat_frame, "leave-room-intent",
+        (GCallback)client_leave_room, self->m_client);
+    g_signal_connect_swapped(self->m_chat_frame, "list-rooms-intent",
+        (GCallback)client_request_roomlist, self->m_client);
+
     // Pass the message to the ChatFrame to display, when one arrives from the Client.
     g_signal_connect_swapped(self->m_client, "message-received",
         (GCallback)chat_frame_add_message, self->m_chat_frame);
@@ -234,6 +244,20 @@ static void client_window_init (ClientWindow *self) {
     g_signal_connect_swapped(self->m_client, "userlist-updated",
         (GCallback)chat_frame_update_userlist, self->m_chat_frame);
 
+    // Pass users joining and leaving to the ChatFrame as they happen.
+    g_signal_connect_swapped(self->m_client, "user-joined",
+        (GCallback)chat_frame_add_user, self->m_chat_frame);
+    g_signal_connect_swapped(self->m_client, "user-left",
+        (GCallback)chat_frame_remove_user, self->m_chat_frame);
+
+    // Pass room messages, joined rooms and the room list to the ChatFrame.
+    g_signal_connect_swapped(self->m_client, "room-message-received",
+        (GCallback)chat_frame_add_room_message, self->m_chat_frame);
+    g_signal_connect_swapped(self->m_client, "room-joined",
+        (GCallback)chat_frame_add_room, self->m_chat_frame);
+    g_signal_connect_swapped(self->m_client, "roomlist-updated",
+        (GCallback)chat_frame_update_roomlist, self->m_chat_frame);
+
     // Update this ClientWindow when the server connection is lost.
     g_signal_connect_swapped(self->m_client, "connection-lost",
         (GCallback)on_clientConnectionLost, self);
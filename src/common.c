@@ -7,9 +7,14 @@
 #include "common.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 int is_valid_address(const char *address, int *err) {
 	if (strlen(address) <= 0) {
@@ -55,8 +60,8 @@ int is_valid_username(const char *username, int *err) {
 		return 0;
 	}
 
-	char tmp_username[MAX_USERNAME_LEN];
-	memset(tmp_username, '\0', MAX_USERNAME_LEN);
+	char tmp_username[MAX_USERNAME_LEN + 1];
+	memset(tmp_username, '\0', MAX_USERNAME_LEN + 1);
 	strcpy(tmp_username, username);
 
 	for(int i = 0; tmp_username[i]; i++){
@@ -72,3 +77,221 @@ int is_valid_username(const char *username, int *err) {
 
 	return 1;
 }
+
+int is_valid_room_name(const char *room, int *err) {
+	if (strlen(room) <= 0) {
+		*err = -1;
+		return 0;
+	}
+
+	if (strlen(room) > MAX_ROOM_NAME_LEN) {
+		*err = -2;
+		return 0;
+	}
+
+	if (strchr(room, ' ') != NULL) {
+		*err = -3;
+		return 0;
+	}
+
+	return 1;
+}
+
+void frame_put_header(char *header, size_t len) {
+	header[0] = (len >> 24) & 0xff;
+	header[1] = (len >> 16) & 0xff;
+	header[2] = (len >> 8) & 0xff;
+	header[3] = len & 0xff;
+}
+
+size_t frame_get_header(const char *header) {
+	const unsigned char *h = (const unsigned char *)header;
+	return ((size_t)h[0] << 24) | ((size_t)h[1] << 16) | ((size_t)h[2] << 8) | (size_t)h[3];
+}
+
+// returns the current (monotonic) time in milliseconds
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int frame_write(int fd, const char *payload, size_t len) {
+	char header[FRAME_HEADER_LEN];
+	frame_put_header(header, len);
+
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = FRAME_HEADER_LEN;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = len;
+
+	// a short write would leave the stream out of sync, so finish it
+	size_t remaining = FRAME_HEADER_LEN + len;
+	int iovcnt = 2;
+	struct iovec *cur = iov;
+	long long deadline = -1;
+	while (remaining > 0) {
+		ssize_t nwritten = writev(fd, cur, iovcnt);
+		if (nwritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			// a non-blocking fd that is full part way through a frame is
+			// waited on (for a while), rather than leaving half a frame on the wire
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && remaining < FRAME_HEADER_LEN + len) {
+				if (deadline < 0) {
+					deadline = now_ms() + FRAME_WRITE_TIMEOUT_MS;
+				}
+				long long wait = deadline - now_ms();
+				if (wait <= 0) {
+					errno = ETIMEDOUT;
+					return 0;
+				}
+
+				struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+				poll(&pfd, 1, (int)wait);
+				continue;
+			}
+			return 0;
+		}
+
+		remaining -= nwritten;
+		while (iovcnt > 0 && (size_t)nwritten >= cur->iov_len) {
+			nwritten -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			cur->iov_base = (char *)cur->iov_base + nwritten;
+			cur->iov_len -= nwritten;
+		}
+	}
+
+	return 1;
+}
+
+void frame_decoder_initialize(struct frame_decoder *decoder) {
+	decoder->buf = NULL;
+	decoder->cap = 0;
+	decoder->start = 0;
+	decoder->end = 0;
+	decoder->nul_at = 0;
+	decoder->nul_saved = '\0';
+}
+
+void frame_decoder_free(struct frame_decoder *decoder) {
+	free(decoder->buf);
+	frame_decoder_initialize(decoder);
+}
+
+// puts back the byte that was overwritten to nul-terminate the last payload
+static void frame_decoder_restore(struct frame_decoder *decoder) {
+	if (decoder->nul_at != 0) {
+		decoder->buf[decoder->nul_at] = decoder->nul_saved;
+		decoder->nul_at = 0;
+	}
+}
+
+// makes room for at least len more bytes (plus a nul terminator) at the end of the buffer
+// (ret: 1 success, 0 failure)
+static int frame_decoder_reserve(struct frame_decoder *decoder, size_t len) {
+	frame_decoder_restore(decoder);
+
+	// move the unconsumed bytes to the front of the buffer...
+	if (decoder->start > 0) {
+		memmove(decoder->buf, decoder->buf + decoder->start, decoder->end - decoder->start);
+		decoder->end -= decoder->start;
+		decoder->start = 0;
+	}
+
+	// ...and grow it if that wasn't enough
+	if (decoder->cap - decoder->end < len + 1) {
+		size_t cap = decoder->cap == 0 ? FRAME_READ_CHUNK * 2 : decoder->cap * 2;
+		while (cap - decoder->end < len + 1) {
+			cap *= 2;
+		}
+
+		char *buf = realloc(decoder->buf, cap);
+		if (buf == NULL) {
+			errno = ENOMEM;
+			return 0;
+		}
+		decoder->buf = buf;
+		decoder->cap = cap;
+	}
+
+	return 1;
+}
+
+ssize_t frame_decoder_read(struct frame_decoder *decoder, int fd) {
+	if (!frame_decoder_reserve(decoder, FRAME_READ_CHUNK)) {
+		return -1;
+	}
+
+	ssize_t nread;
+	do {
+		nread = read(fd, decoder->buf + decoder->end, decoder->cap - decoder->end - 1);
+	} while (nread < 0 && errno == EINTR);
+
+	if (nread > 0) {
+		decoder->end += nread;
+	}
+	return nread;
+}
+
+int frame_decoder_feed(struct frame_decoder *decoder, const char *data, size_t len) {
+	if (!frame_decoder_reserve(decoder, len)) {
+		return 0;
+	}
+
+	memcpy(decoder->buf + decoder->end, data, len);
+	decoder->end += len;
+	return 1;
+}
+
+int frame_decoder_peek_len(struct frame_decoder *decoder, size_t *len) {
+	frame_decoder_restore(decoder);
+
+	if (decoder->end - decoder->start < FRAME_HEADER_LEN) {
+		return 0;
+	}
+	*len = frame_get_header(decoder->buf + decoder->start);
+	return 1;
+}
+
+int frame_decoder_ready(struct frame_decoder *decoder) {
+	frame_decoder_restore(decoder);
+
+	size_t available = decoder->end - decoder->start;
+	if (available < FRAME_HEADER_LEN) {
+		return 0;
+	}
+
+	size_t frame_len = frame_get_header(decoder->buf + decoder->start);
+	if (frame_len > MAX_FRAME_LEN) {
+		return -1;
+	}
+
+	return available >= FRAME_HEADER_LEN + frame_len;
+}
+
+int frame_decoder_next(struct frame_decoder *decoder, char **payload, size_t *len) {
+	int ret = frame_decoder_ready(decoder);
+	if (ret != 1) {
+		return ret;
+	}
+
+	size_t frame_len = frame_get_header(decoder->buf + decoder->start);
+	*payload = decoder->buf + decoder->start + FRAME_HEADER_LEN;
+	*len = frame_len;
+	decoder->start += FRAME_HEADER_LEN + frame_len;
+
+	// nul-terminate the payload in place, remembering the byte we clobbered
+	decoder->nul_at = decoder->start;
+	decoder->nul_saved = decoder->buf[decoder->start];
+	decoder->buf[decoder->start] = '\0';
+
+	return 1;
+}
@@ -7,17 +7,40 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include <stddef.h>
+#include <sys/types.h>
+
 // login defines
 #define MAX_PORT_LEN 5
 #define MAX_ADDRESS_LEN 1024
 #define MAX_USERNAME_LEN 16
+#define MAX_ROOM_NAME_LEN 16
 
 // general defines
 #define MAX_MESSAGE_LEN 256
-#define MAX_CONCURRENT_USERS 10
-#define BUFFER_SIZE (1024 + MAX_USERNAME_LEN * MAX_CONCURRENT_USERS)
-#define MILLI_SLEEP_DUR 1
-#define MICRO_SLEEP_DUR (MILLI_SLEEP_DUR * 1000.0)
+#define BUFFER_SIZE (1024 + MAX_USERNAME_LEN * 10)
+
+// framing defines
+// every message on the wire is a FRAME_HEADER_LEN byte (big-endian) payload
+// length, followed by the payload itself
+#define FRAME_HEADER_LEN 4
+#define MAX_FRAME_LEN (16 * 1024 * 1024)
+#define FRAME_READ_CHUNK 4096
+
+// the longest frame_write() waits for a non-blocking fd that fills up part way
+// through a frame, before giving up on it
+#define FRAME_WRITE_TIMEOUT_MS 5000
+
+// a streaming frame decoder, which buffers partial reads and splits coalesced
+// reads back into individual frames
+struct frame_decoder {
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    size_t nul_at;
+    char nul_saved;
+};
 
 // err: -1 too short, -2 too long
 int is_valid_address(const char *address, int *err);
@@ -28,4 +51,46 @@ int is_valid_port(const char *port, int *err);
 // err: -1 too short, -2 too long, -3 contains spaces
 int is_valid_username(const char *username, int *err);
 
+// err: -1 too short, -2 too long, -3 contains spaces
+int is_valid_room_name(const char *room, int *err);
+
+// writes the header for a payload of len bytes into header
+void frame_put_header(char *header, size_t len);
+
+// returns the payload length stored in header
+size_t frame_get_header(const char *header);
+
+// writes the payload to fd as a single frame. if fd is non-blocking and fills
+// up part way through, it waits (up to FRAME_WRITE_TIMEOUT_MS) for room to
+// finish, so never call it from an event loop that others depend on
+// (ret: 1 success, 0 failure (errno is ETIMEDOUT if the wait ran out))
+int frame_write(int fd, const char *payload, size_t len);
+
+// initialize the decoder
+void frame_decoder_initialize(struct frame_decoder *decoder);
+
+// frees the decoder's memory, resetting it
+void frame_decoder_free(struct frame_decoder *decoder);
+
+// reads whatever is available on fd into the decoder
+// (ret: number of bytes read, 0 if fd was closed, -1 on error (see errno))
+ssize_t frame_decoder_read(struct frame_decoder *decoder, int fd);
+
+// appends len bytes that were received some other way to the decoder
+// (ret: 1 success, 0 failure)
+int frame_decoder_feed(struct frame_decoder *decoder, const char *data, size_t len);
+
+// returns the payload length the next frame's header announces, once the header is in
+// (ret: 1 length returned, 0 no header yet)
+int frame_decoder_peek_len(struct frame_decoder *decoder, size_t *len);
+
+// checks whether the next frame is complete, without popping it
+// (ret: 1 frame complete, 0 no complete frame yet, -1 frame too long)
+int frame_decoder_ready(struct frame_decoder *decoder);
+
+// pops the next complete frame. the payload is nul-terminated in place, and
+// stays valid until the next call to any frame_decoder function
+// (ret: 1 frame returned, 0 no complete frame yet, -1 frame too long)
+int frame_decoder_next(struct frame_decoder *decoder, char **payload, size_t *len);
+
 #endif  // COMMON_H_
@@ -0,0 +1,750 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "tinychat.h"
+
+#include "common.h"
+#include "protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// the number of buckets the set of connected users starts out with (it
+// doubles whenever it holds as many users as buckets)
+#define USER_SET_BUCKETS 64
+
+// the most reads a single call to tinychat_process() makes, so a server that
+// keeps the socket full can not keep the caller's event loop from running
+#define MAX_READS_PER_PROCESS 16
+
+// a connected user, chained into their bucket of the set
+struct user_entry {
+    struct user_entry *next;
+    char username[MAX_USERNAME_LEN + 1];
+};
+
+// the set of connected users (so joins racing the user list are only reported once)
+struct user_set {
+    struct user_entry **buckets;
+    size_t mask;
+    size_t count;
+};
+
+struct tinychat_session {
+    struct tinychat_callbacks callbacks;
+    void *context;
+
+    int socket_fd;
+    int binary;
+    struct frame_decoder decoder;
+    char *username;
+    char *userlist;
+    struct user_set users;
+
+    // tracing (see tinychat_set_trace()): the log, how many messages sent to
+    // each one traced, and how many were sent so far.
+    FILE *trace_log;
+    unsigned trace_every;
+    unsigned trace_count;
+};
+
+
+
+/* returns the hash of username (fnv-1a) */
+static size_t user_set_hash(const char *username) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = username; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    return hash;
+}
+
+/* returns the link pointing at username's entry (or at the end of its bucket) */
+static struct user_entry **user_set_find(struct user_set *set, const char *username) {
+    struct user_entry **link = &set->buckets[user_set_hash(username) & set->mask];
+    while (*link != NULL && strcmp((*link)->username, username) != 0) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/* doubles the number of buckets, rechaining every entry */
+static void user_set_grow(struct user_set *set) {
+    size_t capacity = (set->mask + 1) * 2;
+    struct user_entry **buckets = calloc(capacity, sizeof(struct user_entry*));
+    if (buckets == NULL) {
+        return;
+    }
+
+    for (size_t b = 0; b <= set->mask; b++) {
+        struct user_entry *entry = set->buckets[b];
+        while (entry != NULL) {
+            struct user_entry *next = entry->next;
+            size_t bucket = user_set_hash(entry->username) & (capacity - 1);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    free(set->buckets);
+    set->buckets = buckets;
+    set->mask = capacity - 1;
+}
+
+/* removes every user from the set */
+static void user_set_clear(struct user_set *set) {
+    for (size_t b = 0; set->buckets != NULL && b <= set->mask; b++) {
+        while (set->buckets[b] != NULL) {
+            struct user_entry *entry = set->buckets[b];
+            set->buckets[b] = entry->next;
+            free(entry);
+        }
+    }
+    set->count = 0;
+}
+
+/* adds username to the set.
+(ret: 1 added, 0 already in the set (or out of memory)) */
+static int user_set_add(struct user_set *set, const char *username) {
+    if (set->buckets == NULL) {
+        if ((set->buckets = calloc(USER_SET_BUCKETS, sizeof(struct user_entry*))) == NULL) {
+            return 0;
+        }
+        set->mask = USER_SET_BUCKETS - 1;
+    }
+
+    struct user_entry **link = user_set_find(set, username);
+    if (*link != NULL || strlen(username) > MAX_USERNAME_LEN) {
+        return 0;
+    }
+
+    struct user_entry *entry = malloc(sizeof(struct user_entry));
+    if (entry == NULL) {
+        return 0;
+    }
+    strcpy(entry->username, username);
+    entry->next = NULL;
+    *link = entry;
+
+    if (++set->count > set->mask) {
+        user_set_grow(set);
+    }
+    return 1;
+}
+
+/* removes username from the set.
+(ret: 1 removed, 0 was not in the set) */
+static int user_set_remove(struct user_set *set, const char *username) {
+    if (set->buckets == NULL) {
+        return 0;
+    }
+
+    struct user_entry **link = user_set_find(set, username);
+    if (*link == NULL) {
+        return 0;
+    }
+
+    struct user_entry *entry = *link;
+    *link = entry->next;
+    free(entry);
+    set->count--;
+    return 1;
+}
+
+
+
+/* sets up the initial user list */
+static void userlist_update(struct tinychat_session *session, const char *buffer) {
+    // buffer is of form "<username1> <username2> ... <usernamei>"
+
+    /* the userlist grows with the number of connected users, so it is
+    reallocated to fit every time. */
+    free(session->userlist);
+    session->userlist = malloc(sizeof(char) * (strlen(buffer) + 2));
+    char *tmp_buffer = strdup(buffer);
+    if (session->userlist == NULL || tmp_buffer == NULL) {
+        free(tmp_buffer);
+        return;
+    }
+    char *end = session->userlist;
+    *end = '\0';
+
+    /* retokenize the buffer to remove your own username from the list, since
+    you shouldn't be able to PM yourself. */
+    user_set_clear(&session->users);
+    char *saveptr;
+    char *token = strtok_r(tmp_buffer, " ", &saveptr);
+    while (token != NULL) {
+        if (strcmp(token, session->username) != 0) {
+            end += sprintf(end, "%s ", token);
+            user_set_add(&session->users, token);
+        }
+        token = strtok_r(NULL, " ", &saveptr);
+    }
+    free(tmp_buffer);
+
+    if (session->callbacks.userlist_updated != NULL) {
+        session->callbacks.userlist_updated(session->context, session->userlist);
+    }
+}
+
+
+
+/* Copies the (not nul-terminated) packet field into out, which holds up to max characters.
+(ret: 1 success, 0 the field is empty or too long) */
+static int copy_field(char *out, size_t max, const char *field, size_t len) {
+    if (len == 0 || len > max) {
+        return 0;
+    }
+    memcpy(out, field, len);
+    out[len] = '\0';
+    return 1;
+}
+
+
+
+/* Calls back with a new private message. */
+static void message_parse_whisper(struct tinychat_session *session, const struct protocol_packet *packet) {
+    // the payload ends the frame, so it is already nul-terminated.
+    char sender[MAX_USERNAME_LEN + 1];
+    if (session->callbacks.private_message_received != NULL &&
+        copy_field(sender, MAX_USERNAME_LEN, packet->sender, packet->sender_len)) {
+        session->callbacks.private_message_received(session->context, sender, packet->payload);
+    }
+}
+
+
+
+/* Calls back with a new message. */
+static void message_parse_broadcast(struct tinychat_session *session, const struct protocol_packet *packet) {
+    char sender[MAX_USERNAME_LEN + 1];
+    if (session->callbacks.message_received != NULL &&
+        copy_field(sender, MAX_USERNAME_LEN, packet->sender, packet->sender_len)) {
+        session->callbacks.message_received(session->context, sender, packet->payload);
+    }
+}
+
+
+
+/* Calls back with a new room message. */
+static void message_parse_roomcast(struct tinychat_session *session, const struct protocol_packet *packet) {
+    char room[MAX_ROOM_NAME_LEN + 1];
+    char sender[MAX_USERNAME_LEN + 1];
+    if (session->callbacks.room_message_received != NULL &&
+        copy_field(room, MAX_ROOM_NAME_LEN, packet->target, packet->target_len) &&
+        copy_field(sender, MAX_USERNAME_LEN, packet->sender, packet->sender_len)) {
+        session->callbacks.room_message_received(session->context, room, sender, packet->payload);
+    }
+}
+
+
+
+/* Calls back with whether a room join request succeeded. */
+static void message_parse_room_join_response(struct tinychat_session *session,
+    const struct protocol_packet *packet) {
+    char room[MAX_ROOM_NAME_LEN + 1];
+    if (!copy_field(room, MAX_ROOM_NAME_LEN, packet->target, packet->target_len)) {
+        return;
+    }
+
+    if (strcmp(packet->payload, "ok") == 0) {
+        if (session->callbacks.room_joined != NULL) {
+            session->callbacks.room_joined(session->context, room);
+        }
+    }
+    else if (session->callbacks.room_join_failed != NULL) {
+        session->callbacks.room_join_failed(session->context, room, packet->payload);
+    }
+}
+
+
+
+/* Adds the user who joined. */
+static void message_parse_joined(struct tinychat_session *session, const struct protocol_packet *packet) {
+    char username[MAX_USERNAME_LEN + 1];
+    if (!copy_field(username, MAX_USERNAME_LEN, packet->sender, packet->sender_len)) {
+        return;
+    }
+
+    /* the server may race a join with the initial user list, so only call
+    back about users we didn't already know about. */
+    if (strcmp(username, session->username) != 0 && user_set_add(&session->users, username) &&
+        session->callbacks.user_joined != NULL) {
+        session->callbacks.user_joined(session->context, username);
+    }
+}
+
+
+
+/* Removes the user who left. */
+static void message_parse_left(struct tinychat_session *session, const struct protocol_packet *packet) {
+    char username[MAX_USERNAME_LEN + 1];
+    if (copy_field(username, MAX_USERNAME_LEN, packet->sender, packet->sender_len) &&
+        user_set_remove(&session->users, username) && session->callbacks.user_left != NULL) {
+        session->callbacks.user_left(session->context, username);
+    }
+}
+
+
+
+/* Replaces the user list. */
+static void message_parse_userlist(struct tinychat_session *session, const struct protocol_packet *packet) {
+    userlist_update(session, packet->payload);
+}
+
+
+
+/* Calls back with the list of rooms. */
+static void message_parse_roomlist(struct tinychat_session *session, const struct protocol_packet *packet) {
+    if (session->callbacks.roomlist_updated != NULL) {
+        session->callbacks.roomlist_updated(session->context, packet->payload);
+    }
+}
+
+
+
+/* Answers the server's heartbeat, so it knows the connection is still alive. */
+static void message_parse_ping(struct tinychat_session *session, const struct protocol_packet *packet) {
+    struct protocol_packet pong;
+    protocol_packet_initialize(&pong, OP_PONG, NULL, NULL, NULL);
+
+    if (!protocol_write(session->socket_fd, session->binary, &pong)) {
+        perror("write() failed while answering a ping");
+    }
+}
+
+
+
+/* Picks whether the packet about to be sent carries a trace. */
+static void trace_packet(struct tinychat_session *session, struct protocol_packet *packet) {
+    if (session->trace_log == NULL || !session->binary || session->trace_count++ % session->trace_every != 0) {
+        return;
+    }
+
+    packet->flags |= PROTOCOL_FLAG_TRACE;
+    packet->trace.id = ((uint64_t)random() << 32) | session->trace_count;
+    packet->trace.client_sent = protocol_trace_now();
+}
+
+
+
+/* Logs how long each hop of a traced message took: from its sender to the
+server, through the server, from the server to us, and through our handler.
+note: hops between machines are only as accurate as their clocks are in sync. */
+static void trace_log(struct tinychat_session *session, const struct protocol_packet *packet, uint64_t received,
+    uint64_t handled) {
+    const struct protocol_trace *trace = &packet->trace;
+    const char *word = protocol_command_word(packet->opcode);
+
+    fprintf(session->trace_log, "%016" PRIx64 " %s %" PRIu64 " %.1f %.1f %.1f %.1f\n", trace->id,
+        word[0] == '/' ? word + 1 : "text", trace->client_sent,
+        (int64_t)(trace->server_received - trace->client_sent) / 1e3,
+        (int64_t)(trace->server_sent - trace->server_received) / 1e3,
+        (int64_t)(received - trace->server_sent) / 1e3,
+        (int64_t)(handled - received) / 1e3);
+}
+
+
+
+/* The handler for each message the server may send (anything else is ignored). */
+static void (*const message_handlers[OP_COUNT])(struct tinychat_session *session,
+    const struct protocol_packet *packet) = {
+    [OP_WHISPERED] = message_parse_whisper,
+    [OP_BROADCASTED] = message_parse_broadcast,
+    [OP_ROOMCASTED] = message_parse_roomcast,
+    [OP_ROOMJOINRESPONSE] = message_parse_room_join_response,
+    [OP_JOINED] = message_parse_joined,
+    [OP_LEFT] = message_parse_left,
+    [OP_USERLIST] = message_parse_userlist,
+    [OP_ROOMLIST] = message_parse_roomlist,
+    [OP_PING] = message_parse_ping,
+};
+
+
+
+/* Calls back that the connection was lost. */
+static int connection_lost(struct tinychat_session *session) {
+    if (session->callbacks.connection_lost != NULL) {
+        session->callbacks.connection_lost(session->context);
+    }
+    return 0;
+}
+
+
+
+/* Returns a new session. */
+struct tinychat_session *tinychat_session_new(const struct tinychat_callbacks *callbacks, void *context) {
+    struct tinychat_session *session = calloc(1, sizeof(struct tinychat_session));
+    if (session == NULL) {
+        perror("calloc() failed in tinychat_session_new()");
+        return NULL;
+    }
+
+    if (callbacks != NULL) {
+        session->callbacks = *callbacks;
+    }
+    session->context = context;
+    session->socket_fd = -1;
+    frame_decoder_initialize(&session->decoder);
+    session->trace_every = 1;
+    return session;
+}
+
+
+
+/* Disconnects the session and frees it. */
+void tinychat_session_free(struct tinychat_session *session) {
+    if (session == NULL) {
+        return;
+    }
+
+    tinychat_disconnect(session);
+    free(session->users.buckets);
+    free(session);
+}
+
+
+
+/* Attempts to connect to the server. */
+int tinychat_connect(struct tinychat_session *session, const char *port, const char *address, int *err) {
+    struct addrinfo *address_info;
+
+    // verifies that the address and port combo are valid.
+    if (getaddrinfo(address, port, NULL, &address_info) != 0) {
+        perror("getaddrinfo() failed");
+        *err = -1;
+        return 0;
+    }
+
+    // attempts to create an open socket on the system.
+    if ((session->socket_fd = socket(address_info->ai_family, address_info->ai_socktype,
+        address_info->ai_protocol)) < 0) {
+        perror("socket() failed");
+        freeaddrinfo(address_info);
+        *err = -2;
+        return 0;
+    }
+
+    // attempts to connect to the server via socket.
+    if (connect(session->socket_fd, address_info->ai_addr, address_info->ai_addrlen) < 0) {
+        perror("connect() failed");
+        close(session->socket_fd);
+        session->socket_fd = -1;
+        freeaddrinfo(address_info);
+        *err = -3;
+        return 0;
+    }
+    freeaddrinfo(address_info);
+
+    // reset the decoder, in case a previous connection left anything behind.
+    frame_decoder_free(&session->decoder);
+
+    // make space for the (empty) userlist string, and forget every user.
+    free(session->userlist);
+    session->userlist = calloc(1, sizeof(char));
+    user_set_clear(&session->users);
+
+    // return success.
+    return 1;
+}
+
+
+
+/* Closes the socket and frees the memory, essentially resetting the session. */
+void tinychat_disconnect(struct tinychat_session *session) {
+    // close the socket, if its still open.
+    if (session->socket_fd != -1) {
+        close(session->socket_fd);
+        session->socket_fd = -1;
+    }
+    session->binary = 0;
+
+    // free any partially received messages.
+    frame_decoder_free(&session->decoder);
+
+    free(session->username);
+    session->username = NULL;
+    free(session->userlist);
+    session->userlist = NULL;
+    user_set_clear(&session->users);
+}
+
+
+
+/* Attempts to login to the server. */
+int tinychat_login(struct tinychat_session *session, const char *username, int *err) {
+    char tmp[BUFFER_SIZE];
+    memset(tmp, '\0', BUFFER_SIZE);
+    // offer the binary protocol too (the server picks whether to use it).
+    snprintf(tmp, BUFFER_SIZE, "/join %s %s", username, PROTOCOL_BINARY_VERSION);
+
+    // write to the server to request login
+    if (!frame_write(session->socket_fd, tmp, strlen(tmp))) {
+        perror("write() failed during handshake");
+        *err = -3;
+        return 0;
+    }
+
+    // read response from server (the socket is still blocking, so this waits
+    // until the whole response frame has arrived)
+    char *response;
+    size_t response_len;
+    int ret;
+    while ((ret = frame_decoder_next(&session->decoder, &response, &response_len)) == 0) {
+        if (frame_decoder_read(&session->decoder, session->socket_fd) <= 0) {
+            perror("read() failed during handshake");
+            *err = -3;
+            return 0;
+        }
+    }
+
+    if (ret < 0) {
+        *err = -3;
+        return 0;
+    }
+
+    // copy the response out, since the decoder may reuse its memory
+    memset(tmp, '\0', BUFFER_SIZE);
+    strncpy(tmp, response, BUFFER_SIZE - 1);
+
+    // check the response
+    if (memcmp(tmp, "/joinresponse ok", strlen("/joinresponse ok")) == 0) {
+        // set the socket to be non-blocking so it can be watched by an event loop
+        if (fcntl(session->socket_fd, F_SETFL, O_NONBLOCK) < 0) {
+            perror("fcntl() failed during handshake");
+            *err = -3;
+            return 0;
+        }
+
+        // the server answers in kind if it speaks the binary protocol too.
+        session->binary = strcmp(tmp, "/joinresponse ok " PROTOCOL_BINARY_VERSION) == 0;
+
+        // make space for the username string and fill it.
+        free(session->username);
+        session->username = strndup(username, MAX_USERNAME_LEN);
+
+        /* note: anything that arrived along with the response (i.e. the
+        userlist) is still buffered in the decoder, and is handled by the
+        first call to tinychat_process(). */
+        return 1;
+    }
+    else if (memcmp(tmp, "/joinresponse username_taken", strlen("/joinresponse username_taken")) == 0) {
+        *err = -1;
+        return 0;
+    }
+    else if (memcmp(tmp, "/joinresponse server_full", strlen("/joinresponse server_full")) == 0) {
+        *err = -2;
+        return 0;
+    }
+    else {
+        *err = -3;
+        return 0;
+    }
+}
+
+
+
+/* Returns the socket to watch for reading. */
+int tinychat_get_fd(const struct tinychat_session *session) {
+    return session->socket_fd;
+}
+
+
+
+/* Handles every complete message buffered in the decoder.
+(ret: 1 success, 0 a callback disconnected the session, -1 malformed frame) */
+static int handle_messages(struct tinychat_session *session) {
+    char *tmp;
+    size_t len;
+    int ret;
+    while ((ret = frame_decoder_next(&session->decoder, &tmp, &len)) == 1) {
+        // decode the message (in whichever protocol was negotiated) and hand
+        // it to the handler for its opcode.
+        struct protocol_packet packet;
+        if (!protocol_read(session->binary, tmp, len, &packet)) {
+            fprintf(stderr, "received a malformed packet\n");
+            continue;
+        }
+
+        // (a traced message is timed from here, through its handler)
+        int traced = session->trace_log != NULL && (packet.flags & PROTOCOL_FLAG_TRACE);
+        uint64_t received = traced ? protocol_trace_now() : 0;
+
+        if (message_handlers[packet.opcode] != NULL) {
+            message_handlers[packet.opcode](session, &packet);
+        }
+
+        if (traced) {
+            trace_log(session, &packet, received, protocol_trace_now());
+        }
+
+        // (a callback may have disconnected the session)
+        if (session->socket_fd == -1) {
+            return 0;
+        }
+    }
+    return ret < 0 ? -1 : 1;
+}
+
+
+
+/* Reads until the socket is drained (or for a bounded number of reads), and
+handles every complete message. */
+int tinychat_process(struct tinychat_session *session) {
+    // if the connection was closed since the last call, then stop.
+    if (session->socket_fd == -1) {
+        return 0;
+    }
+
+    /* a single read may hold several messages, or only part of one, so the
+    messages are handled after every read (keeping the decoder small), until
+    there is nothing left to read, or the call has read its share. Whatever is
+    left in the socket keeps it readable, so the caller's loop calls again. */
+    for (int reads = 0; reads < MAX_READS_PER_PROCESS; reads++) {
+        ssize_t nread = frame_decoder_read(&session->decoder, session->socket_fd);
+
+        // if nread == 0, then the socket was closed from the other end.
+        if (nread == 0 || (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return connection_lost(session);
+        }
+
+        int ret = handle_messages(session);
+
+        // a malformed frame means we can no longer tell where messages begin.
+        if (ret < 0) {
+            return connection_lost(session);
+        }
+        if (ret == 0) {
+            return 0;
+        }
+
+        // Otherwise, keep watching once the socket is drained.
+        if (nread < 0) {
+            return 1;
+        }
+    }
+    return 1;
+}
+
+
+
+/* Waits for the socket to be readable, then processes whatever arrived. */
+int tinychat_wait(struct tinychat_session *session, int timeout_ms) {
+    if (session->socket_fd == -1) {
+        return 0;
+    }
+
+    // anything already buffered (e.g. along with the join response) is handled first.
+    if (frame_decoder_ready(&session->decoder) == 0) {
+        struct pollfd pfd = { session->socket_fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            perror("poll() failed");
+            return 0;
+        }
+
+        // nothing arrived in time (or a signal came first), so keep waiting.
+        if (ready <= 0) {
+            return 1;
+        }
+    }
+    return tinychat_process(session);
+}
+
+
+
+/* Returns the username the session logged in with. */
+const char *tinychat_get_username(const struct tinychat_session *session) {
+    return session->username;
+}
+
+
+
+/* Writes the packet to the server, in whichever protocol was negotiated.
+(ret: 1 success, 0 failure) */
+static int send_packet(struct tinychat_session *session, struct protocol_packet *packet, const char *what) {
+    if (!protocol_write(session->socket_fd, session->binary, packet)) {
+        fprintf(stderr, "\'write\' failed during %s\n", what);
+        return 0;
+    }
+    return 1;
+}
+
+
+
+/* Sends the message to all connected users. */
+int tinychat_send_broadcast(struct tinychat_session *session, const char *message) {
+    struct protocol_packet packet;
+    protocol_packet_initialize(&packet, OP_BROADCAST, NULL, NULL, message);
+    trace_packet(session, &packet);
+    return send_packet(session, &packet, "broadcast");
+}
+
+
+
+/* Sends the message to the recipient. */
+int tinychat_send_private_message(struct tinychat_session *session, const char *recipient, const char *message) {
+    struct protocol_packet packet;
+    protocol_packet_initialize(&packet, OP_WHISPER, NULL, recipient, message);
+    trace_packet(session, &packet);
+    return send_packet(session, &packet, "whisper");
+}
+
+
+
+/* Sends the message to every member of the room. */
+int tinychat_send_room_message(struct tinychat_session *session, const char *room, const char *message) {
+    struct protocol_packet packet;
+    protocol_packet_initialize(&packet, OP_ROOMCAST, NULL, room, message);
+    trace_packet(session, &packet);
+    return send_packet(session, &packet, "roomcast");
+}
+
+
+
+/* Asks the server to add you to the room. */
+int tinychat_join_room(struct tinychat_session *session, const char *room) {
+    struct protocol_packet packet;
+    protocol_packet_initialize(&packet, OP_ROOMJOIN, NULL, room, NULL);
+    return send_packet(session, &packet, "room join");
+}
+
+
+
+/* Asks the server to remove you from the room. */
+int tinychat_leave_room(struct tinychat_session *session, const char *room) {
+    struct protocol_packet packet;
+    protocol_packet_initialize(&packet, OP_ROOMLEAVE, NULL, room, NULL);
+    return send_packet(session, &packet, "room leave");
+}
+
+
+
+/* Asks the server for every room with members in it. */
+int tinychat_request_roomlist(struct tinychat_session *session) {
+    struct protocol_packet packet;
+    protocol_packet_initialize(&packet, OP_ROOMLIST, NULL, NULL, NULL);
+    return send_packet(session, &packet, "room list request");
+}
+
+
+
+/* Traces one in every `every` messages sent, logging those received. */
+void tinychat_set_trace(struct tinychat_session *session, FILE *log, unsigned every) {
+    session->trace_log = log;
+    session->trace_every = every > 0 ? every : 1;
+    session->trace_count = 0;
+}
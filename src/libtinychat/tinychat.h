@@ -0,0 +1,126 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef TINYCHAT_H_
+#define TINYCHAT_H_
+
+#include <stdio.h>
+
+/* libtinychat is the client side of the chat protocol (connecting, logging
+in, sending, and receiving and parsing messages) in plain C, free of GTK, so
+bots, bridges and load tools can use it as well as the GTK client.
+
+A session does no waiting of its own once logged in. Whatever event loop the
+caller runs watches the session's socket (see tinychat_get_fd()) and calls
+tinychat_process() when it is readable, which handles every complete message
+that arrived by calling back into the caller. Sessions share nothing, so one
+process (and one loop) can run as many as it likes. */
+
+/* What a session calls when something happens. Any callback may be NULL, and
+every one is handed the context the session was created with. The strings are
+only valid until the callback returns. */
+struct tinychat_callbacks {
+    /* A message was sent to everyone. */
+    void (*message_received)(void *context, const char *sender, const char *message);
+
+    /* A message was sent to you alone. */
+    void (*private_message_received)(void *context, const char *sender, const char *message);
+
+    /* A message was sent to a room you are in. */
+    void (*room_message_received)(void *context, const char *room, const char *sender, const char *message);
+
+    /* The full user list (everyone but you, separated by spaces) arrived, on login. */
+    void (*userlist_updated)(void *context, const char *userlist);
+
+    /* A user joined the chat (after the user list arrived). */
+    void (*user_joined)(void *context, const char *username);
+
+    /* A user left the chat. */
+    void (*user_left)(void *context, const char *username);
+
+    /* The server added you to a room. */
+    void (*room_joined)(void *context, const char *room);
+
+    /* The server refused to add you to a room, for the given reason. */
+    void (*room_join_failed)(void *context, const char *room, const char *reason);
+
+    /* The list of rooms (separated by spaces) arrived. */
+    void (*roomlist_updated)(void *context, const char *roomlist);
+
+    /* The connection to the server was lost. */
+    void (*connection_lost)(void *context);
+};
+
+struct tinychat_session;
+
+/* Returns a new session, which calls back with context, or NULL. */
+struct tinychat_session *tinychat_session_new(const struct tinychat_callbacks *callbacks, void *context);
+
+/* Disconnects the session and frees it. */
+void tinychat_session_free(struct tinychat_session *session);
+
+/* Attempts to connect to the server.
+(ret: 1 success, 0 failure. err: -1 getaddrinfo, -2 socket, -3 connect) */
+int tinychat_connect(struct tinychat_session *session, const char *port, const char *address, int *err);
+
+/* Closes the socket and frees the memory, essentially resetting the session. */
+void tinychat_disconnect(struct tinychat_session *session);
+
+/* Attempts to login to the server (waiting for its answer).
+(ret: 1 success, 0 failure. err: -1 username taken, -2 server full, -3 unspecified) */
+int tinychat_login(struct tinychat_session *session, const char *username, int *err);
+
+/* Returns the socket to watch for reading, or -1 if the session is not connected. */
+int tinychat_get_fd(const struct tinychat_session *session);
+
+/* Reads what has arrived on the socket, and handles every complete message.
+So the caller's loop is never starved, it stops after a bounded number of
+reads even if more is waiting, which keeps the socket readable: watch it
+level-triggered (as poll() and GLib's watches do), not edge-triggered. Call it
+once right after logging in, since whatever arrived along with the join
+response (i.e. the user list) is already buffered.
+(ret: 1 keep watching, 0 the connection was lost (or never made)) */
+int tinychat_process(struct tinychat_session *session);
+
+/* Waits up to timeout_ms milliseconds (or forever, if negative) for the socket to
+be readable, then processes whatever arrived. (For callers without a loop of their own.)
+(ret: 1 keep waiting, 0 the connection was lost (or never made)) */
+int tinychat_wait(struct tinychat_session *session, int timeout_ms);
+
+/* Returns the username the session logged in with, or NULL. */
+const char *tinychat_get_username(const struct tinychat_session *session);
+
+/* Sends the message to all connected users.
+(ret: 1 success, 0 failure) */
+int tinychat_send_broadcast(struct tinychat_session *session, const char *message);
+
+/* Sends the message to the recipient.
+(ret: 1 success, 0 failure) */
+int tinychat_send_private_message(struct tinychat_session *session, const char *recipient, const char *message);
+
+/* Sends the message to every member of the room (which you must have joined).
+(ret: 1 success, 0 failure) */
+int tinychat_send_room_message(struct tinychat_session *session, const char *room, const char *message);
+
+/* Asks the server to add you to the room. room_joined is called once it has.
+(ret: 1 success, 0 failure) */
+int tinychat_join_room(struct tinychat_session *session, const char *room);
+
+/* Asks the server to remove you from the room.
+(ret: 1 success, 0 failure) */
+int tinychat_leave_room(struct tinychat_session *session, const char *room);
+
+/* Asks the server for every room with members in it. roomlist_updated is
+called once they arrive.
+(ret: 1 success, 0 failure) */
+int tinychat_request_roomlist(struct tinychat_session *session);
+
+/* Traces one in every `every` messages sent (in the binary protocol), and logs
+every traced message received to log, with the latency of each hop it took
+(see protocol.h). A NULL log turns tracing off. The log is not closed by the session. */
+void tinychat_set_trace(struct tinychat_session *session, FILE *log, unsigned every);
+
+#endif  // TINYCHAT_H_
@@ -0,0 +1,304 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+// the fields of a command, in the order they appear in its text encoding:
+// 's' the sender (one word), 't' the target (one word), 'T' the target (the
+// rest of the line) and 'p' the payload (the rest of the line)
+struct protocol_command {
+	const char *word;
+	size_t word_len;
+	const char *fields;
+};
+
+#define COMMAND(word, fields) { word, sizeof(word) - 1, fields }
+
+static const struct protocol_command commands[OP_COUNT] = {
+	[OP_TEXT] = { NULL, 0, "p" },
+	[OP_WHISPER] = COMMAND("/whisper", "tp"),
+	[OP_BROADCAST] = COMMAND("/broadcast", "p"),
+	[OP_ROOMCAST] = COMMAND("/roomcast", "tp"),
+	[OP_ROOMJOIN] = COMMAND("/roomjoin", "T"),
+	[OP_ROOMLEAVE] = COMMAND("/roomleave", "T"),
+	[OP_CATCHUP] = COMMAND("/catchup", "p"),
+	[OP_WHISPERED] = COMMAND("/whispered", "sp"),
+	[OP_BROADCASTED] = COMMAND("/broadcasted", "sp"),
+	[OP_ROOMCASTED] = COMMAND("/roomcasted", "tsp"),
+	[OP_ROOMJOINRESPONSE] = COMMAND("/roomjoinresponse", "tp"),
+	[OP_JOINED] = COMMAND("/joined", "s"),
+	[OP_LEFT] = COMMAND("/left", "s"),
+	[OP_USERLIST] = COMMAND("/userlist", "p"),
+	[OP_ROOMLIST] = COMMAND("/roomlist", "p"),
+	[OP_PING] = COMMAND("/ping", ""),
+	[OP_PONG] = COMMAND("/pong", ""),
+};
+
+
+
+void protocol_packet_initialize(struct protocol_packet *packet, int opcode, const char *sender,
+	const char *target, const char *payload) {
+	packet->opcode = opcode;
+	packet->flags = 0;
+	packet->sender = sender != NULL ? sender : "";
+	packet->sender_len = strlen(packet->sender);
+	packet->target = target != NULL ? target : "";
+	packet->target_len = strlen(packet->target);
+	packet->payload = payload != NULL ? payload : "";
+	packet->payload_len = strlen(packet->payload);
+	memset(&packet->trace, 0, sizeof(packet->trace));
+}
+
+uint64_t protocol_trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// reads (or writes) a big-endian 64 bit field of a trace
+static uint64_t get_u64(const unsigned char *in) {
+	uint64_t value = 0;
+	for (int b = 0; b < 8; b++) {
+		value = (value << 8) | in[b];
+	}
+	return value;
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+	for (int b = 7; b >= 0; b--) {
+		out[b] = (unsigned char)value;
+		value >>= 8;
+	}
+}
+
+const char *protocol_command_word(int opcode) {
+	return commands[opcode].word != NULL ? commands[opcode].word : "";
+}
+
+int protocol_read(int binary, const char *data, size_t len, struct protocol_packet *packet) {
+	if (binary) {
+		return protocol_decode(data, len, packet);
+	}
+	protocol_parse_text(data, len, packet);
+	return 1;
+}
+
+int protocol_write(int fd, int binary, const struct protocol_packet *packet) {
+	size_t len = binary ? protocol_encoded_len(packet) : protocol_text_len(packet);
+	if (len == 0 && binary) {
+		return 0;
+	}
+
+	// most packets are small enough to encode on the stack
+	char small[BUFFER_SIZE];
+	char *out = len <= sizeof(small) ? small : malloc(len);
+	if (out == NULL) {
+		return 0;
+	}
+
+	if (binary) {
+		protocol_encode(packet, out);
+	}
+	else {
+		protocol_format_text(packet, out);
+	}
+
+	int ret = frame_write(fd, out, len);
+	if (out != small) {
+		free(out);
+	}
+	return ret;
+}
+
+int protocol_decode(const char *data, size_t len, struct protocol_packet *packet) {
+	if (len < PROTOCOL_HEADER_LEN) {
+		return 0;
+	}
+
+	const unsigned char *header = (const unsigned char *)data;
+	size_t fields_len = PROTOCOL_HEADER_LEN + header[2] + header[3];
+	if (header[0] >= OP_COUNT || fields_len > len) {
+		return 0;
+	}
+
+	packet->opcode = header[0];
+	packet->flags = header[1];
+	packet->sender = data + PROTOCOL_HEADER_LEN;
+	packet->sender_len = header[2];
+	packet->target = packet->sender + packet->sender_len;
+	packet->target_len = header[3];
+	packet->payload = data + fields_len;
+	packet->payload_len = len - fields_len;
+
+	// a trace comes between the target and the payload
+	if (packet->flags & PROTOCOL_FLAG_TRACE) {
+		if (packet->payload_len < PROTOCOL_TRACE_LEN) {
+			return 0;
+		}
+
+		const unsigned char *trace = (const unsigned char *)packet->payload;
+		packet->trace.id = get_u64(trace);
+		packet->trace.client_sent = get_u64(trace + 8);
+		packet->trace.server_received = get_u64(trace + 16);
+		packet->trace.server_sent = get_u64(trace + 24);
+		packet->payload += PROTOCOL_TRACE_LEN;
+		packet->payload_len -= PROTOCOL_TRACE_LEN;
+	}
+	return 1;
+}
+
+size_t protocol_encoded_len(const struct protocol_packet *packet) {
+	// the field lengths each have a single byte
+	if (packet->sender_len > UINT8_MAX || packet->target_len > UINT8_MAX) {
+		return 0;
+	}
+	size_t trace_len = (packet->flags & PROTOCOL_FLAG_TRACE) ? PROTOCOL_TRACE_LEN : 0;
+	return PROTOCOL_HEADER_LEN + packet->sender_len + packet->target_len + trace_len + packet->payload_len;
+}
+
+void protocol_encode(const struct protocol_packet *packet, char *out) {
+	out[0] = (char)packet->opcode;
+	out[1] = (char)packet->flags;
+	out[2] = (char)packet->sender_len;
+	out[3] = (char)packet->target_len;
+
+	out += PROTOCOL_HEADER_LEN;
+	memcpy(out, packet->sender, packet->sender_len);
+	out += packet->sender_len;
+	memcpy(out, packet->target, packet->target_len);
+	out += packet->target_len;
+
+	if (packet->flags & PROTOCOL_FLAG_TRACE) {
+		unsigned char *trace = (unsigned char *)out;
+		put_u64(trace, packet->trace.id);
+		put_u64(trace + 8, packet->trace.client_sent);
+		put_u64(trace + 16, packet->trace.server_received);
+		put_u64(trace + 24, packet->trace.server_sent);
+		out += PROTOCOL_TRACE_LEN;
+	}
+	memcpy(out, packet->payload, packet->payload_len);
+}
+
+void protocol_parse_text(const char *data, size_t len, struct protocol_packet *packet) {
+	protocol_packet_initialize(packet, OP_TEXT, NULL, NULL, NULL);
+	packet->payload = data;
+	packet->payload_len = len;
+
+	// find the command by its first word
+	const char *end = data + len;
+	size_t word_len = 0;
+	while (word_len < len && data[word_len] != ' ') {
+		word_len++;
+	}
+
+	int opcode;
+	for (opcode = OP_TEXT + 1; opcode < OP_COUNT; opcode++) {
+		if (commands[opcode].word_len == word_len && memcmp(commands[opcode].word, data, word_len) == 0) {
+			break;
+		}
+	}
+	if (opcode == OP_COUNT) {
+		return;
+	}
+
+	packet->opcode = opcode;
+	packet->payload = end;
+	packet->payload_len = 0;
+
+	// then split off its fields, each preceded by a single space
+	const char *cursor = data + word_len;
+	for (const char *field = commands[opcode].fields; *field != '\0'; field++) {
+		if (cursor < end && *cursor == ' ') {
+			cursor++;
+		}
+
+		const char *field_end = cursor;
+		if (*field == 's' || *field == 't') {
+			while (field_end < end && *field_end != ' ') {
+				field_end++;
+			}
+		}
+		else {
+			field_end = end;
+		}
+
+		if (*field == 's') {
+			packet->sender = cursor;
+			packet->sender_len = field_end - cursor;
+		}
+		else if (*field == 'p') {
+			packet->payload = cursor;
+			packet->payload_len = field_end - cursor;
+		}
+		else {
+			packet->target = cursor;
+			packet->target_len = field_end - cursor;
+		}
+		cursor = field_end;
+	}
+}
+
+// returns the text encoding's field for the spec letter field
+static void text_field(const struct protocol_packet *packet, char field, const char **value, size_t *len) {
+	if (field == 's') {
+		*value = packet->sender;
+		*len = packet->sender_len;
+	}
+	else if (field == 'p') {
+		*value = packet->payload;
+		*len = packet->payload_len;
+	}
+	else {
+		*value = packet->target;
+		*len = packet->target_len;
+	}
+}
+
+size_t protocol_text_len(const struct protocol_packet *packet) {
+	if (packet->opcode == OP_TEXT) {
+		return packet->payload_len;
+	}
+
+	// note: a command whose only field is empty is sent bare (e.g. "/roomlist")
+	const struct protocol_command *command = &commands[packet->opcode];
+	size_t len = command->word_len;
+	for (const char *field = command->fields; *field != '\0'; field++) {
+		const char *value;
+		size_t value_len;
+		text_field(packet, *field, &value, &value_len);
+		if (value_len > 0 || field != command->fields || field[1] != '\0') {
+			len += 1 + value_len;
+		}
+	}
+	return len;
+}
+
+void protocol_format_text(const struct protocol_packet *packet, char *out) {
+	if (packet->opcode == OP_TEXT) {
+		memcpy(out, packet->payload, packet->payload_len);
+		return;
+	}
+
+	const struct protocol_command *command = &commands[packet->opcode];
+	memcpy(out, command->word, command->word_len);
+	out += command->word_len;
+	for (const char *field = command->fields; *field != '\0'; field++) {
+		const char *value;
+		size_t value_len;
+		text_field(packet, *field, &value, &value_len);
+		if (value_len > 0 || field != command->fields || field[1] != '\0') {
+			*out++ = ' ';
+			memcpy(out, value, value_len);
+			out += value_len;
+		}
+	}
+}
@@ -0,0 +1,142 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the chat protocol has two encodings of the same set of commands.
+//
+// the text encoding is the original one: a command word followed by its
+// fields, separated by spaces (e.g. "/roomcasted lobby alice hello").
+//
+// the binary encoding is a fixed PROTOCOL_HEADER_LEN byte header (opcode,
+// flags, sender length, target length), followed by the sender, the target
+// and then the payload, which runs to the end of the frame (so the frame's
+// own length prefix doubles as the payload length, rather than repeating it).
+//
+// a client offers the binary encoding by adding its version to the join
+// request ("/join alice tcb1"). a server that supports it answers
+// "/joinresponse ok tcb1", and every later frame in both directions is
+// binary. anything else (old clients and old servers) keeps to text.
+//
+// both encodings are described by a single table (see protocol.c), mapping
+// each opcode to its command word and to the fields it carries, so parsing
+// and formatting are table lookups rather than chains of prefix compares.
+//
+// a binary packet may also carry a trace (when PROTOCOL_FLAG_TRACE is set),
+// a PROTOCOL_TRACE_LEN byte block between the target and the payload, which
+// times each hop of a chat message from its sender to its recipients. the
+// text encoding never carries one.
+
+// the version string offered and accepted during the handshake
+#define PROTOCOL_BINARY_VERSION "tcb1"
+
+// the length of a binary packet's header
+#define PROTOCOL_HEADER_LEN 4
+
+// the flags a binary packet may carry
+#define PROTOCOL_FLAG_TRACE 0x01
+
+// the length of a trace (four big-endian 64 bit fields)
+#define PROTOCOL_TRACE_LEN 32
+
+// the opcodes (OP_TEXT carries a frame no other opcode matches, as is)
+enum protocol_opcode {
+	OP_TEXT = 0,
+
+	// client to server
+	OP_WHISPER,
+	OP_BROADCAST,
+	OP_ROOMCAST,
+	OP_ROOMJOIN,
+	OP_ROOMLEAVE,
+	OP_CATCHUP,
+
+	// server to client
+	OP_WHISPERED,
+	OP_BROADCASTED,
+	OP_ROOMCASTED,
+	OP_ROOMJOINRESPONSE,
+	OP_JOINED,
+	OP_LEFT,
+	OP_USERLIST,
+
+	// both (a request from the client, the list from the server)
+	OP_ROOMLIST,
+
+	// a heartbeat from the server, and the client's answer
+	OP_PING,
+	OP_PONG,
+
+	OP_COUNT
+};
+
+// a message's trace: an id picked by its sender, and the times (in wall clock
+// nanoseconds, see protocol_trace_now()) it was sent by the client, received
+// by the server and fanned out by the server
+struct protocol_trace {
+	uint64_t id;
+	uint64_t client_sent;
+	uint64_t server_received;
+	uint64_t server_sent;
+};
+
+// a decoded packet. the fields point into the frame they were decoded from,
+// and are not nul-terminated (except the payload, which ends the frame)
+// note: the trace is only set if flags has PROTOCOL_FLAG_TRACE
+struct protocol_packet {
+	int opcode;
+	int flags;
+	const char *sender;
+	size_t sender_len;
+	const char *target;
+	size_t target_len;
+	const char *payload;
+	size_t payload_len;
+	struct protocol_trace trace;
+};
+
+// fills in packet with the opcode and (nul-terminated) fields
+void protocol_packet_initialize(struct protocol_packet *packet, int opcode, const char *sender,
+	const char *target, const char *payload);
+
+// returns the current wall clock time in nanoseconds (as traces carry it)
+uint64_t protocol_trace_now(void);
+
+// returns the opcode's command word (e.g. "/whisper", or "" for OP_TEXT)
+const char *protocol_command_word(int opcode);
+
+// decodes the binary packet in data
+// (ret: 1 success, 0 malformed packet)
+int protocol_decode(const char *data, size_t len, struct protocol_packet *packet);
+
+// parses the text command in data (anything unrecognized becomes OP_TEXT)
+void protocol_parse_text(const char *data, size_t len, struct protocol_packet *packet);
+
+// returns the length of the packet's binary encoding (or 0 if it cannot be encoded)
+size_t protocol_encoded_len(const struct protocol_packet *packet);
+
+// writes the packet's binary encoding (of protocol_encoded_len() bytes) into out
+void protocol_encode(const struct protocol_packet *packet, char *out);
+
+// returns the length of the packet's text encoding
+size_t protocol_text_len(const struct protocol_packet *packet);
+
+// writes the packet's text encoding (of protocol_text_len() bytes) into out
+void protocol_format_text(const struct protocol_packet *packet, char *out);
+
+// reads the frame payload in data as a packet, in whichever encoding is in use
+// (ret: 1 success, 0 malformed packet)
+int protocol_read(int binary, const char *data, size_t len, struct protocol_packet *packet);
+
+// writes the packet to fd as a single frame, in whichever encoding is in use
+// (ret: 1 success, 0 failure)
+int protocol_write(int fd, int binary, const struct protocol_packet *packet);
+
+#endif  // PROTOCOL_H_
@@ -0,0 +1,223 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#include "ring.h"
+
+#include <string.h>
+
+// slots start on 8 byte boundaries, so sequence numbers are always aligned
+#define SLOT_ALIGN 8
+#define SLOT_ROUND(size) (((size) + SLOT_ALIGN - 1) & ~(size_t)(SLOT_ALIGN - 1))
+
+// an mpsc slot is its sequence number followed by the element
+struct mpsc_slot {
+	uint64_t sequence;
+	char elem[];
+};
+
+static int is_power_of_two(uint32_t n) {
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+
+
+//
+// SPSC function(s)
+//
+
+size_t spsc_ring_bytes(uint32_t capacity, size_t elem_size) {
+	return sizeof(struct spsc_ring) + (size_t)capacity * SLOT_ROUND(elem_size);
+}
+
+int spsc_ring_initialize(struct spsc_ring *ring, uint32_t capacity, size_t elem_size) {
+	if (!is_power_of_two(capacity)) {
+		return 0;
+	}
+
+	ring->head = 0;
+	ring->tail_cache = 0;
+	ring->tail = 0;
+	ring->head_cache = 0;
+	ring->mask = capacity - 1;
+	ring->slot_size = SLOT_ROUND(elem_size);
+	return 1;
+}
+
+void *spsc_ring_claim(struct spsc_ring *ring) {
+	// only look at the consumer's side (and pull its cache line over) when the
+	// last look says the ring is full
+	if (ring->tail - ring->head_cache > ring->mask) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (ring->tail - ring->head_cache > ring->mask) {
+			return NULL;
+		}
+	}
+	return ring->slots + (ring->tail & ring->mask) * ring->slot_size;
+}
+
+void spsc_ring_publish(struct spsc_ring *ring) {
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+void *spsc_ring_claim_nth(struct spsc_ring *ring, uint32_t n) {
+	if (ring->tail + n - ring->head_cache > ring->mask) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (ring->tail + n - ring->head_cache > ring->mask) {
+			return NULL;
+		}
+	}
+	return ring->slots + ((ring->tail + n) & ring->mask) * ring->slot_size;
+}
+
+void spsc_ring_publish_many(struct spsc_ring *ring, uint32_t n) {
+	__atomic_store_n(&ring->tail, ring->tail + n, __ATOMIC_RELEASE);
+}
+
+void *spsc_ring_peek(struct spsc_ring *ring) {
+	// likewise, only look at the producer's side when the last look says the ring is empty
+	if (ring->head == ring->tail_cache) {
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->head == ring->tail_cache) {
+			return NULL;
+		}
+	}
+	return ring->slots + (ring->head & ring->mask) * ring->slot_size;
+}
+
+void spsc_ring_release(struct spsc_ring *ring) {
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+int spsc_ring_push(struct spsc_ring *ring, const void *elem, size_t elem_size) {
+	void *slot = spsc_ring_claim(ring);
+	if (slot == NULL) {
+		return 0;
+	}
+	memcpy(slot, elem, elem_size);
+	spsc_ring_publish(ring);
+	return 1;
+}
+
+int spsc_ring_pop(struct spsc_ring *ring, void *elem, size_t elem_size) {
+	void *slot = spsc_ring_peek(ring);
+	if (slot == NULL) {
+		return 0;
+	}
+	memcpy(elem, slot, elem_size);
+	spsc_ring_release(ring);
+	return 1;
+}
+
+void spsc_ring_clear(struct spsc_ring *ring) {
+	ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&ring->head, ring->tail_cache, __ATOMIC_RELEASE);
+}
+
+
+
+//
+// MPSC function(s)
+//
+
+// returns the slot at position
+static struct mpsc_slot *mpsc_slot_at(struct mpsc_ring *ring, uint64_t position) {
+	return (struct mpsc_slot *)(ring->slots + (position & ring->mask) * ring->slot_size);
+}
+
+size_t mpsc_ring_bytes(uint32_t capacity, size_t elem_size) {
+	return sizeof(struct mpsc_ring) + (size_t)capacity * SLOT_ROUND(sizeof(struct mpsc_slot) + elem_size);
+}
+
+int mpsc_ring_initialize(struct mpsc_ring *ring, uint32_t capacity, size_t elem_size) {
+	if (!is_power_of_two(capacity)) {
+		return 0;
+	}
+
+	ring->head = 0;
+	ring->tail = 0;
+	ring->mask = capacity - 1;
+	ring->slot_size = SLOT_ROUND(sizeof(struct mpsc_slot) + elem_size);
+
+	// a slot is free for the producer claiming position when its sequence
+	// number is position, and ready for the consumer when it is position + 1
+	for (uint32_t i = 0; i < capacity; i++) {
+		mpsc_slot_at(ring, i)->sequence = i;
+	}
+	return 1;
+}
+
+void *mpsc_ring_claim(struct mpsc_ring *ring, uint64_t *position) {
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	while (1) {
+		struct mpsc_slot *slot = mpsc_slot_at(ring, tail);
+		uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)(sequence - tail);
+
+		if (diff == 0) {
+			// the slot is free, so race the other producers for it
+			// note: on failure, tail is reloaded with the winner's value
+			if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 1, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED)) {
+				*position = tail;
+				return slot->elem;
+			}
+		}
+		else if (diff < 0) {
+			// the consumer has not released the slot from the last lap yet
+			return NULL;
+		}
+		else {
+			// another producer claimed the slot first
+			tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void mpsc_ring_publish(struct mpsc_ring *ring, uint64_t position) {
+	__atomic_store_n(&mpsc_slot_at(ring, position)->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+void *mpsc_ring_peek(struct mpsc_ring *ring) {
+	struct mpsc_slot *slot = mpsc_slot_at(ring, ring->head);
+	if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != ring->head + 1) {
+		return NULL;
+	}
+	return slot->elem;
+}
+
+void mpsc_ring_release(struct mpsc_ring *ring) {
+	// hand the slot to whichever producer claims it on the next lap
+	__atomic_store_n(&mpsc_slot_at(ring, ring->head)->sequence, ring->head + ring->mask + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELAXED);
+}
+
+int mpsc_ring_push(struct mpsc_ring *ring, const void *elem, size_t elem_size) {
+	uint64_t position;
+	void *slot = mpsc_ring_claim(ring, &position);
+	if (slot == NULL) {
+		return 0;
+	}
+	memcpy(slot, elem, elem_size);
+	mpsc_ring_publish(ring, position);
+	return 1;
+}
+
+int mpsc_ring_pop(struct mpsc_ring *ring, void *elem, size_t elem_size) {
+	void *slot = mpsc_ring_peek(ring);
+	if (slot == NULL) {
+		return 0;
+	}
+	memcpy(elem, slot, elem_size);
+	mpsc_ring_release(ring);
+	return 1;
+}
+
+void mpsc_ring_clear(struct mpsc_ring *ring) {
+	while (mpsc_ring_peek(ring) != NULL) {
+		mpsc_ring_release(ring);
+	}
+}
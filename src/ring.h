@@ -0,0 +1,97 @@
+//
+// Copyright © Daniel Shervheim, 2019
+// danielshervheim@gmail.com
+// www.github.com/danielshervheim
+//
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// lock-free ring buffers of fixed size elements, for handing message
+// descriptors between threads (or processes). neither side ever takes a lock
+// or makes a system call.
+//
+// a ring lives in a single block of memory (its header followed by its slots,
+// see *_ring_bytes()) that the caller provides, so it can just as well be
+// malloc()ed for threads as mapped into shared memory for forked processes.
+// it holds no pointers, so the processes may even map it at different
+// addresses.
+//
+// elements can be copied in and out (push/pop), or written and read in place
+// (claim/publish, peek/release) to avoid copying large ones twice.
+
+// the size of a cache line. the producer and consumer sides of a ring are
+// kept on separate lines, so they never bounce the same line between cores.
+#define CACHE_LINE_SIZE 64
+
+// a single producer, single consumer ring
+struct spsc_ring {
+	_Alignas(CACHE_LINE_SIZE) uint64_t head;	// written by the consumer
+	uint64_t tail_cache;						// the consumer's last look at tail
+	_Alignas(CACHE_LINE_SIZE) uint64_t tail;	// written by the producer
+	uint64_t head_cache;						// the producer's last look at head
+	_Alignas(CACHE_LINE_SIZE) uint32_t mask;
+	uint32_t slot_size;
+	_Alignas(CACHE_LINE_SIZE) char slots[];
+};
+
+// a multiple producer, single consumer ring. every slot carries a sequence
+// number, so producers claim slots with a single compare-and-swap and the
+// consumer can tell when a claimed slot has actually been written.
+struct mpsc_ring {
+	_Alignas(CACHE_LINE_SIZE) uint64_t head;	// written by the consumer
+	_Alignas(CACHE_LINE_SIZE) uint64_t tail;	// claimed by producers
+	_Alignas(CACHE_LINE_SIZE) uint32_t mask;
+	uint32_t slot_size;
+	_Alignas(CACHE_LINE_SIZE) char slots[];
+};
+
+// returns the number of bytes a ring of capacity elements of elem_size bytes needs
+// note: capacity must be a power of two
+size_t spsc_ring_bytes(uint32_t capacity, size_t elem_size);
+size_t mpsc_ring_bytes(uint32_t capacity, size_t elem_size);
+
+// initialize the ring in memory of (at least) *_ring_bytes() bytes
+// (ret: 1 success, 0 failure (capacity is not a power of two))
+int spsc_ring_initialize(struct spsc_ring *ring, uint32_t capacity, size_t elem_size);
+int mpsc_ring_initialize(struct mpsc_ring *ring, uint32_t capacity, size_t elem_size);
+
+// (producer) returns the next free slot to write an element into (or NULL if
+// the ring is full). the element becomes visible to the consumer once published.
+void *spsc_ring_claim(struct spsc_ring *ring);
+void spsc_ring_publish(struct spsc_ring *ring);
+void *mpsc_ring_claim(struct mpsc_ring *ring, uint64_t *position);
+
+// (producer) returns the n'th free slot after the next one (or NULL if the
+// ring has fewer than n + 1 free), so a producer can write several elements
+// and publish them all at once, the consumer seeing either none or all of them
+void *spsc_ring_claim_nth(struct spsc_ring *ring, uint32_t n);
+void spsc_ring_publish_many(struct spsc_ring *ring, uint32_t n);
+void mpsc_ring_publish(struct mpsc_ring *ring, uint64_t position);
+
+// (consumer) returns the oldest element (or NULL if the ring is empty). its
+// slot is handed back to the producer(s) once released.
+void *spsc_ring_peek(struct spsc_ring *ring);
+void spsc_ring_release(struct spsc_ring *ring);
+void *mpsc_ring_peek(struct mpsc_ring *ring);
+void mpsc_ring_release(struct mpsc_ring *ring);
+
+// (producer) copies elem into the ring
+// (ret: 1 success, 0 if the ring is full)
+int spsc_ring_push(struct spsc_ring *ring, const void *elem, size_t elem_size);
+int mpsc_ring_push(struct mpsc_ring *ring, const void *elem, size_t elem_size);
+
+// (consumer) copies the oldest element out of the ring into elem
+// (ret: 1 success, 0 if the ring is empty)
+int spsc_ring_pop(struct spsc_ring *ring, void *elem, size_t elem_size);
+int mpsc_ring_pop(struct mpsc_ring *ring, void *elem, size_t elem_size);
+
+// (consumer) drops every published element
+// note: with several producers, one still writing its slot is left alone
+void spsc_ring_clear(struct spsc_ring *ring);
+void mpsc_ring_clear(struct mpsc_ring *ring);
+
+#endif	// RING_H_
@@ -0,0 +1,914 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "cluster.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// network includes
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+// the maximum number of events handled per call to epoll_wait()
+#define MAX_EPOLL_EVENTS 64
+
+// epoll user data tags for the listening socket and the mailbox
+// (links are tagged by the node at the other end, and links that have yet to
+// introduce themselves by their slot, above HELLO_TAG_BASE)
+#define LISTENER_TAG ((uint64_t)-1)
+#define MAILBOX_TAG ((uint64_t)-2)
+#define HELLO_TAG_BASE ((uint64_t)1 << 32)
+#define HELLO_TAG(h) (HELLO_TAG_BASE | (uint32_t)(h))
+
+// a scanf conversion for a username (or room name)
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+#define NAME_FORMAT "%" STRINGIFY(MAX_USERNAME_LEN) "s"
+
+// forward declaration(s)
+static void cluster_link_down(struct cluster *cluster, int node);
+
+// returns the current time in milliseconds
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// hands the verdict on a claim (already taken off the list) to the shard whose
+// join made it (result is 1 claimed, -1 username taken, 0 no answer)
+static void cluster_decide_claim(struct cluster *cluster, struct cluster_claim *claim, int result) {
+    cluster->handlers.claimed(claim->shard, claim->slot, claim->ticket, claim->username, result);
+    free(claim);
+}
+
+
+
+//
+// LINK function(s)
+// the link thread opens a link to every node after it in the list (and
+// retries every CLUSTER_RETRY_MS while one is down), and accepts the links
+// opened by the nodes before it
+//
+
+// updates whether epoll should report when the link to node is writable
+static void cluster_watch_writable(struct cluster *cluster, int node, int want_write) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    if (peer->want_write == want_write) {
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.u64 = node;
+    if (epoll_ctl(cluster->epoll_fd, EPOLL_CTL_MOD, peer->fd, &ev) < 0) {
+        perror("epoll_ctl() failed");
+    }
+    peer->want_write = want_write;
+}
+
+// queues the message on the link to node, to go out with the next flush
+static void cluster_queue(struct cluster *cluster, int node, struct message *message) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    if (outbound_queue_push(&peer->outbound, message)) {
+        peer->dirty = 1;
+    }
+}
+
+// writes everything queued during this wakeup, a single writev() per link
+static void cluster_flush_dirty(struct cluster *cluster) {
+    for (int node = 0; node < cluster->num_nodes; node++) {
+        struct cluster_peer *peer = &cluster->peers[node];
+        if (!peer->dirty || peer->fd < 0 || peer->connecting) {
+            continue;
+        }
+        peer->dirty = 0;
+
+        int ret = outbound_queue_flush(&peer->outbound, peer->fd);
+        if (ret < 0) {
+            cluster_link_down(cluster, node);
+        }
+        else {
+            // wait for the socket to drain if anything is left over
+            cluster_watch_writable(cluster, node, ret == 0);
+        }
+    }
+}
+
+// marks the link to node as up, and tells the node about every local user
+static void cluster_link_up(struct cluster *cluster, int node) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    cluster_watch_writable(cluster, node, 0);
+    __atomic_store_n(&peer->up, 1, __ATOMIC_RELEASE);
+    printf("linked to node %d\n", node);
+
+    // the node forgets our users whenever the link drops, so start it over
+    int count;
+    char *usernames = directory_list_below(cluster->directory, CLUSTER_SHARD_BASE, &count);
+    if (usernames == NULL) {
+        return;
+    }
+
+    for (int u = 0; u < count; u++) {
+        struct message *message = message_format("/nodejoined %s", usernames + u * (MAX_USERNAME_LEN + 1));
+        if (message != NULL) {
+            cluster_queue(cluster, node, message);
+            message_unref(message);
+        }
+    }
+    free(usernames);
+}
+
+// closes the link to node, and forgets every user on that node (as far as
+// this node's users are concerned, they all left)
+static void cluster_link_down(struct cluster *cluster, int node) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    if (peer->fd >= 0) {
+        close(peer->fd);
+    }
+
+    peer->fd = -1;
+    peer->connecting = 0;
+    peer->want_write = 0;
+    peer->dirty = 0;
+    peer->relay_type = -1;
+    frame_decoder_free(&peer->decoder);
+    outbound_queue_free(&peer->outbound);
+    outbound_queue_initialize(&peer->outbound);
+
+    // a link that never came up (e.g. a refused connection) has nothing else to undo
+    if (!peer->up) {
+        return;
+    }
+    __atomic_store_n(&peer->up, 0, __ATOMIC_RELEASE);
+    printf("lost the link to node %d\n", node);
+
+    // joins waiting on the node won't hear back now
+    pthread_mutex_lock(&cluster->claims_lock);
+    struct cluster_claim *lost = NULL;
+    struct cluster_claim **link = &cluster->claims;
+    while (*link != NULL) {
+        struct cluster_claim *claim = *link;
+        if (claim->node == node) {
+            *link = claim->next;
+            claim->next = lost;
+            lost = claim;
+        }
+        else {
+            link = &claim->next;
+        }
+    }
+    pthread_mutex_unlock(&cluster->claims_lock);
+
+    while (lost != NULL) {
+        struct cluster_claim *claim = lost;
+        lost = claim->next;
+        cluster_decide_claim(cluster, claim, 0);
+    }
+
+    int count;
+    char *usernames = directory_remove_shard(cluster->directory, CLUSTER_SHARD(node), &count);
+    if (usernames == NULL) {
+        return;
+    }
+
+    for (int u = 0; u < count; u++) {
+        cluster->handlers.left(usernames + u * (MAX_USERNAME_LEN + 1));
+    }
+    free(usernames);
+}
+
+// starts opening the link to node
+static void cluster_connect(struct cluster *cluster, int node) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    peer->last_attempt_ms = now_ms();
+
+    int fd = socket(peer->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("socket() failed");
+        return;
+    }
+
+    // note: a node that is down is simply tried again later
+    if (connect(fd, (struct sockaddr *)&peer->addr, peer->addr_len) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u64 = node;
+    if (epoll_ctl(cluster->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl() failed");
+        close(fd);
+        return;
+    }
+
+    peer->fd = fd;
+    peer->connecting = 1;
+    peer->want_write = 1;
+}
+
+// finishes opening the link to node, once the connection completes (or fails)
+static void cluster_finish_connect(struct cluster *cluster, int node) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        cluster_link_down(cluster, node);
+        return;
+    }
+    peer->connecting = 0;
+
+    struct message *hello = message_format("/peer %d", cluster->self);
+    if (hello == NULL) {
+        cluster_link_down(cluster, node);
+        return;
+    }
+    cluster_queue(cluster, node, hello);
+    message_unref(hello);
+
+    cluster_link_up(cluster, node);
+}
+
+// reopens the links (that this node opens) which are down, once their retry interval is up
+static void cluster_reconnect(struct cluster *cluster) {
+    uint64_t now = now_ms();
+    for (int node = cluster->self + 1; node < cluster->num_nodes; node++) {
+        struct cluster_peer *peer = &cluster->peers[node];
+        if (peer->fd < 0 && now - peer->last_attempt_ms >= CLUSTER_RETRY_MS) {
+            cluster_connect(cluster, node);
+        }
+    }
+}
+
+
+
+//
+// PEER function(s)
+// the commands one node sends another (see cluster.h)
+//
+
+// "/relay <mail type> [<name>]": the next frame is a message to deliver
+static void peer_relay(struct cluster *cluster, int node, const char *args) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    char name[MAX_USERNAME_LEN + 1] = "";
+    int type;
+
+    if (sscanf(args, "%d " NAME_FORMAT, &type, name) >= 1 && type >= MAIL_BROADCAST && type <= MAIL_ROOMCAST) {
+        peer->relay_type = type;
+        strcpy(peer->relay_name, name);
+    }
+}
+
+// "/claim <username> <ticket>": the node wants a username this node owns
+static void peer_claim(struct cluster *cluster, int node, const char *args) {
+    char username[MAX_USERNAME_LEN + 1];
+    unsigned ticket;
+    if (sscanf(args, NAME_FORMAT " %u", username, &ticket) != 2) {
+        return;
+    }
+
+    // the claim is held in the directory, so local joins see it too (and a
+    // node asking again for a name it already holds gets it again)
+    int shard, index;
+    int added = directory_add(cluster->directory, username, CLUSTER_SHARD(node), 0);
+    int granted = added == 1 || (added == -1 && directory_lookup(cluster->directory, username, &shard, &index) &&
+        shard == CLUSTER_SHARD(node));
+
+    struct message *response = message_format("/claimresponse %u %s", ticket, granted ? "ok" : "taken");
+    if (response != NULL) {
+        cluster_queue(cluster, node, response);
+        message_unref(response);
+    }
+}
+
+// "/claimresponse <ticket> ok|taken": the owner answered one of our claims
+static void peer_claimresponse(struct cluster *cluster, int node, const char *args) {
+    char status[8];
+    unsigned ticket;
+    if (sscanf(args, "%u %7s", &ticket, status) != 2) {
+        return;
+    }
+
+    pthread_mutex_lock(&cluster->claims_lock);
+    struct cluster_claim *claim = NULL;
+    for (struct cluster_claim **link = &cluster->claims; *link != NULL; link = &(*link)->next) {
+        if ((*link)->ticket == ticket && (*link)->node == node) {
+            claim = *link;
+            *link = claim->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cluster->claims_lock);
+
+    // (a claim that was already given up on has no one left to tell)
+    if (claim != NULL) {
+        cluster_decide_claim(cluster, claim, strcmp(status, "ok") == 0 ? 1 : -1);
+    }
+}
+
+// "/release <username>": a claim the node no longer needs
+static void peer_release(struct cluster *cluster, int node, const char *args) {
+    char username[MAX_USERNAME_LEN + 1];
+    if (sscanf(args, NAME_FORMAT, username) == 1) {
+        directory_remove_from_shard(cluster->directory, username, CLUSTER_SHARD(node));
+    }
+}
+
+// "/nodejoined <username>": a user joined on the node
+static void peer_nodejoined(struct cluster *cluster, int node, const char *args) {
+    char username[MAX_USERNAME_LEN + 1];
+    if (sscanf(args, NAME_FORMAT, username) != 1) {
+        return;
+    }
+
+    // the user is already filed under the node if this node granted their claim
+    int shard, index;
+    int added = directory_add(cluster->directory, username, CLUSTER_SHARD(node), 0);
+    if (added == 1 || (added == -1 && directory_lookup(cluster->directory, username, &shard, &index) &&
+        shard == CLUSTER_SHARD(node))) {
+        cluster->handlers.joined(username);
+    }
+    else {
+        printf("node %d announced user %s, who is already logged in elsewhere\n", node, username);
+    }
+}
+
+// "/nodeleft <username>": a user left the node
+static void peer_nodeleft(struct cluster *cluster, int node, const char *args) {
+    char username[MAX_USERNAME_LEN + 1];
+    if (sscanf(args, NAME_FORMAT, username) == 1 &&
+        directory_remove_from_shard(cluster->directory, username, CLUSTER_SHARD(node))) {
+        cluster->handlers.left(username);
+    }
+}
+
+// the handler for each command a node may send
+static const struct peer_command {
+    const char *word;
+    void (*handle)(struct cluster *cluster, int node, const char *args);
+} peer_commands[] = {
+    {"/relay", peer_relay},
+    {"/claim", peer_claim},
+    {"/claimresponse", peer_claimresponse},
+    {"/release", peer_release},
+    {"/nodejoined", peer_nodejoined},
+    {"/nodeleft", peer_nodeleft},
+};
+
+// handles a single frame received from node
+static void cluster_route_frame(struct cluster *cluster, int node, const char *payload, size_t len) {
+    struct cluster_peer *peer = &cluster->peers[node];
+
+    // the frame after a relay header is the relayed message itself
+    if (peer->relay_type >= 0) {
+        struct message *message = message_new(payload, len);
+        if (message != NULL) {
+            cluster->handlers.relay(peer->relay_type, peer->relay_name, message);
+            message_unref(message);
+        }
+        peer->relay_type = -1;
+        return;
+    }
+
+    for (size_t c = 0; c < sizeof(peer_commands) / sizeof(peer_commands[0]); c++) {
+        size_t word_len = strlen(peer_commands[c].word);
+        if (strncmp(payload, peer_commands[c].word, word_len) == 0 &&
+            (payload[word_len] == ' ' || payload[word_len] == '\0')) {
+            peer_commands[c].handle(cluster, node, payload + word_len);
+            return;
+        }
+    }
+}
+
+// handles every complete frame buffered for the link to node
+static void cluster_route_frames(struct cluster *cluster, int node) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    char *payload;
+    size_t len;
+    int ret;
+
+    while ((ret = frame_decoder_next(&peer->decoder, &payload, &len)) == 1) {
+        cluster_route_frame(cluster, node, payload, len);
+    }
+
+    if (ret < 0) {
+        printf("node %d sent an oversized frame\n", node);
+        cluster_link_down(cluster, node);
+    }
+}
+
+// reads everything pending on the link to node
+static void cluster_read(struct cluster *cluster, int node) {
+    struct cluster_peer *peer = &cluster->peers[node];
+    ssize_t nread = frame_decoder_read(&peer->decoder, peer->fd);
+
+    if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (nread <= 0) {
+        cluster_link_down(cluster, node);
+        return;
+    }
+
+    cluster_route_frames(cluster, node);
+}
+
+// forgets the link waiting in hello slot h, closing it unless it was adopted
+static void cluster_end_hello(struct cluster *cluster, int h, int adopted) {
+    struct cluster_hello *hello = &cluster->hellos[h];
+    if (!adopted) {
+        close(hello->fd);
+        frame_decoder_free(&hello->decoder);
+    }
+    hello->fd = -1;
+}
+
+// starts waiting for a link opened by another node to introduce itself
+static void cluster_accept(struct cluster *cluster, int fd, const struct sockaddr_in *from) {
+    int h = 0;
+    while (h < CLUSTER_MAX_HELLOS && cluster->hellos[h].fd >= 0) {
+        h++;
+    }
+    if (h == CLUSTER_MAX_HELLOS) {
+        printf("too many links waiting to introduce themselves, refused one\n");
+        close(fd);
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = HELLO_TAG(h);
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || epoll_ctl(cluster->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("failed to register link");
+        close(fd);
+        return;
+    }
+
+    struct cluster_hello *hello = &cluster->hellos[h];
+    hello->fd = fd;
+    hello->from = *from;
+    hello->deadline_ms = now_ms() + CLUSTER_HELLO_TIMEOUT_MS;
+    frame_decoder_initialize(&hello->decoder);
+}
+
+// reads what the link in hello slot h has sent, and adopts it as the link to
+// the node it says it is, once its introduction is in (and checks out)
+static void cluster_read_hello(struct cluster *cluster, int h) {
+    struct cluster_hello *hello = &cluster->hellos[h];
+    ssize_t nread = frame_decoder_read(&hello->decoder, hello->fd);
+    if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (nread <= 0) {
+        cluster_end_hello(cluster, h, 0);
+        return;
+    }
+
+    // an introduction is tiny, so anything announcing more is refused outright
+    size_t pending;
+    if (frame_decoder_peek_len(&hello->decoder, &pending) && pending > CLUSTER_MAX_HELLO_LEN) {
+        printf("refused a link that did not introduce itself\n");
+        cluster_end_hello(cluster, h, 0);
+        return;
+    }
+
+    char *payload;
+    size_t len;
+    int ret = frame_decoder_next(&hello->decoder, &payload, &len);
+    if (ret == 0) {
+        return;
+    }
+
+    // only the nodes before this one in the list open links to it, and only
+    // from their own address
+    int node;
+    if (ret < 0 || sscanf(payload, "/peer %d", &node) != 1 || node < 0 || node >= cluster->self) {
+        printf("refused a link that did not introduce itself\n");
+        cluster_end_hello(cluster, h, 0);
+        return;
+    }
+
+    struct sockaddr_in *expected = (struct sockaddr_in *)&cluster->peers[node].addr;
+    if (hello->from.sin_addr.s_addr != expected->sin_addr.s_addr) {
+        char from[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &hello->from.sin_addr, from, sizeof(from));
+        printf("refused a link from %s claiming to be node %d\n", from, node);
+        cluster_end_hello(cluster, h, 0);
+        return;
+    }
+
+    // a node that reopens its link replaces the old one
+    if (cluster->peers[node].fd >= 0) {
+        cluster_link_down(cluster, node);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = node;
+    if (epoll_ctl(cluster->epoll_fd, EPOLL_CTL_MOD, hello->fd, &ev) < 0) {
+        perror("failed to register link");
+        cluster_end_hello(cluster, h, 0);
+        return;
+    }
+
+    // anything the node sent after its hello stays buffered in the decoder
+    struct cluster_peer *peer = &cluster->peers[node];
+    peer->fd = hello->fd;
+    peer->want_write = 0;
+    peer->decoder = hello->decoder;
+    cluster_end_hello(cluster, h, 1);
+    cluster_link_up(cluster, node);
+    cluster_route_frames(cluster, node);
+}
+
+// closes every link that did not introduce itself in time, and returns how
+// long (in milliseconds) until the next one is due to have, at most max_ms
+static int cluster_expire_hellos(struct cluster *cluster, int max_ms) {
+    uint64_t now = now_ms();
+    int wait_ms = max_ms;
+
+    for (int h = 0; h < CLUSTER_MAX_HELLOS; h++) {
+        struct cluster_hello *hello = &cluster->hellos[h];
+        if (hello->fd < 0) {
+            continue;
+        }
+        if (now >= hello->deadline_ms) {
+            printf("refused a link that did not introduce itself in time\n");
+            cluster_end_hello(cluster, h, 0);
+        }
+        else if (hello->deadline_ms - now < (uint64_t)wait_ms) {
+            wait_ms = (int)(hello->deadline_ms - now);
+        }
+    }
+    return wait_ms;
+}
+
+// gives up on every claim whose owner did not answer in time, and returns how
+// long (in milliseconds) until the next one is due, at most max_ms
+static int cluster_expire_claims(struct cluster *cluster, int max_ms) {
+    uint64_t now = now_ms();
+    int wait_ms = max_ms;
+
+    pthread_mutex_lock(&cluster->claims_lock);
+    struct cluster_claim *expired = NULL;
+    struct cluster_claim **link = &cluster->claims;
+    while (*link != NULL) {
+        struct cluster_claim *claim = *link;
+        if (now >= claim->deadline_ms) {
+            *link = claim->next;
+            claim->next = expired;
+            expired = claim;
+            continue;
+        }
+        if (claim->deadline_ms - now < (uint64_t)wait_ms) {
+            wait_ms = (int)(claim->deadline_ms - now);
+        }
+        link = &claim->next;
+    }
+    pthread_mutex_unlock(&cluster->claims_lock);
+
+    while (expired != NULL) {
+        struct cluster_claim *claim = expired;
+        expired = claim->next;
+        printf("node %d did not answer a claim in time\n", claim->node);
+
+        // the owner may still grant a claim we gave up on, so hand it straight back
+        struct message *release = message_format("/release %s", claim->username);
+        if (release != NULL) {
+            if (cluster->peers[claim->node].up) {
+                cluster_queue(cluster, claim->node, release);
+            }
+            message_unref(release);
+        }
+        cluster_decide_claim(cluster, claim, 0);
+    }
+    return wait_ms;
+}
+
+// hands everything the shards posted to the links it is for
+static void cluster_take_mail(struct cluster *cluster) {
+    mailbox_acknowledge(&cluster->mailbox);
+
+    struct mail mail;
+    while (mailbox_take(&cluster->mailbox, &mail)) {
+        // a relay goes out as a header naming its recipient, followed by the
+        // message itself (so the message is never copied)
+        struct message *header = NULL;
+        if (mail.type != MAIL_PEER && (header = message_format("/relay %d %s", mail.type, mail.name)) == NULL) {
+            message_unref(mail.message);
+            continue;
+        }
+
+        for (int node = 0; node < cluster->num_nodes; node++) {
+            if (node == cluster->self || (mail.index >= 0 && node != mail.index) || !cluster->peers[node].up) {
+                continue;
+            }
+            if (header != NULL) {
+                cluster_queue(cluster, node, header);
+            }
+            cluster_queue(cluster, node, mail.message);
+        }
+
+        if (header != NULL) {
+            message_unref(header);
+        }
+        message_unref(mail.message);
+    }
+}
+
+// runs the link thread, forever
+static void *cluster_run(void *arg) {
+    struct cluster *cluster = arg;
+
+    while (1) {
+        cluster_reconnect(cluster);
+        int timeout_ms = cluster_expire_hellos(cluster, CLUSTER_RETRY_MS);
+        timeout_ms = cluster_expire_claims(cluster, timeout_ms);
+
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int nevents;
+        if ((nevents = epoll_wait(cluster->epoll_fd, events, MAX_EPOLL_EVENTS, timeout_ms)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait() failed");
+            exit(-1);
+        }
+
+        for (int e = 0; e < nevents; e++) {
+            if (events[e].data.u64 == LISTENER_TAG) {
+                struct sockaddr_in from;
+                socklen_t from_len = sizeof(from);
+                int fd;
+                while ((fd = accept(cluster->listen_fd, (struct sockaddr *)&from, &from_len)) != -1) {
+                    cluster_accept(cluster, fd, &from);
+                    from_len = sizeof(from);
+                }
+            }
+            else if (events[e].data.u64 == MAILBOX_TAG) {
+                cluster_take_mail(cluster);
+            }
+            else if (events[e].data.u64 >= HELLO_TAG_BASE) {
+                int h = (int)(uint32_t)events[e].data.u64;
+                if (cluster->hellos[h].fd >= 0) {
+                    cluster_read_hello(cluster, h);
+                }
+            }
+            else {
+                int node = (int)events[e].data.u64;
+                struct cluster_peer *peer = &cluster->peers[node];
+
+                if (peer->fd >= 0 && peer->connecting) {
+                    cluster_finish_connect(cluster, node);
+                    continue;
+                }
+                if (peer->fd >= 0 && (events[e].events & EPOLLOUT)) {
+                    peer->dirty = 1;
+                }
+                if (peer->fd >= 0 && (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    cluster_read(cluster, node);
+                }
+            }
+        }
+
+        // send out everything that was queued during this wakeup
+        cluster_flush_dirty(cluster);
+    }
+
+    return NULL;
+}
+
+
+
+//
+// CLUSTER function(s)
+//
+
+// returns the number of nodes listed in nodes (or 0 if the list is malformed)
+int cluster_count_nodes(const char *nodes) {
+    int count = 0;
+    const char *node = nodes;
+
+    while (1) {
+        size_t len = strcspn(node, ",");
+        const char *colon = memchr(node, ':', len);
+        if (len == 0 || colon == NULL || colon == node || colon == node + len - 1) {
+            return 0;
+        }
+        count++;
+
+        if (node[len] == '\0') {
+            return count;
+        }
+        node += len + 1;
+    }
+}
+
+// resolves the host:port pair address into peer's address
+// (ret: the port, or 0 on failure)
+static int cluster_resolve(struct cluster_peer *peer, char *address) {
+    char *colon = strrchr(address, ':');
+    *colon = '\0';
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *info;
+    int err;
+    if ((err = getaddrinfo(address, colon + 1, &hints, &info)) != 0) {
+        printf("can't resolve cluster node %s: %s\n", address, gai_strerror(err));
+        return 0;
+    }
+
+    memcpy(&peer->addr, info->ai_addr, info->ai_addrlen);
+    peer->addr_len = info->ai_addrlen;
+    freeaddrinfo(info);
+    return atoi(colon + 1);
+}
+
+// sets up node self of the cluster, listening for the other nodes' links
+int cluster_initialize(struct cluster *cluster, const char *nodes, int self, struct directory *directory,
+    const struct cluster_handlers *handlers) {
+
+    memset(cluster, 0, sizeof(struct cluster));
+    cluster->self = self;
+    cluster->num_nodes = cluster_count_nodes(nodes);
+    cluster->directory = directory;
+    cluster->handlers = *handlers;
+
+    if (cluster->num_nodes < 1 || cluster->num_nodes > MAX_CLUSTER_NODES || self < 0 || self >= cluster->num_nodes) {
+        printf("invalid cluster (up to %d nodes, and this node must be one of them)\n", MAX_CLUSTER_NODES);
+        return 0;
+    }
+
+    char *list = strdup(nodes);
+    if (list == NULL) {
+        perror("strdup() failed");
+        return 0;
+    }
+
+    char *saveptr;
+    char *address = strtok_r(list, ",", &saveptr);
+    for (int h = 0; h < CLUSTER_MAX_HELLOS; h++) {
+        cluster->hellos[h].fd = -1;
+    }
+
+    for (int node = 0; node < cluster->num_nodes; node++, address = strtok_r(NULL, ",", &saveptr)) {
+        struct cluster_peer *peer = &cluster->peers[node];
+        peer->fd = -1;
+        peer->relay_type = -1;
+        frame_decoder_initialize(&peer->decoder);
+        outbound_queue_initialize(&peer->outbound);
+
+        if (cluster_resolve(peer, address) == 0) {
+            free(list);
+            return 0;
+        }
+    }
+    free(list);
+
+    // listen for the links opened by the nodes before this one (only on this
+    // node's own address in the list)
+    if ((cluster->listen_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+        perror("socket() failed");
+        return 0;
+    }
+
+    if (setsockopt(cluster->listen_fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEADDR) failed");
+        return 0;
+    }
+
+    if (bind(cluster->listen_fd, (struct sockaddr *)&cluster->peers[self].addr, cluster->peers[self].addr_len) < 0) {
+        perror("bind() failed for the cluster port");
+        return 0;
+    }
+
+    if (listen(cluster->listen_fd, SOMAXCONN) < 0) {
+        perror("listen() failed");
+        return 0;
+    }
+
+    pthread_mutex_init(&cluster->claims_lock, NULL);
+
+    return mailbox_initialize(&cluster->mailbox, 0);
+}
+
+// starts the link thread, which opens (and keeps reopening) the links
+int cluster_start(struct cluster *cluster) {
+    if ((cluster->epoll_fd = epoll_create1(0)) < 0) {
+        perror("epoll_create1() failed");
+        return 0;
+    }
+
+    struct epoll_event listen_ev;
+    listen_ev.events = EPOLLIN;
+    listen_ev.data.u64 = LISTENER_TAG;
+
+    struct epoll_event mailbox_ev;
+    mailbox_ev.events = EPOLLIN;
+    mailbox_ev.data.u64 = MAILBOX_TAG;
+
+    if (epoll_ctl(cluster->epoll_fd, EPOLL_CTL_ADD, cluster->listen_fd, &listen_ev) < 0 ||
+        epoll_ctl(cluster->epoll_fd, EPOLL_CTL_ADD, cluster->mailbox.event_fd, &mailbox_ev) < 0) {
+        perror("epoll_ctl() failed");
+        return 0;
+    }
+
+    if (pthread_create(&cluster->thread, NULL, cluster_run, cluster) != 0) {
+        perror("pthread_create() failed");
+        return 0;
+    }
+    return 1;
+}
+
+// returns the node that owns "username": the first reachable node in the list,
+// counting on from the username's hash
+static int cluster_owner(struct cluster *cluster, const char *username) {
+    int first = username_hash(username) % cluster->num_nodes;
+    for (int n = 0; n < cluster->num_nodes; n++) {
+        int node = (first + n) % cluster->num_nodes;
+        if (node == cluster->self || __atomic_load_n(&cluster->peers[node].up, __ATOMIC_ACQUIRE)) {
+            return node;
+        }
+    }
+    return cluster->self;
+}
+
+// posts the message to be sent as is to node (or to every other node if node is -1)
+static void cluster_post(struct cluster *cluster, int node, struct message *message) {
+    if (message != NULL) {
+        mailbox_post(&cluster->mailbox, 0, MAIL_PEER, node, NULL, message);
+        message_unref(message);
+    }
+}
+
+// claims "username" across the cluster, for the join in handshake slot of shard
+int cluster_claim(struct cluster *cluster, const char *username, int shard, int slot, uint32_t *ticket) {
+    // the local directory already holds the claims for names this node owns
+    int owner = cluster_owner(cluster, username);
+    if (owner == cluster->self) {
+        return 1;
+    }
+
+    struct cluster_claim *claim = malloc(sizeof(struct cluster_claim));
+    if (claim == NULL) {
+        perror("malloc() failed in cluster_claim()");
+        return -1;
+    }
+    claim->node = owner;
+    claim->shard = shard;
+    claim->slot = slot;
+    strcpy(claim->username, username);
+    claim->deadline_ms = now_ms() + CLUSTER_CLAIM_TIMEOUT_MS;
+
+    // the link thread takes the claim from here (and may even decide it before
+    // this returns, so the ticket is handed back first)
+    pthread_mutex_lock(&cluster->claims_lock);
+    claim->ticket = *ticket = cluster->next_ticket++;
+    claim->next = cluster->claims;
+    cluster->claims = claim;
+    pthread_mutex_unlock(&cluster->claims_lock);
+
+    cluster_post(cluster, owner, message_format("/claim %s %u", username, *ticket));
+    return 0;
+}
+
+// gives back a claim that was granted, but whose join then failed
+void cluster_release(struct cluster *cluster, const char *username) {
+    int owner = cluster_owner(cluster, username);
+    if (owner != cluster->self) {
+        cluster_post(cluster, owner, message_format("/release %s", username));
+    }
+}
+
+// tells every other node that the local user "username" joined
+void cluster_announce_join(struct cluster *cluster, const char *username) {
+    cluster_post(cluster, -1, message_format("/nodejoined %s", username));
+}
+
+// tells every other node that the local user "username" left
+void cluster_announce_leave(struct cluster *cluster, const char *username) {
+    cluster_post(cluster, -1, message_format("/nodeleft %s", username));
+}
+
+// relays the message to node (or to every other node if node is -1)
+void cluster_relay(struct cluster *cluster, int node, int type, const char *name, struct message *message) {
+    mailbox_post(&cluster->mailbox, 0, type, node, name, message);
+}
@@ -0,0 +1,177 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "directory.h"
+#include "mailbox.h"
+#include "message.h"
+#include "outbound.h"
+
+// a cluster is a fixed set of server nodes (given as the same list on every
+// node, with each node told its own position in it) that share their users.
+// every pair of nodes is joined by a tcp link, opened by the node earlier in
+// the list, and each node runs a link thread that owns all of its links.
+//
+// every node keeps the whole cluster's users in its directory (a user on
+// another node is filed under CLUSTER_SHARD(node)), so userlists and whisper
+// lookups never leave the node. before a join completes, the username is
+// claimed from its owner: the first reachable node in the list, counting on
+// from the username's hash. the owner serializes the claims for its names,
+// so a username is only ever granted once, and the join is then announced to
+// every node. a shard never waits on a claim: the join stays in its handshake
+// slot, and the link thread posts the verdict back once the owner answers.
+//
+// shards hand whatever has to cross to another node to the link thread
+// through its mailbox. the link thread queues everything it takes on each
+// link's outbound queue and flushes every link once per wakeup, so a burst of
+// messages crosses in a single writev() rather than one write per message.
+//
+// a node only listens for links on its own address in the list, and only
+// adopts a link once it has introduced itself (within CLUSTER_HELLO_TIMEOUT_MS)
+// as a node before it in the list, from that node's address. until then a
+// link is read like any other, so a peer that is slow to introduce itself
+// never holds up the link thread.
+//
+// between nodes, every frame is a text command:
+//   /peer <node>                   (the first frame on a link, from the node that opened it)
+//   /claim <username> <ticket>     -> /claimresponse <ticket> ok|taken
+//   /release <username>            (a granted claim that went unused)
+//   /nodejoined <username>
+//   /nodeleft <username>
+//   /relay <mail type> [<name>]    (followed by the relayed message, as its own frame)
+
+// the most nodes in a cluster
+#define MAX_CLUSTER_NODES 16
+
+// the directory shard that stands for another node's users
+#define CLUSTER_SHARD_BASE 1024
+#define CLUSTER_SHARD(node) (CLUSTER_SHARD_BASE + (node))
+
+// how long to wait before reopening a link that is down
+#define CLUSTER_RETRY_MS 1000
+
+// how long a freshly accepted link has to introduce itself, the longest its
+// introduction may be, and the most links that may be waiting to at once
+#define CLUSTER_HELLO_TIMEOUT_MS 1000
+#define CLUSTER_MAX_HELLO_LEN 64
+#define CLUSTER_MAX_HELLOS MAX_CLUSTER_NODES
+
+// how long a claim waits to hear back from the owner of its username, before
+// the join is refused as unavailable
+#define CLUSTER_CLAIM_TIMEOUT_MS 2000
+
+// a link to another node
+struct cluster_peer {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int fd;
+    int connecting;
+    int up;
+    int want_write;
+    int dirty;
+    uint64_t last_attempt_ms;
+    struct frame_decoder decoder;
+    struct outbound_queue outbound;
+
+    // the relay whose message is the next frame (or -1)
+    int relay_type;
+    char relay_name[MAX_USERNAME_LEN + 1];
+};
+
+// a link accepted from another node, waiting for it to say which node it is
+struct cluster_hello {
+    int fd;
+    struct sockaddr_in from;
+    uint64_t deadline_ms;
+    struct frame_decoder decoder;
+};
+
+// a join (in handshake slot of shard) waiting to hear back from the owner
+// of its username
+struct cluster_claim {
+    uint32_t ticket;
+    int node;
+    int shard;
+    int slot;
+    char username[MAX_USERNAME_LEN + 1];
+    uint64_t deadline_ms;
+    struct cluster_claim *next;
+};
+
+// what the link thread hands to the rest of the server
+struct cluster_handlers {
+    // delivers a message relayed from another node (type is MAIL_BROADCAST,
+    // MAIL_WHISPER or MAIL_ROOMCAST, and name its recipient or room)
+    void (*relay)(int type, const char *name, struct message *message);
+
+    // tells every local user that a user on another node joined (or left)
+    void (*joined)(const char *username);
+    void (*left)(const char *username);
+
+    // hands the verdict on a claim made by cluster_claim() back to the join
+    // in handshake slot of shard (result is 1 claimed, -1 username taken, 0
+    // the owner could not be reached)
+    void (*claimed)(int shard, int slot, uint32_t ticket, const char *username, int result);
+};
+
+struct cluster {
+    int self;
+    int num_nodes;
+    struct cluster_peer peers[MAX_CLUSTER_NODES];
+    struct cluster_hello hellos[CLUSTER_MAX_HELLOS];
+    int listen_fd;
+    int epoll_fd;
+    struct mailbox mailbox;
+    struct directory *directory;
+    struct cluster_handlers handlers;
+    pthread_t thread;
+
+    // guards the claims in flight
+    pthread_mutex_t claims_lock;
+    struct cluster_claim *claims;
+    uint32_t next_ticket;
+};
+
+// sets up node self of the cluster whose nodes are listed (as comma separated
+// host:port pairs) in nodes, listening for the other nodes' links
+// (ret: 1 success, 0 failure)
+int cluster_initialize(struct cluster *cluster, const char *nodes, int self, struct directory *directory,
+    const struct cluster_handlers *handlers);
+
+// returns the number of nodes listed in nodes (or 0 if the list is malformed)
+int cluster_count_nodes(const char *nodes);
+
+// starts the link thread, which opens (and keeps reopening) the links
+// (ret: 1 success, 0 failure)
+int cluster_start(struct cluster *cluster);
+
+// claims "username" (already added to the local directory) across the cluster,
+// for the join in handshake slot of shard. if the owner is another node, this
+// returns right away, and the verdict arrives later through handlers.claimed,
+// along with the ticket returned in *ticket
+// (ret: 1 claimed, 0 waiting on the owner, -1 the claim could not be made)
+int cluster_claim(struct cluster *cluster, const char *username, int shard, int slot, uint32_t *ticket);
+
+// gives back a claim that was granted, but whose join then failed
+void cluster_release(struct cluster *cluster, const char *username);
+
+// tells every other node that the local user "username" joined (or left)
+void cluster_announce_join(struct cluster *cluster, const char *username);
+void cluster_announce_leave(struct cluster *cluster, const char *username);
+
+// relays the message to node (or to every other node if node is -1), where it
+// is delivered as mail of the given type (see mailbox.h)
+void cluster_relay(struct cluster *cluster, int node, int type, const char *name, struct message *message);
+
+#endif  // CLUSTER_H_
@@ -0,0 +1,246 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "directory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// returns the hash of username (FNV-1a)
+uint32_t username_hash(const char *username) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)username; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// returns the slot holding username, or the empty slot it would go in
+// note: the caller must hold the lock
+static uint32_t directory_find_slot(struct directory *directory, const char *username, uint32_t hash) {
+    uint32_t slot = hash & directory->mask;
+    while (directory->entries[slot].taken == 1) {
+        if (directory->entries[slot].hash == hash && strcmp(directory->entries[slot].username, username) == 0) {
+            break;
+        }
+        slot = (slot + 1) & directory->mask;
+    }
+    return slot;
+}
+
+// initialize the directory
+int directory_initialize(struct directory *directory, int max_users, int shared) {
+    // keep the table at most half full, so probe sequences stay short
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t)max_users * 2) {
+        capacity *= 2;
+    }
+
+    if ((directory->entries = shared_alloc(capacity * sizeof(struct directory_entry), shared)) == NULL) {
+        return 0;
+    }
+
+    shared_mutex_initialize(&directory->lock, shared);
+    directory->mask = capacity - 1;
+    directory->count = 0;
+    directory->max_users = max_users;
+    return 1;
+}
+
+// claims "username" for the user at (shard, index)
+int directory_add(struct directory *directory, const char *username, int shard, int index) {
+    uint32_t hash = username_hash(username);
+    int ret = 1;
+
+    shared_mutex_lock(&directory->lock);
+    uint32_t slot = directory_find_slot(directory, username, hash);
+
+    if (directory->entries[slot].taken == 1) {
+        ret = -1;
+    }
+    else if (directory->count >= directory->max_users) {
+        ret = -2;
+    }
+    else {
+        strcpy(directory->entries[slot].username, username);
+        directory->entries[slot].hash = hash;
+        directory->entries[slot].shard = shard;
+        directory->entries[slot].index = index;
+        directory->entries[slot].taken = 1;
+        directory->count++;
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    return ret;
+}
+
+// files "username", held for a join on shard, under the index its user was given
+int directory_update(struct directory *directory, const char *username, int shard, int index) {
+    uint32_t hash = username_hash(username);
+    int updated = 0;
+
+    shared_mutex_lock(&directory->lock);
+    uint32_t slot = directory_find_slot(directory, username, hash);
+
+    if (directory->entries[slot].taken == 1 && directory->entries[slot].shard == shard) {
+        directory->entries[slot].index = index;
+        updated = 1;
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    return updated;
+}
+
+// releases the entry in slot
+// note: the caller must hold the lock
+static void directory_remove_slot(struct directory *directory, uint32_t slot) {
+    directory->entries[slot].taken = 0;
+    directory->count--;
+
+    // shift the following entries of the probe sequence back, so that
+    // lookups never stop early at the hole we just left
+    uint32_t hole = slot;
+    uint32_t next = (slot + 1) & directory->mask;
+    while (directory->entries[next].taken == 1) {
+        uint32_t home = directory->entries[next].hash & directory->mask;
+        if (((next - home) & directory->mask) >= ((next - hole) & directory->mask)) {
+            directory->entries[hole] = directory->entries[next];
+            directory->entries[next].taken = 0;
+            hole = next;
+        }
+        next = (next + 1) & directory->mask;
+    }
+}
+
+// releases "username"
+void directory_remove(struct directory *directory, const char *username) {
+    uint32_t hash = username_hash(username);
+
+    shared_mutex_lock(&directory->lock);
+    uint32_t slot = directory_find_slot(directory, username, hash);
+
+    if (directory->entries[slot].taken == 1) {
+        directory_remove_slot(directory, slot);
+    }
+    pthread_mutex_unlock(&directory->lock);
+}
+
+// releases "username" if it is claimed by a user on shard
+int directory_remove_from_shard(struct directory *directory, const char *username, int shard) {
+    uint32_t hash = username_hash(username);
+    int removed = 0;
+
+    shared_mutex_lock(&directory->lock);
+    uint32_t slot = directory_find_slot(directory, username, hash);
+
+    if (directory->entries[slot].taken == 1 && directory->entries[slot].shard == shard) {
+        directory_remove_slot(directory, slot);
+        removed = 1;
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    return removed;
+}
+
+// releases every username claimed by a user on shard
+char *directory_remove_shard(struct directory *directory, int shard, int *count) {
+    shared_mutex_lock(&directory->lock);
+
+    char *usernames = malloc((size_t)(directory->count + 1) * (MAX_USERNAME_LEN + 1));
+    *count = 0;
+
+    if (usernames != NULL) {
+        // removing an entry can shift a later one back into its slot, so look
+        // at the same slot again before moving on
+        uint32_t slot = 0;
+        while (slot <= directory->mask) {
+            struct directory_entry *entry = &directory->entries[slot];
+            if (entry->taken == 1 && entry->shard == shard) {
+                strcpy(usernames + *count * (MAX_USERNAME_LEN + 1), entry->username);
+                (*count)++;
+                directory_remove_slot(directory, slot);
+            }
+            else {
+                slot++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    if (usernames == NULL) {
+        perror("malloc() failed in directory_remove_shard()");
+    }
+    return usernames;
+}
+
+// lists every username claimed by a user on a shard below shard_limit
+char *directory_list_below(struct directory *directory, int shard_limit, int *count) {
+    shared_mutex_lock(&directory->lock);
+
+    char *usernames = malloc((size_t)(directory->count + 1) * (MAX_USERNAME_LEN + 1));
+    *count = 0;
+
+    if (usernames != NULL) {
+        for (uint32_t slot = 0; slot <= directory->mask; slot++) {
+            struct directory_entry *entry = &directory->entries[slot];
+            if (entry->taken == 1 && entry->shard < shard_limit && entry->index != DIRECTORY_PENDING) {
+                strcpy(usernames + *count * (MAX_USERNAME_LEN + 1), entry->username);
+                (*count)++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    if (usernames == NULL) {
+        perror("malloc() failed in directory_list_below()");
+    }
+    return usernames;
+}
+
+// finds the owner of "username"
+int directory_lookup(struct directory *directory, const char *username, int *shard, int *index) {
+    uint32_t hash = username_hash(username);
+    int found = 0;
+
+    shared_mutex_lock(&directory->lock);
+    uint32_t slot = directory_find_slot(directory, username, hash);
+
+    if (directory->entries[slot].taken == 1 && directory->entries[slot].index != DIRECTORY_PENDING) {
+        *shard = directory->entries[slot].shard;
+        *index = directory->entries[slot].index;
+        found = 1;
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    return found;
+}
+
+// returns a new message (with one reference) containing "/userlist <username1> ... <usernamei>"
+struct message *directory_format_userlist(struct directory *directory) {
+    shared_mutex_lock(&directory->lock);
+
+    // format straight into the message, then trim its length to fit
+    struct message *message = message_alloc(strlen("/userlist") + directory->count * (MAX_USERNAME_LEN + 1) + 1);
+
+    if (message != NULL) {
+        char *payload = message->data + FRAME_HEADER_LEN;
+        char *end = payload + sprintf(payload, "/userlist");
+
+        for (uint32_t i = 0; i <= directory->mask; i++) {
+            if (directory->entries[i].taken == 1 && directory->entries[i].index != DIRECTORY_PENDING) {
+                end += sprintf(end, " %s", directory->entries[i].username);
+            }
+        }
+
+        message->len = end - message->data;
+        frame_put_header(message->data, end - payload);
+    }
+    pthread_mutex_unlock(&directory->lock);
+
+    return message;
+}
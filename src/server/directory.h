@@ -0,0 +1,86 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef DIRECTORY_H_
+#define DIRECTORY_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "message.h"
+#include "shared.h"
+
+// the directory maps every logged in username (across all shards) to the
+// shard that owns its socket and its index in that shard's user list. it is
+// only locked on joins, leaves and whisper lookups, never while fanning out.
+//
+// it is an open addressing hash table (with linear probing) sized for
+// max_users at startup, so lookups stay constant time however many users are
+// logged in. (being allocated once also lets it live in shared memory, for
+// worker processes.)
+
+// the index a username is held under while its join waits on its claim (see
+// cluster.h). a held username is taken, but is never found, listed or whispered to
+#define DIRECTORY_PENDING -1
+
+struct directory_entry {
+    char username[MAX_USERNAME_LEN + 1];
+    uint32_t hash;
+    int shard;
+    int index;
+    int taken;
+};
+
+struct directory {
+    pthread_mutex_t lock;
+    struct directory_entry *entries;
+    uint32_t mask;
+    int count;
+    int max_users;
+};
+
+// returns the hash of username
+uint32_t username_hash(const char *username);
+
+// initialize the directory (in memory shared with forked workers, if shared is set)
+// (ret: 1 success, 0 failure)
+int directory_initialize(struct directory *directory, int max_users, int shared);
+
+// claims "username" for the user at (shard, index) (or holds it for a join on
+// shard, if index is DIRECTORY_PENDING)
+// (ret: 1 success, -1 username taken, -2 server full)
+int directory_add(struct directory *directory, const char *username, int shard, int index);
+
+// files "username", held for a join on shard, under the index its user was given
+// (ret: 1 success, 0 not held for shard)
+int directory_update(struct directory *directory, const char *username, int shard, int index);
+
+// releases "username"
+void directory_remove(struct directory *directory, const char *username);
+
+// releases "username" if it is claimed by a user on shard
+// (ret: 1 released, 0 not claimed from shard)
+int directory_remove_from_shard(struct directory *directory, const char *username, int shard);
+
+// releases every username claimed by a user on shard
+// (ret: a newly allocated array of the released usernames, each MAX_USERNAME_LEN + 1
+// bytes long, and their count (or NULL))
+char *directory_remove_shard(struct directory *directory, int shard, int *count);
+
+// lists every username claimed by a user on a shard below shard_limit
+// (ret: a newly allocated array of the usernames, each MAX_USERNAME_LEN + 1
+// bytes long, and their count (or NULL))
+char *directory_list_below(struct directory *directory, int shard_limit, int *count);
+
+// finds the owner of "username"
+// (ret: 1 found, 0 not found)
+int directory_lookup(struct directory *directory, const char *username, int *shard, int *index);
+
+// returns a new message (with one reference) containing "/userlist <username1> ... <usernamei>" (or NULL)
+struct message *directory_format_userlist(struct directory *directory);
+
+#endif  // DIRECTORY_H_
@@ -0,0 +1,67 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "handshake.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// resets slot h and chains it onto the free list
+static void handshake_list_free_slot(struct handshake_list *list, int h) {
+    list->handshakes[h].socket_fd = -1;
+    frame_decoder_initialize(&list->handshakes[h].decoder);
+    list->handshakes[h].polling = 0;
+    list->handshakes[h].closing = 0;
+    list->handshakes[h].claiming = 0;
+    list->handshakes[h].taken = 0;
+    list->handshakes[h].next_free = list->free_head;
+    list->free_head = h;
+}
+
+// initialize handshake list
+int handshake_list_initialize(struct handshake_list *list, int capacity) {
+    list->capacity = capacity;
+    list->count = 0;
+    list->free_head = -1;
+
+    if ((list->handshakes = malloc(capacity * sizeof(struct handshake))) == NULL) {
+        perror("malloc() failed in handshake_list_initialize()");
+        return 0;
+    }
+
+    for (int h = capacity - 1; h >= 0; h--) {
+        handshake_list_free_slot(list, h);
+    }
+    return 1;
+}
+
+// claims a slot for the freshly accepted socket
+int handshake_list_add(struct handshake_list *list, int socket_fd) {
+    int h = list->free_head;
+    if (h < 0) {
+        return -1;
+    }
+
+    list->free_head = list->handshakes[h].next_free;
+    list->handshakes[h].socket_fd = socket_fd;
+    list->handshakes[h].taken = 1;
+    list->handshakes[h].next_free = -1;
+    list->count++;
+    return h;
+}
+
+// frees slot h
+void handshake_list_remove(struct handshake_list *list, int h, int handed_over) {
+    if (h >= 0 && h < list->capacity && list->handshakes[h].taken == 1) {
+        if (!handed_over) {
+            close(list->handshakes[h].socket_fd);
+            frame_decoder_free(&list->handshakes[h].decoder);
+        }
+        list->count--;
+        handshake_list_free_slot(list, h);
+    }
+}
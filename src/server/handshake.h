@@ -0,0 +1,65 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef HANDSHAKE_H_
+#define HANDSHAKE_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+// a connection that was accepted, but has yet to send its /join. it is read
+// from by the event loop like any user's, until its /join frame is complete
+// (or its deadline passes), so a connection that never sends one only costs
+// a slot rather than stalling the shard. in a cluster, a join keeps its slot
+// until its username's claim is decided, too.
+struct handshake {
+    int socket_fd;
+    struct frame_decoder decoder;
+
+    // when the connection was accepted (in nanoseconds, see rate_limit_now())
+    uint64_t accepted_at;
+
+    // (io_uring) whether a poll for the socket is in flight, and whether the
+    // handshake was given up on (and its slot is freed once the poll completes)
+    int polling;
+    int closing;
+
+    // (cluster) whether the /join is waiting on its username's claim (and is
+    // no longer read from), the claim's ticket, and what the join goes on
+    // with once the claim is decided
+    int claiming;
+    uint32_t ticket;
+    char username[MAX_USERNAME_LEN + 1];
+    int binary;
+
+    int taken;
+    int next_free;
+};
+
+// the handshake list is a fixed table of slots, so the number of handshakes
+// in progress at once is capped. free slots are chained into a free list, so
+// finding one never requires a scan.
+struct handshake_list {
+    struct handshake *handshakes;
+    int capacity;
+    int count;
+    int free_head;
+};
+
+// initialize handshake list, with room for capacity handshakes at once
+// (ret: 1 success, 0 failure)
+int handshake_list_initialize(struct handshake_list *list, int capacity);
+
+// claims a slot for the freshly accepted socket
+// (ret: the slot, or -1 if the list is full)
+int handshake_list_add(struct handshake_list *list, int socket_fd);
+
+// frees slot h, closing its socket (and freeing its decoder) unless they were
+// handed over to a user
+void handshake_list_remove(struct handshake_list *list, int h, int handed_over);
+
+#endif  // HANDSHAKE_H_
@@ -0,0 +1,137 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every record starts with this header, followed by the message's frame. a
+// record with a len of 0 is padding, filling the end of the buffer when the
+// next record would not fit there.
+struct history_record {
+    uint32_t size;
+    uint32_t len;
+    char room[MAX_ROOM_NAME_LEN + 1];
+};
+
+// records start on 8 byte boundaries, so their headers are always aligned
+#define RECORD_ALIGN 8
+#define RECORD_SIZE(len) ((sizeof(struct history_record) + (len) + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1))
+
+// returns the record at position
+static struct history_record *history_record_at(struct history *history, uint64_t position) {
+    return (struct history_record *)(history->buffer + position % history->capacity);
+}
+
+// drops the oldest record
+static void history_drop_oldest(struct history *history) {
+    struct history_record *record = history_record_at(history, history->head);
+    if (record->len > 0) {
+        history->count--;
+    }
+    history->head += record->size;
+}
+
+// initialize the history with a budget of capacity bytes (0 disables it)
+int history_initialize(struct history *history, size_t capacity, int shared) {
+    shared_mutex_initialize(&history->lock, shared);
+    history->capacity = capacity & ~(size_t)(RECORD_ALIGN - 1);
+    history->buffer = NULL;
+    history->head = 0;
+    history->tail = 0;
+    history->count = 0;
+
+    // note: the slack at the end leaves room for the header of a padding record,
+    // however little of the buffer it covers
+    if (history->capacity > 0 &&
+        (history->buffer = shared_alloc(history->capacity + sizeof(struct history_record), shared)) == NULL) {
+        return 0;
+    }
+    return 1;
+}
+
+// records the frame (header included) as sent to room (or HISTORY_BROADCAST),
+// dropping the oldest records as necessary
+void history_append(struct history *history, const char *room, const char *frame, size_t len) {
+    size_t size = RECORD_SIZE(len);
+    if (size > history->capacity) {
+        return;
+    }
+
+    shared_mutex_lock(&history->lock);
+
+    // pad out the end of the buffer if the record would not fit before it
+    size_t offset = history->tail % history->capacity;
+    if (offset + size > history->capacity) {
+        size_t padding = history->capacity - offset;
+        while (history->tail + padding - history->head > history->capacity) {
+            history_drop_oldest(history);
+        }
+
+        struct history_record *record = history_record_at(history, history->tail);
+        record->size = padding;
+        record->len = 0;
+        history->tail += padding;
+    }
+
+    while (history->tail + size - history->head > history->capacity) {
+        history_drop_oldest(history);
+    }
+
+    struct history_record *record = history_record_at(history, history->tail);
+    record->size = size;
+    record->len = len;
+    strcpy(record->room, room);
+    memcpy(record + 1, frame, len);
+    history->tail += size;
+    history->count++;
+
+    pthread_mutex_unlock(&history->lock);
+}
+
+// returns a newly allocated array of every recorded message sent to room, oldest
+// first, along with every broadcast if with_broadcasts is set (or NULL)
+struct message **history_snapshot(struct history *history, const char *room, int with_broadcasts,
+    int *count) {
+
+    *count = 0;
+    if (history->capacity == 0) {
+        return NULL;
+    }
+
+    shared_mutex_lock(&history->lock);
+
+    struct message **messages = malloc((history->count + 1) * sizeof(struct message *));
+    if (messages == NULL) {
+        perror("malloc() failed in history_snapshot()");
+        pthread_mutex_unlock(&history->lock);
+        return NULL;
+    }
+
+    for (uint64_t position = history->head; position < history->tail; ) {
+        struct history_record *record = history_record_at(history, position);
+        position += record->size;
+
+        if (record->len == 0) {
+            continue;
+        }
+
+        int broadcast = strcmp(record->room, HISTORY_BROADCAST) == 0;
+        if ((with_broadcasts && broadcast) || (room != NULL && strcmp(record->room, room) == 0)) {
+            // the frame is stored whole, so copy out just its payload
+            struct message *message = message_new((char *)(record + 1) + FRAME_HEADER_LEN,
+                record->len - FRAME_HEADER_LEN);
+            if (message != NULL) {
+                messages[(*count)++] = message;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&history->lock);
+    return messages;
+}
@@ -0,0 +1,55 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "message.h"
+#include "shared.h"
+
+// the history keeps the most recent broadcasts and room messages (shared by
+// every shard), so they can be replayed to users as they log in or join a
+// room.
+//
+// it is a single ring buffer of bytes allocated once at startup. records are
+// stored whole (never split across the end of the buffer), and the oldest
+// ones are dropped to make room for new ones, so memory use is capped by the
+// byte budget however long the messages are.
+
+// the room a broadcast is recorded under
+#define HISTORY_BROADCAST ""
+
+struct history {
+    pthread_mutex_t lock;
+    char *buffer;
+    size_t capacity;
+    uint64_t head;
+    uint64_t tail;
+    int count;
+};
+
+// initialize the history with a budget of capacity bytes (0 disables it), in
+// memory shared with forked workers if shared is set
+// (ret: 1 success, 0 failure)
+int history_initialize(struct history *history, size_t capacity, int shared);
+
+// records the frame (header included) as sent to room (or HISTORY_BROADCAST),
+// dropping the oldest records as necessary
+// note: frames larger than the whole budget are not recorded
+void history_append(struct history *history, const char *room, const char *frame, size_t len);
+
+// returns a newly allocated array of every recorded message sent to room, oldest
+// first, along with every broadcast if with_broadcasts is set (or NULL)
+// note: the caller is responsible for unreferencing each message and freeing the array
+struct message **history_snapshot(struct history *history, const char *room, int with_broadcasts,
+    int *count);
+
+#endif  // HISTORY_H_
@@ -0,0 +1,223 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "mailbox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+// a mail as copied into a sender's ring (in worker mode). a frame longer than
+// a record holds carries on in the frame of the parts - 1 records after it
+// (whose other fields are unused)
+struct mail_record {
+    int type;
+    int index;
+    char name[MAX_USERNAME_LEN + 1];
+    uint32_t len;
+    uint32_t parts;
+    char frame[FRAME_HEADER_LEN + BUFFER_SIZE];
+};
+
+#define RECORD_FRAME_LEN sizeof(((struct mail_record *)NULL)->frame)
+
+// returns sender's ring
+static struct spsc_ring *mailbox_sender_ring(struct mailbox *mailbox, int sender) {
+    return (struct spsc_ring *)(mailbox->sender_rings + sender * mailbox->sender_ring_bytes);
+}
+
+// initialize the mailbox
+int mailbox_initialize(struct mailbox *mailbox, int num_senders) {
+    if ((mailbox->event_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        perror("eventfd() failed");
+        return 0;
+    }
+
+    mailbox->ring = NULL;
+    mailbox->sender_rings = NULL;
+    mailbox->num_senders = num_senders;
+
+    if ((mailbox->dropped = shared_alloc((num_senders > 0 ? num_senders : 1) * sizeof(uint64_t),
+        num_senders > 0)) == NULL) {
+        return 0;
+    }
+
+    if (num_senders == 0) {
+        size_t bytes = mpsc_ring_bytes(MAILBOX_CAPACITY, sizeof(struct mail));
+        if ((mailbox->ring = aligned_alloc(CACHE_LINE_SIZE, bytes)) == NULL) {
+            perror("aligned_alloc() failed in mailbox_initialize()");
+            return 0;
+        }
+        return mpsc_ring_initialize(mailbox->ring, MAILBOX_CAPACITY, sizeof(struct mail));
+    }
+
+    // every sender's ring starts on its own cache line
+    mailbox->sender_ring_bytes = spsc_ring_bytes(MAILBOX_SHARED_CAPACITY, sizeof(struct mail_record));
+    mailbox->sender_ring_bytes = (mailbox->sender_ring_bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+    if ((mailbox->sender_rings = shared_alloc(num_senders * mailbox->sender_ring_bytes, 1)) == NULL) {
+        return 0;
+    }
+    for (int s = 0; s < num_senders; s++) {
+        spsc_ring_initialize(mailbox_sender_ring(mailbox, s), MAILBOX_SHARED_CAPACITY, sizeof(struct mail_record));
+    }
+    return 1;
+}
+
+// copies the mail into sender's ring (spanning as many records as it takes)
+// (ret: 1 success, 0 failure)
+static int mailbox_post_shared(struct mailbox *mailbox, int sender, int type, int index, const char *name,
+    struct message *message) {
+
+    struct spsc_ring *ring = mailbox_sender_ring(mailbox, sender);
+    uint32_t parts = (message->len + RECORD_FRAME_LEN - 1) / RECORD_FRAME_LEN;
+    if (parts > MAILBOX_MAX_PARTS) {
+        printf("mail of %zu bytes is too long for a mailbox, dropping it\n", message->len);
+        return 0;
+    }
+
+    // (claiming the last record first makes sure there is room for them all)
+    if (spsc_ring_claim_nth(ring, parts - 1) == NULL) {
+        printf("mailbox full, dropping mail\n");
+        return 0;
+    }
+
+    struct mail_record *record = spsc_ring_claim_nth(ring, 0);
+    record->type = type;
+    record->index = index;
+    strcpy(record->name, name != NULL ? name : "");
+    record->len = message->len;
+    record->parts = parts;
+
+    for (uint32_t p = 0; p < parts; p++) {
+        size_t offset = p * RECORD_FRAME_LEN;
+        size_t len = message->len - offset < RECORD_FRAME_LEN ? message->len - offset : RECORD_FRAME_LEN;
+        struct mail_record *part = spsc_ring_claim_nth(ring, p);
+        memcpy(part->frame, message->data + offset, len);
+    }
+
+    spsc_ring_publish_many(ring, parts);
+    return 1;
+}
+
+// appends a new mail holding a reference to the message, and wakes the owning shard
+int mailbox_post(struct mailbox *mailbox, int sender, int type, int index, const char *name,
+    struct message *message) {
+
+    int posted;
+    if (mailbox->ring == NULL) {
+        posted = mailbox_post_shared(mailbox, sender, type, index, name, message);
+    }
+    else {
+        struct mail mail;
+        mail.type = type;
+        mail.index = index;
+        strcpy(mail.name, name != NULL ? name : "");
+        mail.message = message_ref(message);
+
+        if (!(posted = mpsc_ring_push(mailbox->ring, &mail, sizeof(struct mail)))) {
+            message_unref(message);
+            printf("mailbox full, dropping mail\n");
+        }
+    }
+
+    // note: the owner is too far behind to catch up, so rather than stall the
+    // sender (possibly on a shard that is stalled on it) the mail is dropped
+    // (and counted: in worker mode, by the sender's own counter, otherwise by
+    // the one every sender shares)
+    if (!posted) {
+        if (mailbox->ring == NULL) {
+            metrics_add(&mailbox->dropped[sender], 1);
+        }
+        else {
+            __atomic_add_fetch(mailbox->dropped, 1, __ATOMIC_RELAXED);
+        }
+        return 0;
+    }
+
+    if (write(mailbox->event_fd, &(uint64_t){1}, sizeof(uint64_t)) < 0) {
+        perror("write() failed in mailbox_post()");
+    }
+    return 1;
+}
+
+// returns the number of mails dropped so far, by every sender
+uint64_t mailbox_dropped(struct mailbox *mailbox) {
+    uint64_t dropped = 0;
+    for (int s = 0; s < (mailbox->num_senders > 0 ? mailbox->num_senders : 1); s++) {
+        dropped += metrics_read(&mailbox->dropped[s]);
+    }
+    return dropped;
+}
+
+// resets the owning shard's wakeup, before it takes what was posted
+void mailbox_acknowledge(struct mailbox *mailbox) {
+    uint64_t count;
+    if (read(mailbox->event_fd, &count, sizeof(uint64_t)) < 0) {
+        // nothing was posted since the last call (EAGAIN)
+    }
+}
+
+// removes the oldest mail (from any one sender) into mail
+int mailbox_take(struct mailbox *mailbox, struct mail *mail) {
+    if (mailbox->ring != NULL) {
+        return mpsc_ring_pop(mailbox->ring, mail, sizeof(struct mail));
+    }
+
+    for (int s = 0; s < mailbox->num_senders; s++) {
+        struct spsc_ring *ring = mailbox_sender_ring(mailbox, s);
+        struct mail_record *record = spsc_ring_peek(ring);
+        if (record == NULL) {
+            continue;
+        }
+
+        // turn the copy (and any records it carries on in, which were
+        // published along with it) back into a message of our own
+        mail->type = record->type;
+        mail->index = record->index;
+        strcpy(mail->name, record->name);
+        mail->message = message_alloc(record->len - FRAME_HEADER_LEN);
+
+        size_t len = record->len;
+        uint32_t parts = record->parts;
+        for (uint32_t p = 0; p < parts; p++) {
+            struct mail_record *part = p == 0 ? record : spsc_ring_peek(ring);
+            size_t offset = p * RECORD_FRAME_LEN;
+            if (mail->message != NULL) {
+                memcpy(mail->message->data + offset, part->frame,
+                    len - offset < RECORD_FRAME_LEN ? len - offset : RECORD_FRAME_LEN);
+            }
+            spsc_ring_release(ring);
+        }
+
+        if (mail->message != NULL) {
+            return 1;
+        }
+
+        // (out of memory, so the mail is lost. try the same sender again)
+        s--;
+    }
+    return 0;
+}
+
+// drops every mail posted so far, without delivering it
+void mailbox_clear(struct mailbox *mailbox) {
+    if (mailbox->ring != NULL) {
+        struct mail mail;
+        while (mpsc_ring_pop(mailbox->ring, &mail, sizeof(struct mail))) {
+            message_unref(mail.message);
+        }
+        return;
+    }
+
+    for (int s = 0; s < mailbox->num_senders; s++) {
+        spsc_ring_clear(mailbox_sender_ring(mailbox, s));
+    }
+}
@@ -0,0 +1,97 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "message.h"
+#include "ring.h"
+#include "shared.h"
+
+// every shard owns a mailbox that the other shards post outgoing messages to.
+// the shard is woken up through the mailbox's eventfd (which it watches with
+// epoll like any other socket) and then delivers the mail to its own users.
+//
+// mail is handed over through lock-free rings. between threads, every shard
+// posts into the same multiple producer ring, and a mail just holds a
+// reference to the message. between worker processes a mail can't hold a
+// pointer into the sender's memory, so each sender instead gets its own single
+// producer ring in shared memory that the message is copied into (and a
+// worker that dies mid-post can only ever wedge its own ring). a message too
+// long for a single record spans several consecutive ones (up to
+// MAILBOX_MAX_PARTS), published together.
+
+// the number of mails each mailbox can hold (and, in worker mode, the number
+// each sender can have in flight to it)
+#define MAILBOX_CAPACITY 16384
+#define MAILBOX_SHARED_CAPACITY 1024
+
+// the most records a single message may span in a sender's ring (so one long
+// message can't take up the whole ring), in worker mode
+#define MAILBOX_MAX_PARTS (MAILBOX_SHARED_CAPACITY / 4)
+
+// mail types
+#define MAIL_BROADCAST 0  // deliver to every local user (except index, if >= 0)
+#define MAIL_WHISPER 1    // deliver to the local user at index, if still named name
+#define MAIL_ROOMCAST 2   // deliver to every local member of the room named name
+#define MAIL_PEER 3       // (cluster) send as is to node index, or every node if -1
+#define MAIL_CLAIMED 4    // (cluster) the claim of the join in handshake slot index, for username name, was
+                          // decided (the message is "<ticket> <result>", see cluster_claim())
+
+// a single piece of mail
+struct mail {
+    int type;
+    int index;
+    char name[MAX_USERNAME_LEN + 1];  // a username or a room name (same maximum length)
+    struct message *message;
+};
+
+// the mailbox struct
+struct mailbox {
+    int event_fd;
+
+    // the ring every shard posts to (threads), or one ring per sender (workers)
+    struct mpsc_ring *ring;
+    char *sender_rings;
+    size_t sender_ring_bytes;
+    int num_senders;
+
+    // mail dropped because the mailbox was full (or, in worker mode, the message
+    // was too long), one counter per sender in worker mode
+    uint64_t *dropped;
+};
+
+// initialize the mailbox, with one shared ring for each of num_senders
+// senders if num_senders > 0 (for worker processes)
+// (ret: 1 success, 0 failure)
+int mailbox_initialize(struct mailbox *mailbox, int num_senders);
+
+// appends a new mail holding a reference to the message (or, in worker mode,
+// a copy of it in sender's ring), and wakes the owning shard
+// (ret: 1 success, 0 failure (the mailbox is full))
+int mailbox_post(struct mailbox *mailbox, int sender, int type, int index, const char *name,
+    struct message *message);
+
+// returns the number of mails dropped so far, by every sender
+uint64_t mailbox_dropped(struct mailbox *mailbox);
+
+// resets the owning shard's wakeup, before it takes what was posted
+void mailbox_acknowledge(struct mailbox *mailbox);
+
+// removes the oldest mail (from any one sender) into mail
+// note: the caller is responsible for unreferencing the mail's message
+// (ret: 1 a mail was taken, 0 the mailbox is empty)
+int mailbox_take(struct mailbox *mailbox, struct mail *mail);
+
+// drops every mail posted so far, without delivering it
+// note: only safe while the owning shard is not running (e.g. after its worker died)
+void mailbox_clear(struct mailbox *mailbox);
+
+#endif  // MAILBOX_H_
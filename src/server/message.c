@@ -0,0 +1,141 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "message.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "slab.h"
+
+// a first guess at the length of a formatted payload (most chat messages are short)
+#define FORMAT_GUESS 200
+
+// returns a new message (with one reference) with room for a payload of len bytes, or NULL
+struct message *message_alloc(size_t len) {
+    struct message *message = slab_alloc(sizeof(struct message) + FRAME_HEADER_LEN + len);
+    if (message == NULL) {
+        return NULL;
+    }
+
+    message->refcount = 1;
+    message->binary = NULL;
+    message->len = FRAME_HEADER_LEN + len;
+    frame_put_header(message->data, len);
+    return message;
+}
+
+// returns a new message (with one reference) framing the payload, or NULL
+struct message *message_new(const char *payload, size_t len) {
+    struct message *message = message_alloc(len);
+    if (message != NULL) {
+        memcpy(message->data + FRAME_HEADER_LEN, payload, len);
+    }
+    return message;
+}
+
+// returns a new message (with one reference) framing the formatted payload, or NULL
+struct message *message_format(const char *format, ...) {
+    // format straight into a pooled block, guessing that the payload fits in a
+    // small one (and formatting again into one that is large enough if not)
+    size_t len = FORMAT_GUESS;
+
+    while (1) {
+        struct message *message = message_alloc(len);
+        if (message == NULL) {
+            return NULL;
+        }
+
+        // use whatever slack the block's size class leaves, too
+        size_t room = slab_capacity(message) > sizeof(struct message) + FRAME_HEADER_LEN ?
+            slab_capacity(message) - sizeof(struct message) - FRAME_HEADER_LEN : len;
+        if (room > BUFFER_SIZE) {
+            room = BUFFER_SIZE;
+        }
+
+        va_list args;
+        va_start(args, format);
+        int formatted = vsnprintf(message->data + FRAME_HEADER_LEN, room, format, args);
+        va_end(args);
+
+        if (formatted < 0) {
+            message_unref(message);
+            return NULL;
+        }
+
+        // note: the payload is truncated to BUFFER_SIZE (less its terminator)
+        if ((size_t)formatted < room || room == BUFFER_SIZE) {
+            len = (size_t)formatted < room ? (size_t)formatted : room - 1;
+            message->len = FRAME_HEADER_LEN + len;
+            frame_put_header(message->data, len);
+            return message;
+        }
+
+        message_unref(message);
+        len = (size_t)formatted + 1 < BUFFER_SIZE ? (size_t)formatted + 1 : BUFFER_SIZE;
+    }
+}
+
+// returns the message's binary encoding, made (carrying the trace, if it is
+// not NULL) and kept alongside it if it was not already, or NULL
+static struct message *message_encode(struct message *message, const struct protocol_trace *trace) {
+    struct message *binary = __atomic_load_n(&message->binary, __ATOMIC_ACQUIRE);
+    if (binary != NULL) {
+        return binary;
+    }
+
+    struct protocol_packet packet;
+    protocol_parse_text(message->data + FRAME_HEADER_LEN, message->len - FRAME_HEADER_LEN, &packet);
+    if (trace != NULL) {
+        packet.flags |= PROTOCOL_FLAG_TRACE;
+        packet.trace = *trace;
+    }
+
+    size_t len = protocol_encoded_len(&packet);
+    if (len == 0 || (binary = message_alloc(len)) == NULL) {
+        return NULL;
+    }
+    protocol_encode(&packet, binary->data + FRAME_HEADER_LEN);
+
+    // shards may race to encode the same message, in which case the first one wins
+    struct message *expected = NULL;
+    if (!__atomic_compare_exchange_n(&message->binary, &expected, binary, 0, __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE)) {
+        message_unref(binary);
+        return expected;
+    }
+    return binary;
+}
+
+// returns the message's binary encoding (owned by the message), or NULL
+struct message *message_binary(struct message *message) {
+    return message_encode(message, NULL);
+}
+
+// makes the message's binary encoding carry the trace
+int message_trace(struct message *message, const struct protocol_trace *trace) {
+    return message_encode(message, trace) != NULL;
+}
+
+// takes another reference to the message, and returns it
+// note: messages are shared between shards, so the count is updated atomically
+struct message *message_ref(struct message *message) {
+    __atomic_add_fetch(&message->refcount, 1, __ATOMIC_RELAXED);
+    return message;
+}
+
+// drops a reference to the message, freeing it once none are left
+void message_unref(struct message *message) {
+    if (__atomic_sub_fetch(&message->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (message->binary != NULL) {
+            message_unref(message->binary);
+        }
+        slab_free(message);
+    }
+}
@@ -0,0 +1,56 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef MESSAGE_H_
+#define MESSAGE_H_
+
+#include <stddef.h>
+
+#include "common.h"
+#include "protocol.h"
+
+// a message is an immutable, reference counted frame (header included). a
+// broadcast is formatted into a single message, and every recipient's
+// outbound queue (and every other shard's mailbox) just holds a reference.
+// messages are allocated from the slab pool (see slab.h).
+//
+// messages are always formatted in the text protocol. the first time one is
+// sent to a user speaking the binary protocol (see protocol.h), its binary
+// encoding is made and kept alongside it, so a fan-out encodes it only once.
+
+struct message {
+    int refcount;
+    size_t len;
+    struct message *binary;
+    char data[];
+};
+
+// returns a new message (with one reference) with room for a payload of len bytes, or NULL
+// note: the payload is left for the caller to fill in
+struct message *message_alloc(size_t len);
+
+// returns a new message (with one reference) framing the payload, or NULL
+struct message *message_new(const char *payload, size_t len);
+
+// returns a new message (with one reference) framing the formatted payload, or NULL
+// note: the payload is truncated to BUFFER_SIZE
+struct message *message_format(const char *format, ...);
+
+// returns the message's binary encoding (owned by the message), or NULL
+struct message *message_binary(struct message *message);
+
+// makes the message's binary encoding carry the trace (so binary users are
+// sent it, and text users are not), before it is sent to anyone
+// (ret: 1 success, 0 failure)
+int message_trace(struct message *message, const struct protocol_trace *trace);
+
+// takes another reference to the message, and returns it
+struct message *message_ref(struct message *message);
+
+// drops a reference to the message, freeing it once none are left
+void message_unref(struct message *message);
+
+#endif  // MESSAGE_H_
@@ -0,0 +1,610 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "message_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// every message is stored as this header followed by its frame. records start
+// on 8 byte boundaries, so their headers can be read straight out of the mapping.
+// note: the log is written in the host's byte order
+struct log_record {
+    uint64_t offset;
+    uint64_t timestamp;
+    uint32_t len;
+    char room[MAX_ROOM_NAME_LEN + 1];
+};
+
+#define RECORD_ALIGN 8
+#define RECORD_SIZE(len) ((sizeof(struct log_record) + (len) + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1))
+
+// where a read should start in a segment, and how much of it is committed
+struct log_cursor {
+    int fd;
+    size_t size;
+    size_t position;
+};
+
+
+
+//
+// SEGMENT function(s)
+//
+
+// returns the current time, in milliseconds since the epoch
+static uint64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// writes all len bytes of buf to fd
+// (ret: 1 success, 0 failure)
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buf, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += nwritten;
+        len -= nwritten;
+    }
+    return 1;
+}
+
+// opens (creating if necessary) the segment starting at base_offset, loads its
+// index and appends it to the log's segments
+// (ret: 1 success, 0 failure)
+static int log_add_segment(struct message_log *log, uint64_t base_offset) {
+    struct log_segment segment;
+    memset(&segment, 0, sizeof(struct log_segment));
+    segment.base_offset = base_offset;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%020" PRIu64 ".log", log->directory, base_offset);
+    if ((segment.fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0) {
+        perror("open() failed for log segment");
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%020" PRIu64 ".idx", log->directory, base_offset);
+    if ((segment.index_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0) {
+        perror("open() failed for log index");
+        close(segment.fd);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(segment.fd, &st) < 0) {
+        perror("fstat() failed for log segment");
+        return 0;
+    }
+    segment.size = st.st_size;
+
+    // load the sparse index (a torn trailing entry is ignored)
+    if (fstat(segment.index_fd, &st) < 0) {
+        perror("fstat() failed for log index");
+        return 0;
+    }
+    segment.index_count = st.st_size / sizeof(struct log_index_entry);
+    segment.index_capacity = segment.index_count > 16 ? segment.index_count : 16;
+
+    if ((segment.index = malloc(segment.index_capacity * sizeof(struct log_index_entry))) == NULL) {
+        perror("malloc() failed in log_add_segment()");
+        return 0;
+    }
+
+    size_t index_bytes = segment.index_count * sizeof(struct log_index_entry);
+    if (index_bytes > 0 && pread(segment.index_fd, segment.index, index_bytes, 0) != (ssize_t)index_bytes) {
+        perror("pread() failed for log index");
+        return 0;
+    }
+
+    segment.next_index_position = segment.index_count > 0 ?
+        segment.index[segment.index_count - 1].position + INDEX_INTERVAL : 0;
+
+    pthread_mutex_lock(&log->segments_lock);
+    if (log->num_segments == log->segments_capacity) {
+        int capacity = log->segments_capacity == 0 ? 16 : log->segments_capacity * 2;
+        struct log_segment *segments = realloc(log->segments, capacity * sizeof(struct log_segment));
+        if (segments == NULL) {
+            pthread_mutex_unlock(&log->segments_lock);
+            perror("realloc() failed in log_add_segment()");
+            return 0;
+        }
+        log->segments = segments;
+        log->segments_capacity = capacity;
+    }
+    log->segments[log->num_segments++] = segment;
+    pthread_mutex_unlock(&log->segments_lock);
+
+    return 1;
+}
+
+// records the index entry for the record at position in the segment
+// note: the caller must hold the segments lock
+static void segment_add_index(struct log_segment *segment, struct log_record *record, size_t position) {
+    if (segment->index_count == segment->index_capacity) {
+        int capacity = segment->index_capacity * 2;
+        struct log_index_entry *index = realloc(segment->index, capacity * sizeof(struct log_index_entry));
+        if (index == NULL) {
+            // the index is only a shortcut, so reads just scan further without it
+            perror("realloc() failed in segment_add_index()");
+            return;
+        }
+        segment->index = index;
+        segment->index_capacity = capacity;
+    }
+
+    struct log_index_entry *entry = &segment->index[segment->index_count++];
+    entry->offset = record->offset;
+    entry->timestamp = record->timestamp;
+    entry->position = position;
+
+    if (!write_all(segment->index_fd, (char *)entry, sizeof(struct log_index_entry))) {
+        perror("write() failed for log index");
+    }
+    segment->next_index_position = position + INDEX_INTERVAL;
+}
+
+// cuts the last segment back to its last complete record, in case the server
+// died partway through a commit, and picks up the offsets where it left off
+static void log_recover(struct message_log *log) {
+    struct log_segment *segment = &log->segments[log->num_segments - 1];
+
+    // only the records after the last index entry need checking
+    size_t position = 0;
+    uint64_t expected = segment->base_offset;
+    while (segment->index_count > 0) {
+        struct log_index_entry *last = &segment->index[segment->index_count - 1];
+        if (last->position < segment->size) {
+            position = last->position;
+            expected = last->offset;
+            break;
+        }
+        segment->index_count--;
+    }
+
+    if (segment->size > 0) {
+        char *map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, segment->fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap() failed while recovering the log");
+            position = segment->size;
+        }
+        else {
+            while (position + sizeof(struct log_record) <= segment->size) {
+                struct log_record *record = (struct log_record *)(map + position);
+                if (record->offset != expected || record->len < FRAME_HEADER_LEN ||
+                    record->len > FRAME_HEADER_LEN + MAX_FRAME_LEN ||
+                    position + RECORD_SIZE(record->len) > segment->size) {
+                    break;
+                }
+                position += RECORD_SIZE(record->len);
+                expected++;
+            }
+            munmap(map, segment->size);
+        }
+    }
+
+    if (position < segment->size) {
+        printf("truncating torn log segment %020" PRIu64 " from %zu to %zu bytes\n",
+            segment->base_offset, segment->size, position);
+        if (ftruncate(segment->fd, position) < 0) {
+            perror("ftruncate() failed while recovering the log");
+        }
+        segment->size = position;
+    }
+
+    if (ftruncate(segment->index_fd, segment->index_count * sizeof(struct log_index_entry)) < 0) {
+        perror("ftruncate() failed while recovering the log index");
+    }
+    segment->next_index_position = segment->index_count > 0 ?
+        segment->index[segment->index_count - 1].position + INDEX_INTERVAL : 0;
+
+    log->next_offset = expected;
+}
+
+
+
+//
+// COMMIT function(s)
+// appends are batched in memory and committed by a single background thread,
+// which writes every record appended during the last interval with one write()
+// and makes them durable with one fdatasync()
+//
+
+// writes [from, to) of the batch to the segment, makes it durable, and makes
+// it visible to readers
+static void segment_commit(struct message_log *log, struct log_segment *segment, const char *from,
+    const char *to) {
+
+    if (to == from) {
+        return;
+    }
+
+    if (!write_all(segment->fd, from, to - from)) {
+        perror("write() failed for log segment");
+        return;
+    }
+
+    if (fdatasync(segment->fd) < 0 || fdatasync(segment->index_fd) < 0) {
+        perror("fdatasync() failed for log segment");
+    }
+
+    pthread_mutex_lock(&log->segments_lock);
+    segment->size += to - from;
+    pthread_mutex_unlock(&log->segments_lock);
+}
+
+// writes a batch of records out, indexing them and rolling segments as needed
+static void message_log_commit(struct message_log *log, char *batch, size_t len) {
+    int last = log->num_segments - 1;
+    size_t position = log->segments[last].size;
+    size_t run_start = 0;
+
+    for (size_t p = 0; p < len; ) {
+        struct log_record *record = (struct log_record *)(batch + p);
+
+        // start a new segment once the current one is full
+        if (position >= SEGMENT_BYTES) {
+            segment_commit(log, &log->segments[last], batch + run_start, batch + p);
+            if (log_add_segment(log, record->offset)) {
+                last = log->num_segments - 1;
+                position = 0;
+            }
+            run_start = p;
+        }
+
+        if (position >= log->segments[last].next_index_position) {
+            pthread_mutex_lock(&log->segments_lock);
+            segment_add_index(&log->segments[last], record, position);
+            pthread_mutex_unlock(&log->segments_lock);
+        }
+
+        position += RECORD_SIZE(record->len);
+        p += RECORD_SIZE(record->len);
+    }
+
+    segment_commit(log, &log->segments[last], batch + run_start, batch + len);
+}
+
+// commits everything appended during each sync interval, forever
+static void *message_log_run(void *arg) {
+    struct message_log *log = arg;
+    char *batch = NULL;
+    size_t batch_capacity = 0;
+
+    while (1) {
+        struct timespec interval = {log->sync_ms / 1000, (log->sync_ms % 1000) * 1000000L};
+        nanosleep(&interval, NULL);
+
+        // swap the pending buffer for the (empty) batch buffer, so appends can
+        // carry on while this batch is written
+        pthread_mutex_lock(&log->lock);
+        char *pending = log->pending;
+        size_t pending_len = log->pending_len;
+        size_t pending_capacity = log->pending_capacity;
+        log->pending = batch;
+        log->pending_len = 0;
+        log->pending_capacity = batch_capacity;
+        pthread_mutex_unlock(&log->lock);
+
+        batch = pending;
+        batch_capacity = pending_capacity;
+
+        if (pending_len > 0) {
+            message_log_commit(log, batch, pending_len);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+//
+// LOG function(s)
+//
+
+// compares two segment file names (which sort by base offset)
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// opens (creating if necessary) the log in directory, recovering its segments,
+// and starts the thread that commits appends every sync_ms milliseconds
+int message_log_open(struct message_log *log, const char *directory, int sync_ms) {
+    memset(log, 0, sizeof(struct message_log));
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_mutex_init(&log->segments_lock, NULL);
+    log->directory = strdup(directory);
+    log->sync_ms = sync_ms;
+
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir() failed for log directory");
+        return 0;
+    }
+
+    // find the existing segments, oldest first
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        perror("opendir() failed for log directory");
+        return 0;
+    }
+
+    char **names = NULL;
+    int num_names = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len == 20 + strlen(".log") && strcmp(entry->d_name + 20, ".log") == 0) {
+            char **grown = realloc(names, (num_names + 1) * sizeof(char *));
+            if (grown == NULL) {
+                break;
+            }
+            names = grown;
+            names[num_names++] = strdup(entry->d_name);
+        }
+    }
+    closedir(dir);
+    qsort(names, num_names, sizeof(char *), compare_names);
+
+    int ok = 1;
+    for (int n = 0; n < num_names; n++) {
+        ok = ok && log_add_segment(log, strtoull(names[n], NULL, 10));
+        free(names[n]);
+    }
+    free(names);
+
+    if (!ok || (log->num_segments == 0 && !log_add_segment(log, 0))) {
+        return 0;
+    }
+
+    log_recover(log);
+    printf("message log %s holds %" PRIu64 " messages in %d segment(s)\n",
+        directory, log->next_offset, log->num_segments);
+
+    if (pthread_create(&log->thread, NULL, message_log_run, log) != 0) {
+        perror("pthread_create() failed for message log");
+        return 0;
+    }
+    return 1;
+}
+
+// queues the message, as sent to room, to be written at the next commit
+void message_log_append(struct message_log *log, const char *room, struct message *message) {
+    size_t size = RECORD_SIZE(message->len);
+
+    pthread_mutex_lock(&log->lock);
+    if (log->pending_len + size > log->pending_capacity) {
+        size_t capacity = log->pending_capacity == 0 ? 64 * 1024 : log->pending_capacity;
+        while (capacity < log->pending_len + size) {
+            capacity *= 2;
+        }
+
+        char *pending = realloc(log->pending, capacity);
+        if (pending == NULL) {
+            pthread_mutex_unlock(&log->lock);
+            perror("realloc() failed in message_log_append()");
+            return;
+        }
+        log->pending = pending;
+        log->pending_capacity = capacity;
+    }
+
+    struct log_record *record = (struct log_record *)(log->pending + log->pending_len);
+    memset(record, 0, size);
+    record->offset = log->next_offset++;
+    record->timestamp = now_ms();
+    record->len = message->len;
+    strcpy(record->room, room);
+    memcpy(record + 1, message->data, message->len);
+    log->pending_len += size;
+    pthread_mutex_unlock(&log->lock);
+}
+
+
+
+//
+// READ function(s)
+//
+
+// visits the records of each cursor's segment from its position, skipping any
+// sent before timestamp
+static void message_log_visit(struct log_cursor *cursors, int count, uint64_t timestamp,
+    message_log_visitor visitor, void *context) {
+
+    for (int c = 0; c < count; c++) {
+        if (cursors[c].position >= cursors[c].size) {
+            continue;
+        }
+
+        char *map = mmap(NULL, cursors[c].size, PROT_READ, MAP_SHARED, cursors[c].fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap() failed for log segment");
+            return;
+        }
+
+        int keep_going = 1;
+        for (size_t position = cursors[c].position; keep_going && position < cursors[c].size; ) {
+            struct log_record *record = (struct log_record *)(map + position);
+            if (record->timestamp >= timestamp) {
+                keep_going = visitor(context, record->room, (char *)(record + 1), record->len,
+                    record->timestamp);
+            }
+            position += RECORD_SIZE(record->len);
+        }
+
+        munmap(map, cursors[c].size);
+        if (!keep_going) {
+            return;
+        }
+    }
+}
+
+// fills in a cursor for each segment from first onwards, starting the first at
+// position, and returns how many there are (or -1)
+// note: the caller must hold the segments lock
+static int log_cursors(struct message_log *log, int first, size_t position, struct log_cursor **cursors) {
+    int count = log->num_segments - first;
+    if ((*cursors = malloc(count * sizeof(struct log_cursor))) == NULL) {
+        perror("malloc() failed in log_cursors()");
+        return -1;
+    }
+
+    for (int c = 0; c < count; c++) {
+        (*cursors)[c].fd = log->segments[first + c].fd;
+        (*cursors)[c].size = log->segments[first + c].size;
+        (*cursors)[c].position = c == 0 ? position : 0;
+    }
+    return count;
+}
+
+// finds where a read of the messages sent at or after timestamp should start
+void message_log_seek(struct message_log *log, uint64_t timestamp, struct log_position *position) {
+    pthread_mutex_lock(&log->segments_lock);
+
+    // start from the last segment that begins before timestamp
+    int first = log->num_segments - 1;
+    while (first > 0 && (log->segments[first].index_count == 0 ||
+        log->segments[first].index[0].timestamp >= timestamp)) {
+        first--;
+    }
+
+    // then from the last indexed record in it sent before timestamp (and committed)
+    struct log_segment *segment = &log->segments[first];
+    int lo = 0, hi = segment->index_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (segment->index[mid].timestamp < timestamp) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    while (lo > 0 && segment->index[lo - 1].position >= segment->size) {
+        lo--;
+    }
+
+    position->segment = first;
+    position->position = lo > 0 ? segment->index[lo - 1].position : 0;
+    pthread_mutex_unlock(&log->segments_lock);
+}
+
+// visits the committed messages sent at or after timestamp from position on,
+// scanning at most *budget bytes of the log
+// note: only the part of a segment from position on is mapped, so a read that
+// is picked up again and again doesn't map (or fault in) what it already scanned
+int message_log_replay_from(struct message_log *log, struct log_position *position, uint64_t timestamp,
+    size_t *budget, message_log_visitor visitor, void *context) {
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    while (*budget > 0) {
+        // (segments are only ever added, so the segment stays put once the lock is let go)
+        pthread_mutex_lock(&log->segments_lock);
+        if (position->segment >= log->num_segments) {
+            pthread_mutex_unlock(&log->segments_lock);
+            return 0;
+        }
+        int fd = log->segments[position->segment].fd;
+        size_t size = log->segments[position->segment].size;
+        int last = position->segment == log->num_segments - 1;
+        pthread_mutex_unlock(&log->segments_lock);
+
+        if (position->position >= size) {
+            if (last) {
+                return 0;
+            }
+            position->segment++;
+            position->position = 0;
+            continue;
+        }
+
+        size_t start = position->position & ~(page_size - 1);
+        char *map = mmap(NULL, size - start, PROT_READ, MAP_SHARED, fd, start);
+        if (map == MAP_FAILED) {
+            perror("mmap() failed for log segment");
+            return 0;
+        }
+
+        int keep_going = 1;
+        while (keep_going && *budget > 0 && position->position < size) {
+            struct log_record *record = (struct log_record *)(map + position->position - start);
+            if (record->timestamp >= timestamp) {
+                keep_going = visitor(context, record->room, (char *)(record + 1), record->len,
+                    record->timestamp);
+            }
+
+            size_t record_size = RECORD_SIZE(record->len);
+            position->position += record_size;
+            *budget -= record_size < *budget ? record_size : *budget;
+        }
+
+        munmap(map, size - start);
+        if (!keep_going) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// visits the committed messages in (about) the last bytes bytes of the log
+void message_log_replay_tail(struct message_log *log, size_t bytes, message_log_visitor visitor,
+    void *context) {
+
+    if (bytes == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&log->segments_lock);
+
+    // walk back over the segments that fit entirely within bytes
+    int first = log->num_segments - 1;
+    while (first > 0 && log->segments[first].size < bytes) {
+        bytes -= log->segments[first].size;
+        first--;
+    }
+
+    // then start at the first indexed record within the remaining bytes, or
+    // (if there is none, e.g. the window is narrower than the index spacing)
+    // at the last one before them, rather than scanning the whole segment
+    struct log_segment *segment = &log->segments[first];
+    size_t position = 0;
+    if (segment->size > bytes) {
+        for (int e = 0; e < segment->index_count && segment->index[e].position < segment->size; e++) {
+            position = segment->index[e].position;
+            if (position >= segment->size - bytes) {
+                break;
+            }
+        }
+    }
+
+    struct log_cursor *cursors;
+    int count = log_cursors(log, first, position, &cursors);
+    pthread_mutex_unlock(&log->segments_lock);
+
+    if (count > 0) {
+        message_log_visit(cursors, count, 0, visitor, context);
+    }
+    free(cursors);
+}
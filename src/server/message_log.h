@@ -0,0 +1,109 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef MESSAGE_LOG_H_
+#define MESSAGE_LOG_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "message.h"
+
+// the message log persists every broadcast and room message to disk, so the
+// history survives a restart.
+//
+// the log is a directory of append-only segment files, each named after the
+// offset (sequence number) of its first message and rolled over once it grows
+// past SEGMENT_BYTES. next to each segment is a sparse index, holding the
+// offset, timestamp and file position of roughly one message every
+// INDEX_INTERVAL bytes, so a read can seek close to where it wants to start
+// and scan from there.
+//
+// appending only copies the message into a pending buffer. a background
+// thread writes the buffer out and fsyncs it once per sync interval (group
+// commit), so no disk flush ever happens on the delivery path. reads mmap the
+// segments rather than copying them through read() calls.
+
+// the size past which a segment is rolled over
+#define SEGMENT_BYTES (64 * 1024 * 1024)
+
+// the (approximate) number of bytes between sparse index entries
+#define INDEX_INTERVAL 4096
+
+struct log_index_entry {
+    uint64_t offset;
+    uint64_t timestamp;
+    uint64_t position;
+};
+
+struct log_segment {
+    uint64_t base_offset;
+    int fd;
+    int index_fd;
+    size_t size;
+    size_t next_index_position;
+    struct log_index_entry *index;
+    int index_count;
+    int index_capacity;
+};
+
+struct message_log {
+    // guards the pending buffer and the next offset
+    pthread_mutex_t lock;
+    char *pending;
+    size_t pending_len;
+    size_t pending_capacity;
+    uint64_t next_offset;
+
+    // guards the segments (readers against the writer thread)
+    pthread_mutex_t segments_lock;
+    struct log_segment *segments;
+    int num_segments;
+    int segments_capacity;
+
+    char *directory;
+    int sync_ms;
+    pthread_t thread;
+};
+
+// where a read of the log is up to: a segment (by its place in the log,
+// oldest first) and a position in it
+struct log_position {
+    int segment;
+    size_t position;
+};
+
+// called once per logged message (oldest first) with its room, its frame
+// (header included) and when it was sent, in milliseconds since the epoch
+// (ret: 1 to keep going, 0 to stop)
+typedef int (*message_log_visitor)(void *context, const char *room, const char *frame, size_t len,
+    uint64_t timestamp);
+
+// opens (creating if necessary) the log in directory, recovering its segments,
+// and starts the thread that commits appends every sync_ms milliseconds
+// (ret: 1 success, 0 failure)
+int message_log_open(struct message_log *log, const char *directory, int sync_ms);
+
+// queues the message, as sent to room, to be written at the next commit
+void message_log_append(struct message_log *log, const char *room, struct message *message);
+
+// finds where a read of the messages sent at or after timestamp should start
+void message_log_seek(struct message_log *log, uint64_t timestamp, struct log_position *position);
+
+// visits the committed messages sent at or after timestamp from position on,
+// scanning at most *budget bytes of the log (which are taken off *budget), and
+// moves position past what was scanned, so the read can be picked up later
+// (ret: 1 there is more to read, 0 the read reached the end of the log, or the visitor stopped it)
+int message_log_replay_from(struct message_log *log, struct log_position *position, uint64_t timestamp,
+    size_t *budget, message_log_visitor visitor, void *context);
+
+// visits the committed messages in (about) the last bytes bytes of the log
+void message_log_replay_tail(struct message_log *log, size_t bytes, message_log_visitor visitor,
+    void *context);
+
+#endif  // MESSAGE_LOG_H_
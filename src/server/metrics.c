@@ -0,0 +1,227 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// the longest a scrape gets to send its request
+#define REQUEST_TIMEOUT_SECONDS 1
+
+// the endpoint's listening socket, and what writes the metrics
+static int listen_fd = -1;
+static void (*collect_metrics)(FILE *out) = NULL;
+
+// returns the bucket the value us falls into
+static int histogram_bucket(uint64_t us) {
+    if (us < HISTOGRAM_SUB_BUCKETS) {
+        return (int)us;
+    }
+
+    int bit = 63 - __builtin_clzll(us);
+    if (bit > HISTOGRAM_MAX_BIT) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    return (bit - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS +
+        (int)((us >> (bit - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// returns the smallest value that falls into bucket b
+static uint64_t histogram_bucket_start(int b) {
+    if (b < HISTOGRAM_SUB_BUCKETS) {
+        return b;
+    }
+
+    int bit = b / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS + b % HISTOGRAM_SUB_BUCKETS) << (bit - HISTOGRAM_SUB_BITS);
+}
+
+// returns the largest value that falls into bucket b (but the last, which has no end)
+static uint64_t histogram_bucket_end(int b) {
+    return histogram_bucket_start(b + 1) - 1;
+}
+
+
+
+//
+// COUNTER function(s)
+//
+
+// adds n to the counter
+void metrics_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+// returns the counter's value
+uint64_t metrics_read(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// records n values of us microseconds in the histogram
+void histogram_record(struct histogram *histogram, uint64_t us, uint64_t n) {
+    metrics_add(&histogram->counts[histogram_bucket(us)], n);
+    metrics_add(&histogram->count, n);
+    metrics_add(&histogram->sum, us * n);
+}
+
+// adds the histogram's counts into total
+void histogram_merge(struct histogram *total, const struct histogram *histogram) {
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        total->counts[b] += metrics_read(&histogram->counts[b]);
+    }
+    total->count += metrics_read(&histogram->count);
+    total->sum += metrics_read(&histogram->sum);
+}
+
+
+
+//
+// EXPOSITION function(s)
+// writes the metrics in the prometheus text format (version 0.0.4)
+//
+
+// writes the help and type lines for the metric name
+void metrics_write_family(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// writes a value of the metric name, with the given labels
+void metrics_write_value(FILE *out, const char *name, const char *labels, uint64_t value) {
+    if (labels != NULL) {
+        fprintf(out, "%s{%s} %llu\n", name, labels, (unsigned long long)value);
+    }
+    else {
+        fprintf(out, "%s %llu\n", name, (unsigned long long)value);
+    }
+}
+
+// writes the histogram (in seconds)
+// note: the buckets are cumulative, each counting every value up to (and
+// including) its bound, which is the last whole microsecond of the bucket
+void metrics_write_histogram(FILE *out, const char *name, const char *help, const struct histogram *histogram) {
+    metrics_write_family(out, name, "histogram", help);
+
+    uint64_t cumulative = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS - 1; b++) {
+        cumulative += histogram->counts[b];
+        fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, histogram_bucket_end(b) / 1e6,
+            (unsigned long long)cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)histogram->count);
+    fprintf(out, "%s_sum %g\n", name, histogram->sum / 1e6);
+    fprintf(out, "%s_count %llu\n", name, (unsigned long long)histogram->count);
+}
+
+
+
+//
+// ENDPOINT function(s)
+// a thread of its own answers every connection to the metrics port with the
+// current metrics, whatever was asked for, so scrapes never touch the shards'
+// event loops
+//
+
+// answers a single scrape on fd, then closes it
+static void metrics_answer(int fd) {
+    // a scrape may send its request in pieces, so wait for the end of its headers
+    struct timeval timeout = { REQUEST_TIMEOUT_SECONDS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[4096];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        ssize_t nread = read(fd, request + len, sizeof(request) - 1 - len);
+        if (nread <= 0) {
+            break;
+        }
+        len += nread;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL) {
+        perror("open_memstream() failed");
+        close(fd);
+        return;
+    }
+    collect_metrics(out);
+    fclose(out);
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+
+    if (write(fd, header, header_len) != header_len || write(fd, body, body_len) != (ssize_t)body_len) {
+        perror("write() failed while answering a scrape");
+    }
+    free(body);
+    close(fd);
+}
+
+// answers scrapes, forever
+static void *metrics_run(void *arg) {
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            perror("accept() failed on the metrics port");
+            continue;
+        }
+        metrics_answer(fd);
+    }
+    return NULL;
+}
+
+// starts a thread serving the metrics over http on port
+int metrics_serve(int port, void (*collect)(FILE *out)) {
+    if ((listen_fd = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket() failed");
+        return 0;
+    }
+
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEADDR) failed");
+        return 0;
+    }
+
+    // the metrics are for whoever runs the server, so only local connections are let in
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = PF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("bind() failed on the metrics port");
+        return 0;
+    }
+
+    if (listen(listen_fd, SOMAXCONN) < 0) {
+        perror("listen() failed");
+        return 0;
+    }
+
+    collect_metrics = collect;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, metrics_run, NULL) != 0) {
+        perror("pthread_create() failed");
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
@@ -0,0 +1,66 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// the server's counters and latency histograms, and the endpoint that serves
+// them in the prometheus text format.
+//
+// every counter (and histogram) has a single writer (the shard it belongs
+// to), so updating one is a plain load and store rather than a locked
+// instruction, and cheap enough to always leave on. whoever reads them (the
+// endpoint's thread) sums every writer's copy.
+//
+// histograms are log-linear, as in hdr histograms: every power of two is
+// split into HISTOGRAM_SUB_BUCKETS buckets, so a value is always placed
+// within 1 / HISTOGRAM_SUB_BUCKETS of itself, over a range of values from a
+// microsecond to over an hour, in a fixed number of buckets.
+
+#define HISTOGRAM_SUB_BITS 2
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+// the largest power of two a histogram tells apart (larger values share the last bucket)
+#define HISTOGRAM_MAX_BIT 31
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BIT - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_SUB_BUCKETS)
+
+// a latency histogram (in microseconds)
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+};
+
+// adds n to the counter (which only the caller ever writes)
+void metrics_add(uint64_t *counter, uint64_t n);
+
+// returns the counter's value (which another thread, or process, may be writing)
+uint64_t metrics_read(const uint64_t *counter);
+
+// records n values of us microseconds in the histogram (which only the caller ever writes)
+void histogram_record(struct histogram *histogram, uint64_t us, uint64_t n);
+
+// adds the histogram's counts into total
+void histogram_merge(struct histogram *total, const struct histogram *histogram);
+
+// writes the help and type lines for the metric name (type is "counter" or "gauge")
+void metrics_write_family(FILE *out, const char *name, const char *type, const char *help);
+
+// writes a value of the metric name, with the given labels (e.g. "type=\"whisper\"", or NULL)
+void metrics_write_value(FILE *out, const char *name, const char *labels, uint64_t value);
+
+// writes the histogram (in seconds) in the prometheus text format
+void metrics_write_histogram(FILE *out, const char *name, const char *help, const struct histogram *histogram);
+
+// starts a thread serving the metrics (as written by collect) over http on
+// port, on the loopback interface only
+// (ret: 1 success, 0 failure)
+int metrics_serve(int port, void (*collect)(FILE *out));
+
+#endif  // METRICS_H_
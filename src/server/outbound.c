@@ -0,0 +1,148 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "outbound.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// initialize the queue
+void outbound_queue_initialize(struct outbound_queue *queue) {
+    queue->messages = NULL;
+    queue->head = 0;
+    queue->count = 0;
+    queue->capacity = 0;
+    queue->offset = 0;
+    queue->bytes = 0;
+    queue->pinned = 0;
+}
+
+// drops every queued message and frees the queue's memory
+void outbound_queue_free(struct outbound_queue *queue) {
+    for (int i = 0; i < queue->count; i++) {
+        message_unref(queue->messages[(queue->head + i) % queue->capacity]);
+    }
+    free(queue->messages);
+    outbound_queue_initialize(queue);
+}
+
+// appends a reference to the message to the queue
+int outbound_queue_push(struct outbound_queue *queue, struct message *message) {
+    if (queue->count == queue->capacity) {
+        int capacity = queue->capacity == 0 ? 8 : queue->capacity * 2;
+        struct message **messages = malloc(capacity * sizeof(struct message *));
+        if (messages == NULL) {
+            perror("malloc() failed in outbound_queue_push()");
+            return 0;
+        }
+
+        // unwrap the ring into the new array
+        for (int i = 0; i < queue->count; i++) {
+            messages[i] = queue->messages[(queue->head + i) % queue->capacity];
+        }
+        free(queue->messages);
+
+        queue->messages = messages;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+
+    queue->messages[(queue->head + queue->count) % queue->capacity] = message_ref(message);
+    queue->count++;
+    queue->bytes += message->len;
+    return 1;
+}
+
+// points iov at (up to max of) the queued messages, oldest first
+int outbound_queue_prepare(struct outbound_queue *queue, struct iovec *iov, int max, size_t *total) {
+    int iovcnt = 0;
+    *total = 0;
+
+    for (int i = 0; i < queue->count && iovcnt < max; i++) {
+        struct message *message = queue->messages[(queue->head + i) % queue->capacity];
+        size_t skip = i == 0 ? queue->offset : 0;
+        iov[iovcnt].iov_base = message->data + skip;
+        iov[iovcnt].iov_len = message->len - skip;
+        *total += iov[iovcnt].iov_len;
+        iovcnt++;
+    }
+
+    queue->pinned = iovcnt;
+    return iovcnt;
+}
+
+// releases the first len queued bytes, once they have been written
+void outbound_queue_consume(struct outbound_queue *queue, size_t len) {
+    // release every message that was written completely
+    queue->bytes -= len;
+    size_t remaining = len + queue->offset;
+    while (queue->count > 0 && remaining >= queue->messages[queue->head]->len) {
+        remaining -= queue->messages[queue->head]->len;
+        message_unref(queue->messages[queue->head]);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    queue->offset = remaining;
+    queue->pinned = 0;
+}
+
+// drops the oldest messages that are not pinned (or partly written) until at
+// most max_bytes are left to send
+int outbound_queue_drop_oldest(struct outbound_queue *queue, size_t max_bytes) {
+    int keep = queue->pinned > 0 ? queue->pinned : queue->offset > 0;
+    int dropped = 0;
+
+    while (queue->count - dropped > keep && queue->bytes > max_bytes) {
+        struct message *message = queue->messages[(queue->head + keep + dropped) % queue->capacity];
+        queue->bytes -= message->len;
+        message_unref(message);
+        dropped++;
+    }
+    if (dropped == 0) {
+        return 0;
+    }
+
+    // close the gap by moving the messages that were kept up against the rest
+    for (int k = keep - 1; k >= 0; k--) {
+        queue->messages[(queue->head + k + dropped) % queue->capacity] =
+            queue->messages[(queue->head + k) % queue->capacity];
+    }
+    queue->head = (queue->head + dropped) % queue->capacity;
+    queue->count -= dropped;
+    return dropped;
+}
+
+// writes as much of the queue to fd as it will take
+int outbound_queue_flush(struct outbound_queue *queue, int fd) {
+    while (queue->count > 0) {
+        struct iovec iov[MAX_FLUSH_IOVECS];
+        size_t total;
+        int iovcnt = outbound_queue_prepare(queue, iov, MAX_FLUSH_IOVECS, &total);
+
+        ssize_t nwritten = writev(fd, iov, iovcnt);
+        if (nwritten < 0) {
+            // nothing was written, so nothing is in flight either
+            queue->pinned = 0;
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+
+        outbound_queue_consume(queue, nwritten);
+
+        // a short write means the socket buffer is full
+        if ((size_t)nwritten < total) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
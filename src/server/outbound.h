@@ -0,0 +1,65 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef OUTBOUND_H_
+#define OUTBOUND_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "message.h"
+
+// the most messages handed to a single writev()
+#define MAX_FLUSH_IOVECS 64
+
+// an outbound queue holds references to the messages a user has yet to be
+// sent, in order. it is flushed with writev whenever the socket is writable,
+// so a user that is briefly busy falls behind instead of losing messages.
+//
+// bytes counts what is still to be sent, so the server can tell when a user
+// has fallen too far behind. messages are only ever dropped whole, and never
+// once they have started going out (or been handed to the kernel, with
+// io_uring), so what does reach the user is still a valid stream of frames.
+
+struct outbound_queue {
+    struct message **messages;
+    int head;
+    int count;
+    int capacity;
+    size_t offset;
+    size_t bytes;
+    int pinned;
+};
+
+// initialize the queue
+void outbound_queue_initialize(struct outbound_queue *queue);
+
+// drops every queued message and frees the queue's memory
+void outbound_queue_free(struct outbound_queue *queue);
+
+// appends a reference to the message to the queue
+// (ret: 1 success, 0 failure)
+int outbound_queue_push(struct outbound_queue *queue, struct message *message);
+
+// points iov at (up to max of) the queued messages, oldest first, and sets
+// total to the number of bytes they cover
+// note: the messages are pinned (can't be dropped) until outbound_queue_consume()
+// (ret: the number of iovecs filled in)
+int outbound_queue_prepare(struct outbound_queue *queue, struct iovec *iov, int max, size_t *total);
+
+// releases the first len queued bytes, once they have been written
+void outbound_queue_consume(struct outbound_queue *queue, size_t len);
+
+// drops the oldest messages that are not pinned (or partly written) until at
+// most max_bytes are left to send
+// (ret: the number of messages dropped)
+int outbound_queue_drop_oldest(struct outbound_queue *queue, size_t max_bytes);
+
+// writes as much of the queue to fd as it will take
+// (ret: 1 queue empty, 0 fd is full, -1 error (see errno))
+int outbound_queue_flush(struct outbound_queue *queue, int fd);
+
+#endif  // OUTBOUND_H_
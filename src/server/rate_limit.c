@@ -0,0 +1,89 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "rate_limit.h"
+
+#include <time.h>
+
+#define NS_PER_SECOND 1000000000ull
+
+// sets up the bucket to refill rate tokens a second, holding up to burst of them
+void rate_limit_initialize(struct rate_limit *limit, int rate, int burst) {
+    if (rate <= 0) {
+        limit->interval_ns = 0;
+        limit->tolerance_ns = 0;
+        return;
+    }
+
+    // the first token is the one being taken, the rest may be taken early
+    limit->interval_ns = NS_PER_SECOND / rate;
+    limit->tolerance_ns = limit->interval_ns * (uint64_t)(burst > 1 ? burst - 1 : 0);
+}
+
+// returns whether the bucket limits anything at all
+int rate_limit_enabled(const struct rate_limit *limit) {
+    return limit->interval_ns != 0;
+}
+
+// works out the bucket's state after taking a token at time now
+// (ret: 0 taken (and *next set), otherwise the time at which a token will be available)
+static uint64_t rate_limit_step(const struct rate_limit *limit, uint64_t full_at, uint64_t now, uint64_t *next) {
+    // a bucket that was full a while ago is simply full
+    if (full_at < now) {
+        full_at = now;
+    }
+
+    if (full_at - now > limit->tolerance_ns) {
+        return full_at - limit->tolerance_ns;
+    }
+
+    *next = full_at + limit->interval_ns;
+    return 0;
+}
+
+// takes a token from the bucket whose state is *full_at, at time now (in nanoseconds)
+uint64_t rate_limit_take(const struct rate_limit *limit, uint64_t *full_at, uint64_t now) {
+    if (limit->interval_ns == 0) {
+        return 0;
+    }
+
+    uint64_t next;
+    uint64_t retry_at = rate_limit_step(limit, *full_at, now, &next);
+    if (retry_at == 0) {
+        *full_at = next;
+    }
+    return retry_at;
+}
+
+// the same, for a bucket that is shared between threads (or processes)
+uint64_t rate_limit_take_shared(const struct rate_limit *limit, uint64_t *full_at, uint64_t now) {
+    if (limit->interval_ns == 0) {
+        return 0;
+    }
+
+    uint64_t current = __atomic_load_n(full_at, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        uint64_t retry_at = rate_limit_step(limit, current, now, &next);
+        if (retry_at != 0) {
+            return retry_at;
+        }
+    } while (!__atomic_compare_exchange_n(full_at, &current, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+// puts back a token that was taken, but not used
+void rate_limit_refund(const struct rate_limit *limit, uint64_t *full_at) {
+    *full_at -= limit->interval_ns;
+}
+
+// returns the current (monotonic) time in nanoseconds
+uint64_t rate_limit_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
@@ -0,0 +1,55 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef RATE_LIMIT_H_
+#define RATE_LIMIT_H_
+
+#include <stdint.h>
+
+// a token bucket, kept as a single timestamp (the generic cell rate
+// algorithm): rather than counting tokens and topping them up, the bucket
+// remembers when it will next be full. taking a token pushes that time back
+// by one interval, and a token may be taken as long as the bucket would not
+// be full for more than burst intervals to come.
+//
+// since the whole bucket is one word, a bucket shared by every shard (or
+// worker, in shared memory) needs no lock: rate_limit_take_shared() updates it
+// with a compare-and-swap.
+
+// the shape of a bucket (an interval of 0 never limits anything)
+struct rate_limit {
+    uint64_t interval_ns;
+    uint64_t tolerance_ns;
+};
+
+// counters for what was done with the messages over the limit
+struct rate_limit_stats {
+    uint64_t delayed;        // messages held back until the sender had a token again
+    uint64_t dropped;        // messages thrown away
+    uint64_t disconnected;   // users disconnected for going over their limit too often
+};
+
+// sets up the bucket to refill rate tokens a second, holding up to burst of them
+// (a rate of 0 leaves it unlimited)
+void rate_limit_initialize(struct rate_limit *limit, int rate, int burst);
+
+// returns whether the bucket limits anything at all
+int rate_limit_enabled(const struct rate_limit *limit);
+
+// takes a token from the bucket whose state is *full_at, at time now (in nanoseconds)
+// (ret: 0 taken, otherwise the time at which a token will be available)
+uint64_t rate_limit_take(const struct rate_limit *limit, uint64_t *full_at, uint64_t now);
+
+// the same, for a bucket that is shared between threads (or processes)
+uint64_t rate_limit_take_shared(const struct rate_limit *limit, uint64_t *full_at, uint64_t now);
+
+// puts back a token that was taken, but not used
+void rate_limit_refund(const struct rate_limit *limit, uint64_t *full_at);
+
+// returns the current (monotonic) time in nanoseconds
+uint64_t rate_limit_now(void);
+
+#endif  // RATE_LIMIT_H_
@@ -0,0 +1,307 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "rooms.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "directory.h"
+
+// the number of buckets a room index starts out with
+#define INITIAL_BUCKETS 16
+
+// the number of members a room starts out with space for
+#define INITIAL_MEMBERS 8
+
+
+
+//
+// ROOM_INDEX function(s)
+//
+
+// initialize the room index
+int room_index_initialize(struct room_index *index) {
+    if ((index->buckets = calloc(INITIAL_BUCKETS, sizeof(struct room *))) == NULL) {
+        perror("calloc() failed in room_index_initialize()");
+        return 0;
+    }
+
+    index->mask = INITIAL_BUCKETS - 1;
+    index->count = 0;
+    return 1;
+}
+
+// returns the room named "name" (or NULL)
+struct room *room_index_find(struct room_index *index, const char *name) {
+    uint32_t hash = username_hash(name);
+
+    for (struct room *room = index->buckets[hash & index->mask]; room != NULL; room = room->next) {
+        if (room->hash == hash && strcmp(room->name, name) == 0) {
+            return room;
+        }
+    }
+    return NULL;
+}
+
+// doubles the number of buckets, keeping chains short as rooms are created
+// (ret: 1 success, 0 failure)
+static int room_index_grow(struct room_index *index) {
+    uint32_t mask = index->mask * 2 + 1;
+    struct room **buckets = calloc(mask + 1, sizeof(struct room *));
+    if (buckets == NULL) {
+        perror("calloc() failed in room_index_grow()");
+        return 0;
+    }
+
+    for (uint32_t b = 0; b <= index->mask; b++) {
+        struct room *room = index->buckets[b];
+        while (room != NULL) {
+            struct room *next = room->next;
+            room->next = buckets[room->hash & mask];
+            buckets[room->hash & mask] = room;
+            room = next;
+        }
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->mask = mask;
+    return 1;
+}
+
+// returns the room named "name", creating it if it does not exist yet (or NULL)
+struct room *room_index_find_or_create(struct room_index *index, const char *name) {
+    struct room *room = room_index_find(index, name);
+    if (room != NULL) {
+        return room;
+    }
+
+    // a failure to grow only makes the chains longer, so carry on regardless
+    if ((uint32_t)index->count > index->mask) {
+        room_index_grow(index);
+    }
+
+    if ((room = malloc(sizeof(struct room))) == NULL) {
+        perror("malloc() failed in room_index_find_or_create()");
+        return NULL;
+    }
+
+    strcpy(room->name, name);
+    room->hash = username_hash(name);
+    room->members = NULL;
+    room->count = 0;
+    room->capacity = 0;
+    room->next = index->buckets[room->hash & index->mask];
+    index->buckets[room->hash & index->mask] = room;
+    index->count++;
+    return room;
+}
+
+// removes the room from the index and frees it
+void room_index_remove(struct room_index *index, struct room *room) {
+    struct room **link = &index->buckets[room->hash & index->mask];
+    while (*link != NULL && *link != room) {
+        link = &(*link)->next;
+    }
+
+    if (*link == room) {
+        *link = room->next;
+        index->count--;
+        free(room->members);
+        free(room);
+    }
+}
+
+// appends member to the room
+int room_add_member(struct room *room, int member) {
+    if (room->count == room->capacity) {
+        int capacity = room->capacity == 0 ? INITIAL_MEMBERS : room->capacity * 2;
+        int *members = realloc(room->members, capacity * sizeof(int));
+        if (members == NULL) {
+            perror("realloc() failed in room_add_member()");
+            return -1;
+        }
+        room->members = members;
+        room->capacity = capacity;
+    }
+
+    room->members[room->count] = member;
+    return room->count++;
+}
+
+// removes the member at position by moving the last member into its place
+int room_remove_member(struct room *room, int position) {
+    room->count--;
+    if (position == room->count) {
+        return -1;
+    }
+
+    room->members[position] = room->members[room->count];
+    return room->members[position];
+}
+
+
+
+//
+// ROOM_REGISTRY function(s)
+//
+
+// returns the slot holding the room "name", or the empty slot it would go in
+// note: the caller must hold the lock
+static uint32_t room_registry_find_slot(struct room_registry *registry, const char *name, uint32_t hash) {
+    uint32_t slot = hash & registry->mask;
+    while (registry->entries[slot].taken == 1) {
+        if (registry->entries[slot].hash == hash && strcmp(registry->entries[slot].name, name) == 0) {
+            break;
+        }
+        slot = (slot + 1) & registry->mask;
+    }
+    return slot;
+}
+
+// removes the room in slot (which no shard has members in anymore)
+// note: the caller must hold the lock
+static void room_registry_remove_slot(struct room_registry *registry, uint32_t slot) {
+    registry->entries[slot].taken = 0;
+    registry->count--;
+
+    // shift the following entries of the probe sequence back, so that
+    // lookups never stop early at the hole we just left
+    uint32_t hole = slot;
+    uint32_t next = (slot + 1) & registry->mask;
+    while (registry->entries[next].taken == 1) {
+        uint32_t home = registry->entries[next].hash & registry->mask;
+        if (((next - home) & registry->mask) >= ((next - hole) & registry->mask)) {
+            registry->entries[hole] = registry->entries[next];
+            registry->entries[next].taken = 0;
+            hole = next;
+        }
+        next = (next + 1) & registry->mask;
+    }
+}
+
+// initialize the room registry for at most max_rooms rooms
+int room_registry_initialize(struct room_registry *registry, int max_rooms, int shared) {
+    // keep the table at most half full, so probe sequences stay short
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t)max_rooms * 2) {
+        capacity *= 2;
+    }
+
+    if ((registry->entries = shared_alloc(capacity * sizeof(struct room_registry_entry), shared)) == NULL) {
+        return 0;
+    }
+
+    shared_mutex_initialize(&registry->lock, shared);
+    registry->mask = capacity - 1;
+    registry->count = 0;
+    registry->max_rooms = max_rooms;
+    return 1;
+}
+
+// records that shard has (at least one) member in the room "name"
+void room_registry_add_shard(struct room_registry *registry, const char *name, int shard) {
+    uint32_t hash = username_hash(name);
+
+    shared_mutex_lock(&registry->lock);
+    uint32_t slot = room_registry_find_slot(registry, name, hash);
+    struct room_registry_entry *entry = &registry->entries[slot];
+
+    if (entry->taken != 1 && registry->count < registry->max_rooms) {
+        strcpy(entry->name, name);
+        entry->hash = hash;
+        entry->shards = 0;
+        entry->taken = 1;
+        registry->count++;
+    }
+    if (entry->taken == 1) {
+        entry->shards |= (uint64_t)1 << shard;
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// records that shard no longer has any member in the room "name"
+void room_registry_remove_shard(struct room_registry *registry, const char *name, int shard) {
+    uint32_t hash = username_hash(name);
+
+    shared_mutex_lock(&registry->lock);
+    uint32_t slot = room_registry_find_slot(registry, name, hash);
+    struct room_registry_entry *entry = &registry->entries[slot];
+
+    if (entry->taken == 1) {
+        entry->shards &= ~((uint64_t)1 << shard);
+        if (entry->shards == 0) {
+            room_registry_remove_slot(registry, slot);
+        }
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// records that shard no longer has any member in any room
+void room_registry_remove_shard_everywhere(struct room_registry *registry, int shard) {
+    shared_mutex_lock(&registry->lock);
+
+    // removing an entry can shift a later one back into its slot, so look at
+    // the same slot again before moving on
+    uint32_t slot = 0;
+    while (slot <= registry->mask) {
+        struct room_registry_entry *entry = &registry->entries[slot];
+        if (entry->taken == 1 && (entry->shards & ((uint64_t)1 << shard))) {
+            entry->shards &= ~((uint64_t)1 << shard);
+            if (entry->shards == 0) {
+                room_registry_remove_slot(registry, slot);
+                continue;
+            }
+        }
+        slot++;
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+// copies (at most max of) the shards with members in the room "name" into shards
+int room_registry_shards(struct room_registry *registry, const char *name, int *shards, int max) {
+    uint32_t hash = username_hash(name);
+    int count = 0;
+
+    shared_mutex_lock(&registry->lock);
+    uint32_t slot = room_registry_find_slot(registry, name, hash);
+    uint64_t mask = registry->entries[slot].taken == 1 ? registry->entries[slot].shards : 0;
+    pthread_mutex_unlock(&registry->lock);
+
+    for (int s = 0; s < MAX_REGISTRY_SHARDS && count < max; s++) {
+        if (mask & ((uint64_t)1 << s)) {
+            shards[count++] = s;
+        }
+    }
+    return count;
+}
+
+// returns a new message (with one reference) containing "/roomlist <room1> ... <roomi>"
+struct message *room_registry_format_roomlist(struct room_registry *registry) {
+    shared_mutex_lock(&registry->lock);
+
+    // format straight into the message, then trim its length to fit
+    struct message *message = message_alloc(strlen("/roomlist") + registry->count * (MAX_ROOM_NAME_LEN + 1) + 1);
+
+    if (message != NULL) {
+        char *payload = message->data + FRAME_HEADER_LEN;
+        char *end = payload + sprintf(payload, "/roomlist");
+
+        for (uint32_t i = 0; i <= registry->mask; i++) {
+            if (registry->entries[i].taken == 1) {
+                end += sprintf(end, " %s", registry->entries[i].name);
+            }
+        }
+
+        message->len = end - message->data;
+        frame_put_header(message->data, end - payload);
+    }
+    pthread_mutex_unlock(&registry->lock);
+
+    return message;
+}
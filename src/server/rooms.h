@@ -0,0 +1,110 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef ROOMS_H_
+#define ROOMS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "message.h"
+#include "shared.h"
+
+// every shard keeps a room index mapping each room its users have joined to
+// the local users subscribed to it, so a message sent to a room is only ever
+// queued for that room's members.
+//
+// the room registry is shared by every shard: it records which shards have at
+// least one member in each room, so a room message only wakes up the shards
+// that need it (and /roomlist can be answered without asking every shard).
+// it is an open addressing hash table sized for the most rooms there could
+// ever be, allocated once (so it can live in shared memory, for worker
+// processes), holding each room's shards as a bitmask.
+
+// the maximum number of rooms a single user can be in at once
+#define MAX_ROOMS_PER_USER 16
+
+// the room every user joins when they log in
+#define DEFAULT_ROOM "lobby"
+
+// the maximum number of shards the room registry can keep track of
+#define MAX_REGISTRY_SHARDS 64
+
+struct room {
+    char name[MAX_ROOM_NAME_LEN + 1];
+    uint32_t hash;
+    int *members;
+    int count;
+    int capacity;
+    struct room *next;
+};
+
+// a chained hash table of rooms, grown (by doubling) as rooms are created
+struct room_index {
+    struct room **buckets;
+    uint32_t mask;
+    int count;
+};
+
+struct room_registry_entry {
+    char name[MAX_ROOM_NAME_LEN + 1];
+    uint32_t hash;
+    uint64_t shards;
+    int taken;
+};
+
+struct room_registry {
+    pthread_mutex_t lock;
+    struct room_registry_entry *entries;
+    uint32_t mask;
+    int count;
+    int max_rooms;
+};
+
+// initialize the room index
+// (ret: 1 success, 0 failure)
+int room_index_initialize(struct room_index *index);
+
+// returns the room named "name" (or NULL)
+struct room *room_index_find(struct room_index *index, const char *name);
+
+// returns the room named "name", creating it if it does not exist yet (or NULL)
+struct room *room_index_find_or_create(struct room_index *index, const char *name);
+
+// removes the room from the index and frees it
+void room_index_remove(struct room_index *index, struct room *room);
+
+// appends member to the room
+// (ret: the member's position in the room, -1 failure)
+int room_add_member(struct room *room, int member);
+
+// removes the member at position by moving the last member into its place
+// (ret: the member that now occupies position, -1 if none did)
+int room_remove_member(struct room *room, int position);
+
+// initialize the room registry for at most max_rooms rooms (in memory shared
+// with forked workers, if shared is set)
+// (ret: 1 success, 0 failure)
+int room_registry_initialize(struct room_registry *registry, int max_rooms, int shared);
+
+// records that shard has (at least one) member in the room "name"
+void room_registry_add_shard(struct room_registry *registry, const char *name, int shard);
+
+// records that shard no longer has any member in the room "name"
+void room_registry_remove_shard(struct room_registry *registry, const char *name, int shard);
+
+// records that shard no longer has any member in any room
+void room_registry_remove_shard_everywhere(struct room_registry *registry, int shard);
+
+// copies (at most max of) the shards with members in the room "name" into shards
+// (ret: the number of shards copied)
+int room_registry_shards(struct room_registry *registry, const char *name, int *shards, int max);
+
+// returns a new message (with one reference) containing "/roomlist <room1> ... <roomi>" (or NULL)
+struct message *room_registry_format_roomlist(struct room_registry *registry);
+
+#endif  // ROOMS_H_
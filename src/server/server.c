@@ -4,410 +4,371 @@
 // github.com/danielshervheim
 //
 
-#include <errno.h>
-#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-
-// network includes
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/types.h>
 
 #include "common.h"
+#include "metrics.h"
+#include "shard.h"
+
+// the maximum number of reactor threads (or workers)
+#define MAX_THREADS 64
+
+// the default maximum number of concurrently logged in users
+#define DEFAULT_MAX_USERS 1024
+
+// the default number of bytes of recent messages kept for replay
+#define DEFAULT_HISTORY_BYTES (64 * 1024)
+
+// the default interval between log commits (in milliseconds)
+#define DEFAULT_LOG_SYNC_MS 100
+
+// the default number of times a user may go over their rate limit (with
+// one forgiven every second) before they are disconnected
+#define DEFAULT_MAX_STRIKES 20
+
+// the default number of bytes a user may have waiting to be sent before they
+// count as having fallen behind
+#define DEFAULT_HIGH_WATER (4 * 1024 * 1024)
+
+// the default timeouts (in seconds): how long a user may be quiet before they
+// are pinged, and before they are disconnected, and how long a new connection
+// has to send its /join
+#define DEFAULT_PING_INTERVAL 30
+#define DEFAULT_IDLE_TIMEOUT 90
+#define DEFAULT_HANDSHAKE_TIMEOUT 10
+
+// the default number of connections each thread (or worker) lets be
+// mid-handshake at once
+#define DEFAULT_MAX_HANDSHAKES 128
+
+// prints the usage message and exits
+void usage(const char *program) {
+    printf("usage: %s <port> [--threads N | --workers N] [--max-users N] [--history-bytes N] [--log DIR]"
+        " [--log-sync-ms N] [--io epoll|uring] [--cluster HOST:PORT,... --node N] [--rate-limit N]"
+        " [--rate-burst N] [--global-rate-limit N] [--rate-policy delay|drop] [--max-strikes N]"
+        " [--high-water N] [--low-water N] [--slow-policy disconnect|drop-oldest|drop-new]"
+        " [--ping-interval S] [--idle-timeout S] [--handshake-timeout S] [--max-handshakes N]"
+        " [--metrics-port N]\n", program);
+    exit(-1);
+}
 
+// prints the rate limiting and slow consumer counters every time the server is sent SIGUSR1
+void *report_stats(void *arg) {
+    sigset_t *signals = arg;
+    while (1) {
+        int sig;
+        if (sigwait(signals, &sig) != 0) {
+            continue;
+        }
 
+        struct rate_limit_stats stats;
+        shards_get_rate_limit_stats(&stats);
+        printf("rate limit: %llu delayed, %llu dropped, %llu disconnected\n", (unsigned long long)stats.delayed,
+            (unsigned long long)stats.dropped, (unsigned long long)stats.disconnected);
 
-//
-// USER_LIST function(s)
-//
-
-// the user struct
-struct user {
-    char username[MAX_USERNAME_LEN];
-    int write_to_child;
-    int read_from_child;
-    int taken;
-};
-
-// initialize user list
-void user_list_initialize(struct user *user_list) {
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        strcpy(user_list[i].username, "");
-        user_list[i].write_to_child = -1;
-        user_list[i].read_from_child = -1;
-        user_list[i].taken = 0;
+        struct slow_consumer_stats slow;
+        shards_get_slow_consumer_stats(&slow);
+        printf("slow consumers: %llu dropped, %llu disconnected\n", (unsigned long long)slow.dropped,
+            (unsigned long long)slow.disconnected);
+        fflush(stdout);
     }
+    return NULL;
 }
 
-// removes the user at position i from the list
-void user_list_remove_user(struct user *user_list, int i) {
-    if (i >= 0 && i < MAX_CONCURRENT_USERS) {
-        strcpy(user_list[i].username, "");
-        close(user_list[i].write_to_child);
-        user_list[i].write_to_child = -1;
-        close(user_list[i].read_from_child);
-        user_list[i].read_from_child = -1;
-        user_list[i].taken = 0;
-    }
-}
 
-// returns an empty position, i, or -1 if the server is full
-int user_list_get_free_index(struct user *user_list) {
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        if (user_list[i].taken == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
 
-// returns the index of the user "username", or -1
-int user_list_get_index_by_username(struct user *user_list, char *username) {
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        if (user_list[i].taken == 1) {
-            if (strcmp(user_list[i].username, username) == 0) {
-                return i;
-            }
+//
+// MAIN launches the server then waits for incoming connections and messages,
+// reformatting and distributing them as appropriate
+//
+int main(int argc, char* argv[]) {
+    struct server_config config;
+    config.num_threads = 1;
+    config.num_workers = 0;
+    config.max_users = DEFAULT_MAX_USERS;
+    config.log_directory = NULL;
+    config.log_sync_ms = DEFAULT_LOG_SYNC_MS;
+    config.use_uring = 0;
+    config.cluster_nodes = NULL;
+    config.node = -1;
+    config.rate_limit = 0;
+    config.rate_burst = 0;
+    config.global_rate_limit = 0;
+    config.rate_drop = 0;
+    config.max_strikes = DEFAULT_MAX_STRIKES;
+    config.slow_policy = SLOW_DISCONNECT;
+    config.ping_interval = DEFAULT_PING_INTERVAL;
+    config.idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    config.handshake_timeout = DEFAULT_HANDSHAKE_TIMEOUT;
+    config.max_handshakes = DEFAULT_MAX_HANDSHAKES;
+    long history_bytes = DEFAULT_HISTORY_BYTES;
+    long high_water = DEFAULT_HIGH_WATER;
+    long low_water = -1;
+    int metrics_port = 0;
+
+    static struct option long_options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"workers", required_argument, NULL, 'w'},
+        {"max-users", required_argument, NULL, 'm'},
+        {"history-bytes", required_argument, NULL, 'b'},
+        {"log", required_argument, NULL, 'l'},
+        {"log-sync-ms", required_argument, NULL, 's'},
+        {"io", required_argument, NULL, 'i'},
+        {"cluster", required_argument, NULL, 'c'},
+        {"node", required_argument, NULL, 'n'},
+        {"rate-limit", required_argument, NULL, 'r'},
+        {"rate-burst", required_argument, NULL, 'u'},
+        {"global-rate-limit", required_argument, NULL, 'g'},
+        {"rate-policy", required_argument, NULL, 'p'},
+        {"max-strikes", required_argument, NULL, 'k'},
+        {"high-water", required_argument, NULL, 'H'},
+        {"low-water", required_argument, NULL, 'L'},
+        {"slow-policy", required_argument, NULL, 'P'},
+        {"ping-interval", required_argument, NULL, 'T'},
+        {"idle-timeout", required_argument, NULL, 'I'},
+        {"handshake-timeout", required_argument, NULL, 'J'},
+        {"max-handshakes", required_argument, NULL, 'A'},
+        {"metrics-port", required_argument, NULL, 'M'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:w:m:b:l:s:i:c:n:r:u:g:p:k:H:L:P:T:I:J:A:M:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                config.num_threads = atoi(optarg);
+                break;
+            case 'w':
+                config.num_workers = atoi(optarg);
+                break;
+            case 'm':
+                config.max_users = atoi(optarg);
+                break;
+            case 'b':
+                history_bytes = atol(optarg);
+                break;
+            case 'l':
+                config.log_directory = optarg;
+                break;
+            case 's':
+                config.log_sync_ms = atoi(optarg);
+                break;
+            case 'i':
+                // the event loop backend (io_uring falls back to epoll if the kernel lacks it)
+                if (strcmp(optarg, "uring") == 0) {
+                    config.use_uring = 1;
+                }
+                else if (strcmp(optarg, "epoll") != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'c':
+                config.cluster_nodes = optarg;
+                break;
+            case 'n':
+                config.node = atoi(optarg);
+                break;
+            case 'r':
+                config.rate_limit = atoi(optarg);
+                break;
+            case 'u':
+                config.rate_burst = atoi(optarg);
+                break;
+            case 'g':
+                config.global_rate_limit = atoi(optarg);
+                break;
+            case 'p':
+                // what happens to a message over the limit
+                if (strcmp(optarg, "drop") == 0) {
+                    config.rate_drop = 1;
+                }
+                else if (strcmp(optarg, "delay") != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'k':
+                config.max_strikes = atoi(optarg);
+                break;
+            case 'H':
+                high_water = atol(optarg);
+                break;
+            case 'L':
+                low_water = atol(optarg);
+                break;
+            case 'P':
+                // what happens to a user who falls too far behind
+                if (strcmp(optarg, "disconnect") == 0) {
+                    config.slow_policy = SLOW_DISCONNECT;
+                }
+                else if (strcmp(optarg, "drop-oldest") == 0) {
+                    config.slow_policy = SLOW_DROP_OLDEST;
+                }
+                else if (strcmp(optarg, "drop-new") == 0) {
+                    config.slow_policy = SLOW_DROP_NEW;
+                }
+                else {
+                    usage(argv[0]);
+                }
+                break;
+            case 'T':
+                config.ping_interval = atoi(optarg);
+                break;
+            case 'I':
+                config.idle_timeout = atoi(optarg);
+                break;
+            case 'J':
+                config.handshake_timeout = atoi(optarg);
+                break;
+            case 'A':
+                config.max_handshakes = atoi(optarg);
+                break;
+            case 'M':
+                metrics_port = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
         }
     }
-    return -1;
-}
 
-// send the userlist to all currently connected users
-void broadcast_user_list(struct user *user_list) {
-    // generate the userlist...
-    char tmp[BUFFER_SIZE];
-    strcpy(tmp, "/userlist");
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        if (user_list[i].taken == 1) {
-            strcat(tmp, " ");
-            strcat(tmp, user_list[i].username);
-        }
+    // verify that the number of arguments are correct
+    if (optind != argc - 1) {
+        usage(argv[0]);
     }
 
-    // ...then write it to all connected users
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        if (user_list[i].taken == 1) {
-             if (write(user_list[i].write_to_child, tmp, strlen(tmp)) < 0) {
-             	perror("write() failed in broadcast_user_list()");
-             }
-        }
+    // verify that the port is within the correct range
+    config.port = atoi(argv[optind]);
+    if (config.port < 1024 || config.port > 65535) {
+        printf("invalid port range\n");
+        exit(-1);
     }
-}
 
-/*
-// sends the user who left to all current users
-void notify_user_left(struct user *user_list, const char *username) {
-    char msg[BUFFER_SIZE];
-    memset(msg, '\0', BUFFER_SIZE);
-    sprintf(msg, "/left %s", username);
-
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        if (user_list[i].taken == 1) {
-            if (write(user_list[i].write_to_child, msg, strlen(msg)) < 0) {
-               perror("write() failed in notify_user_left()");
-            }
-        }
+    // verify that the number of threads is sensible
+    if (config.num_threads < 1 || config.num_threads > MAX_THREADS) {
+        printf("invalid number of threads (1 - %d)\n", MAX_THREADS);
+        exit(-1);
     }
-}
 
-// sends the user who joined to all current users
-void notify_user_joined(struct user *user_list, const char *username) {
-    char msg[BUFFER_SIZE];
-    memset(msg, '\0', BUFFER_SIZE);
-    sprintf(msg, "/joined %s", username);
-
-    for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-        if (user_list[i].taken == 1 && strcmp(username, user_list[i].username) != 0) {
-            if (write(user_list[i].write_to_child, msg, strlen(msg)) < 0) {
-               perror("write() failed in notify_user_joined()");
-            }
-        }
+    // verify that the number of workers is sensible (0 runs threads instead)
+    if (config.num_workers < 0 || config.num_workers > MAX_THREADS) {
+        printf("invalid number of workers (1 - %d)\n", MAX_THREADS);
+        exit(-1);
     }
-}
-*/
-
 
+    // each worker runs a single shard, and the log's writer thread has to live
+    // in a single process
+    if (config.num_workers > 0 && config.num_threads > 1) {
+        printf("--threads and --workers can't be combined\n");
+        exit(-1);
+    }
+    if (config.num_workers > 0 && config.log_directory != NULL) {
+        printf("--log can't be combined with --workers\n");
+        exit(-1);
+    }
 
-//
-// USER_DAEMON acts as a relay between the server process and the user's client
-//
-void user_daemon(int write_to_server, int read_from_server, int socket_fd) {
-    while (1) {
-        char server_buf[BUFFER_SIZE];
-        memset(server_buf, '\0', BUFFER_SIZE);
-        ssize_t server_nread;
-
-        // if there is data to read from the server
-        if ((server_nread = read(read_from_server, server_buf, BUFFER_SIZE)) != -1) {
-            if (server_nread == 0) {
-            	// the connection to the server was lost
-                close(write_to_server);
-                close(read_from_server);
-                close(socket_fd);
-                exit(1);
-            }
-            else if (write(socket_fd, server_buf, server_nread) < 0) {
-               	perror("write() failed in user_daemon()");
-            }
-        }
+    // a node has to know where it is in the cluster, and the link thread has
+    // to live in a single process
+    if ((config.cluster_nodes != NULL) != (config.node >= 0)) {
+        printf("--cluster and --node must be given together\n");
+        exit(-1);
+    }
+    if (config.num_workers > 0 && config.cluster_nodes != NULL) {
+        printf("--cluster can't be combined with --workers\n");
+        exit(-1);
+    }
 
-        char client_buf[BUFFER_SIZE];
-        memset(client_buf, '\0', BUFFER_SIZE);
-        ssize_t client_nread;
-
-        // if there is data to read from the socket
-        if ((client_nread = read(socket_fd, client_buf, BUFFER_SIZE)) != -1) {
-            if (client_nread == 0) {
-            	// the connection to the client was lost
-                close(write_to_server);
-                close(read_from_server);
-                close(socket_fd);
-                exit(1);
-            }
-            else if (write(write_to_server, client_buf, client_nread) < 0){
-            	perror("write() failed in user_daemon()");
-            }
-        }
+    // verify that the maximum number of users is sensible
+    if (config.max_users < 1) {
+        printf("invalid maximum number of users\n");
+        exit(-1);
+    }
 
-        usleep(MICRO_SLEEP_DUR);
+    // verify that the history budget is sensible (0 disables the history)
+    if (history_bytes < 0) {
+        printf("invalid number of history bytes\n");
+        exit(-1);
     }
-}
+    config.history_bytes = history_bytes;
 
+    // verify that the log commit interval is sensible
+    if (config.log_sync_ms < 1) {
+        printf("invalid log sync interval\n");
+        exit(-1);
+    }
 
+    // verify that the rate limits are sensible (0 disables them), letting a
+    // user send a second's worth of messages at once unless told otherwise
+    if (config.rate_limit < 0 || config.rate_burst < 0 || config.global_rate_limit < 0) {
+        printf("invalid rate limit\n");
+        exit(-1);
+    }
+    if (config.rate_burst == 0) {
+        config.rate_burst = config.rate_limit;
+    }
 
-//
-// MAIN launches the server then checks for incoming messages from user daemons,
-// reformatting and distributing them as appropriate
-//
-int main(int argc, char* argv[]) {
-    // verify that the number of arguments are correct
-    if (argc < 2) {
-        printf("usage: %s <port>\n", argv[0]);
+    // verify that the number of strikes is sensible (0 never disconnects anyone)
+    if (config.max_strikes < 0) {
+        printf("invalid maximum number of strikes\n");
         exit(-1);
     }
 
-    // verify that the port is within the correct range
-    int port = atoi(argv[1]);
-    if (port < 1024 || port > 65535) {
-        printf("invalid port range\n");
+    // verify that the water marks are sensible (a high water mark of 0 lets a
+    // user fall behind without bound), draining a user halfway by default
+    if (low_water < 0) {
+        low_water = high_water / 2;
+    }
+    if (high_water < 0 || low_water > high_water) {
+        printf("invalid water marks (0 <= low water <= high water)\n");
         exit(-1);
     }
+    config.high_water = high_water;
+    config.low_water = low_water;
 
-    // initialize the socket
-    // note: socket needs to be non-blocking as we "accept" new connections every iteration
-    int sock_fd;
-    if ((sock_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
-        perror("socket() failed");
+    // verify that the timeouts are sensible (0 disables them)
+    if (config.ping_interval < 0 || config.idle_timeout < 0 || config.handshake_timeout < 0) {
+        printf("invalid timeout\n");
         exit(-1);
     }
 
-    // set the socket to allow reuse of the same address
-    if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0) {
-        perror("setsockopt(SO_REUSEADDR) failed");
+    // verify that the handshake cap is sensible
+    if (config.max_handshakes < 1) {
+        printf("invalid maximum number of handshakes\n");
         exit(-1);
     }
 
-    // create an address structure based on the port
-    // note: INADDR_ANY binds to any local ip address (typically there is only one,
-    // unless the host has multiple wifi cards, or wifi+ethernet)
-    struct sockaddr_in addr;
-    addr.sin_family = PF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port);
-
-    // bind the socket to the address structure
-    if (bind(sock_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
-        perror("bind() failed");
+    // verify that the metrics port is within the correct range (0 serves no metrics)
+    if (metrics_port != 0 && (metrics_port < 1024 || metrics_port > 65535 || metrics_port == config.port)) {
+        printf("invalid metrics port\n");
         exit(-1);
     }
 
-    // set the socket to listen for incoming connections
-    if (listen(sock_fd, MAX_CONCURRENT_USERS) < 0) {
-        perror("listen() failed");
+    // a client that disconnects mid-write should cost us an EPIPE, not the whole server
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGUSR1 is only ever taken by the thread that reports the counters (every
+    // other thread, and worker, inherits the mask with it blocked)
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if (!shards_initialize(&config)) {
         exit(-1);
     }
 
-    // initialize the user_list data structure
-    struct user user_list[MAX_CONCURRENT_USERS];
-    user_list_initialize(user_list);
+    pthread_t reporter;
+    if (pthread_create(&reporter, NULL, report_stats, &signals) != 0) {
+        perror("pthread_create() failed");
+        exit(-1);
+    }
 
-    // begin the main server loop
-    while (1) {
-        int incoming_fd;
-
-        // a user is trying to connect
-        if ((incoming_fd = accept(sock_fd, NULL, NULL)) != -1) {
-
-        	// temporary buffer to hold handshake information
-            char handshake_buf[BUFFER_SIZE];
-            memset(handshake_buf, '\0', BUFFER_SIZE);
-            ssize_t handshake_nread;
-
-            // wait for handshake from user
-            if ((handshake_nread = read(incoming_fd, handshake_buf, BUFFER_SIZE)) <= 0) {
-                perror("read() failed");
-                close(incoming_fd);
-            }
-            else if (memcmp(handshake_buf, "/join", strlen("/join")) != 0) {
-                printf("user did not send /join command as expected\n");
-                close(incoming_fd);
-            }
-            else {
-            	// handshake_buf is of format: /join <username>
-                char* username = handshake_buf + strlen("/join") + 1;
-                int index_to_add;
-
-                // check if we are able to add the user to the userlist
-                if (user_list_get_index_by_username(user_list, username) != -1) {
-                    if (write(incoming_fd, "/joinresponse username_taken", strlen("/joinresponse username_taken")) < 0) {
-                    	perror("write() failed while responding to join request");
-                    }
-                    close(incoming_fd);
-                }
-                else if ((index_to_add = user_list_get_free_index(user_list)) < 0) {
-                    if (write(incoming_fd, "/joinresponse server_full", strlen("/joinresponse server_full")) < 0) {
-                    	perror("write() failed while responding to join request");
-                    }
-                    close(incoming_fd);
-                }
-                else {
-                    // attempt to add the user to the userlist
-                    int child_to_server[2], server_to_child[2];
-                    pid_t user_daemon_pid = -1;
-
-                    if (pipe(child_to_server) < 0 || pipe(server_to_child) < 0) {
-                        perror("pipe() failed");
-                        close(incoming_fd);
-                    }
-                    else if (fcntl(child_to_server[0], F_SETFL, O_NONBLOCK) < 0 ||
-                             fcntl(child_to_server[1], F_SETFL, O_NONBLOCK) < 0 ||
-                             fcntl(server_to_child[0], F_SETFL, O_NONBLOCK) < 0 ||
-                             fcntl(server_to_child[1], F_SETFL, O_NONBLOCK) < 0) {
-                        perror("fcntl() failed");
-                        close(incoming_fd);
-                        close(child_to_server[0]);
-                        close(child_to_server[1]);
-                        close(server_to_child[0]);
-                        close(server_to_child[1]);
-                    }
-                    else if ((user_daemon_pid = fork()) < 0) {
-                        perror("fork() failed");
-                        close(incoming_fd);
-                        close(child_to_server[0]);
-                        close(child_to_server[1]);
-                        close(server_to_child[0]);
-                        close(server_to_child[1]);
-                    }
-                    else if (user_daemon_pid == 0) {
-                        // we are now in child process
-                        close(child_to_server[0]);
-                        close(server_to_child[1]);
-
-                        fcntl(incoming_fd, F_SETFL, O_NONBLOCK);
-                        user_daemon(child_to_server[1], server_to_child[0], incoming_fd);
-                    }
-                    else {
-                        // we are still in parent process
-                        close(child_to_server[1]);
-                        close(server_to_child[0]);
-                        strcpy(user_list[index_to_add].username, username);
-                        user_list[index_to_add].write_to_child = server_to_child[1];
-                        user_list[index_to_add].read_from_child = child_to_server[0];
-                        user_list[index_to_add].taken = 1;
-
-                        // notify the user that they are connected succesfully
-                        if (write(incoming_fd, "/joinresponse ok", strlen("/joinresponse ok")) < 0) {
-                            perror("write() failed while responding to join request");
-                            user_list_remove_user(user_list, index_to_add);
-                        }
-                        else {
-                            // notify all users that userlist has changed
-                            broadcast_user_list(user_list);
-                        }
-                    }
-                }
-            }
-        }
-        else {
-            // check if there are messages to pass
-            for (int i = 0; i < MAX_CONCURRENT_USERS; i++) {
-                if (user_list[i].taken == 1) {
-
-                	// temporary buffer to hold potential message
-                    char buf[BUFFER_SIZE];
-                    memset(buf, '\0', BUFFER_SIZE);
-                    ssize_t nread;
-
-                    if ((nread = read(user_list[i].read_from_child, buf, BUFFER_SIZE)) != -1) {
-                        if (nread == 0) {
-                            // the connection to this user was lost, so remove them
-                            user_list_remove_user(user_list, i);
-
-                            // notify all users that userlist has changed
-                            broadcast_user_list(user_list);
-                        }
-                        else {
-                            if (memcmp(buf, "/whisper", strlen("/whisper")) == 0) {
-                                // strtok modifies the original string so we must
-                                // make another copy to single out the recipient
-                                char rec_buf[BUFFER_SIZE];
-                                memset(rec_buf, '\0', BUFFER_SIZE);
-                                strcpy(rec_buf, buf + strlen("/whisper") + 1);
-
-                                char *recipient = strtok(rec_buf, " ");
-                                char *message = buf + strlen("/whisper") + 1 + strlen(recipient) + 1;
-
-                                int recipient_index = user_list_get_index_by_username(user_list, recipient);
-
-                                // note: the client does not allow whispering to non-
-                                // connected users, so this check is unnecessary... in theory...
-                                if (recipient_index >= 0) {
-                                	// reformat the message to send it out
-                                	char outgoing[BUFFER_SIZE];
-                                	memset(outgoing, '\0', BUFFER_SIZE);
-                                	sprintf(outgoing, "/whispered %s %s", user_list[i].username, message);
-
-                                    if (write(user_list[recipient_index].write_to_child, outgoing, strlen(outgoing)) < 0) {
-                                    	perror("write() failed while whispering");
-                                    }
-                                }
-                            }
-                            else if (memcmp(buf, "/broadcast", strlen("/broadcast")) == 0) {
-                                char *message = buf + strlen("/broadcast") + 1;
-
-                                // reformat the message to send it out
-                                char outgoing[BUFFER_SIZE];
-                                memset(outgoing, '\0', BUFFER_SIZE);
-                                sprintf(outgoing, "/broadcasted %s %s", user_list[i].username, message);
-
-                                for (int j = 0; j < MAX_CONCURRENT_USERS; j++) {
-                                    if (j != i && user_list[j].taken == 1) {
-                                        if (write(user_list[j].write_to_child, outgoing, strlen(outgoing)) < 0) {
-                                        	perror("write() failed while broadcasting");
-                                        }
-                                    }
-                                }
-                            }
-                            // add other commands here, if any
-                        }
-
-                        // note: we end the loop early (and check remaining users on the next iteration)
-                        // to prevent sending multiple messages to the same user in the same iteration
-                        // (else, user would recieve multiple messages as one single message)
-                        // since the client and server both "sleep" for the same duration, this should
-                        // avoid collisions... in theory...
-                        i = MAX_CONCURRENT_USERS;
-                    }
-                }
-            }
-        }
+    if (metrics_port != 0 && !metrics_serve(metrics_port, shards_write_metrics)) {
+        exit(-1);
+    }
 
-        usleep(MICRO_SLEEP_DUR);
-    }  // end of while
+    shards_run();
 }  // end of main
@@ -0,0 +1,2316 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "shard.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// network includes
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// the most a single /catchup replays, and the most of the log it scans
+// (in steps of CATCHUP_STEP_BYTES, one per tick, so that even a /catchup
+// that finds nothing to replay can't stall a shard)
+#define MAX_CATCHUP_BYTES (1024 * 1024)
+#define MAX_CATCHUP_SCAN_BYTES (64 * 1024 * 1024)
+#define CATCHUP_STEP_BYTES (1024 * 1024)
+
+// the longest a /join may be (a connection announcing a longer first frame is
+// refused as soon as its header is in, rather than buffering it)
+#define MAX_JOIN_LEN BUFFER_SIZE
+
+// the maximum number of events handled per call to epoll_wait()
+#define MAX_EPOLL_EVENTS 64
+
+// epoll user data tags for the listening socket and the mailbox
+// (user sockets are tagged by their index in the user list, and sockets
+// still in their handshake by their slot, above HANDSHAKE_TAG_BASE)
+#define LISTENER_TAG ((uint64_t)-1)
+#define MAILBOX_TAG ((uint64_t)-2)
+#define HANDSHAKE_TAG_BASE ((uint64_t)1 << 32)
+#define HANDSHAKE_TAG(h) (HANDSHAKE_TAG_BASE | (uint32_t)(h))
+
+// the size of each shard's io_uring submission queue, and the number of
+// receive buffers (of FRAME_READ_CHUNK bytes each) the kernel can fill
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 1024
+#define URING_BUFFER_GROUP 0
+
+// io_uring user data is the kind of request and the user index it is for
+#define URING_ACCEPT 1
+#define URING_MAILBOX 2
+#define URING_RECV 3
+#define URING_SEND 4
+#define URING_PROBE 5
+#define URING_TIMER 6
+#define URING_HANDSHAKE 7
+#define URING_CANCEL 8
+#define URING_DATA(kind, index) (((uint64_t)(kind) << 32) | (uint32_t)(index))
+#define URING_KIND(data) ((int)((data) >> 32))
+#define URING_INDEX(data) ((int)(uint32_t)(data))
+
+// the most a throttled user may have buffered (past that, they are disconnected).
+// with io_uring, whatever the kernel already received for them before their
+// receive was cancelled (at most every provided buffer) is let in on top
+#define MAX_THROTTLED_BYTES (256 * 1024)
+#define MAX_THROTTLED_URING_BYTES (MAX_THROTTLED_BYTES + (size_t)URING_BUFFERS * FRAME_READ_CHUNK)
+
+// the length of a timer wheel tick (in milliseconds)
+#define TIMER_TICK_MS 10
+
+// each user has a timer of each kind, known by their index and the kind
+// (and each handshake has a deadline, known by its slot)
+#define TIMER_HEARTBEAT 0
+#define TIMER_RESUME 1
+#define TIMER_HANDSHAKE 2
+#define TIMER_CATCHUP 3
+#define TIMERS_PER_USER 4
+#define USER_TIMER(index, kind) ((index) * TIMERS_PER_USER + (kind))
+#define HANDSHAKE_TIMER(h) USER_TIMER(h, TIMER_HANDSHAKE)
+
+// forward declaration(s)
+void remove_user(struct shard *self, int i);
+void disconnect_user(struct shard *self, int i, const char *reason);
+void route_frames(struct shard *self, int i);
+void expire_handshake(struct shard *self, int h);
+void continue_catchup(struct shard *self, int i);
+void start_receiving(struct shard *self, int i);
+void claim_decided(struct shard *self, int h, const char *username, struct message *verdict);
+int shard_initialize_events(struct shard *self);
+int find_subscription(struct shard *self, int i, const char *name);
+
+// every shard, and the directory, room registry, history and (optional)
+// message log they share (the first three in shared memory, with workers)
+static struct shard *shards = NULL;
+static int num_shards = 0;
+static struct directory *directory = NULL;
+static struct room_registry *room_registry = NULL;
+static struct history *history = NULL;
+static struct message_log message_log;
+static int logging = 0;
+
+// whether the shards run as worker processes rather than threads, and each
+// worker's process id
+static int workers = 0;
+static pid_t *worker_pids = NULL;
+
+// whether to run the shards' event loops on io_uring rather than epoll
+static int use_uring = 0;
+
+// the cluster this server is a node of (if any)
+static struct cluster cluster;
+static int clustered = 0;
+
+// the rate limits: each user's own, the whole server's, and how often a user
+// may go over theirs before they are disconnected
+static struct rate_limit user_limit;
+static struct rate_limit global_limit;
+static struct rate_limit strike_limit;
+static int rate_limiting = 0;
+static int rate_drop = 0;
+
+// the server's bucket and the rate limiting counters (in shared memory, with workers)
+struct rate_limit_state {
+    uint64_t global_full_at;
+    struct rate_limit_stats stats;
+};
+static struct rate_limit_state *rate_state = NULL;
+
+// how far behind a user may fall, what happens to them if they fall further,
+// and how often it did (in shared memory, with workers)
+static size_t high_water = 0;
+static size_t low_water = 0;
+static int slow_policy = SLOW_DISCONNECT;
+static struct slow_consumer_stats *slow_stats = NULL;
+
+// how long (in ticks) a user may be quiet before they are sent a /ping, and
+// before they are disconnected, and how long a new connection has to send
+// its /join (0 for never)
+static uint64_t ping_ticks = 0;
+static uint64_t idle_ticks = 0;
+static uint64_t handshake_ticks = 0;
+
+// a step of a /catchup in progress
+struct catchup {
+    struct shard *self;
+    int i;
+    size_t bytes;
+};
+
+
+
+//
+// METRICS function(s)
+// every shard counts what it does in its own counters, which only it writes
+// (see metrics.h), and the metrics endpoint sums them across every shard
+//
+
+// counts len bytes as sent to a user (and so no longer queued)
+void note_sent(struct shard *self, size_t len) {
+    metrics_add(&self->metrics->bytes_sent, len);
+    metrics_add(&self->metrics->queued_bytes, -(uint64_t)len);
+}
+
+// notes that a message from the latest read was routed, so its latency is
+// recorded once the fan-out is flushed
+void note_routed(struct shard *self) {
+    if (self->routed_count > 0 && self->routed[self->routed_count - 1].read_at == self->read_at) {
+        self->routed[self->routed_count - 1].count++;
+        return;
+    }
+
+    if (self->routed_count == self->routed_capacity) {
+        int capacity = self->routed_capacity == 0 ? 64 : self->routed_capacity * 2;
+        struct routed_read *routed = realloc(self->routed, capacity * sizeof(struct routed_read));
+        if (routed == NULL) {
+            perror("realloc() failed in note_routed()");
+            return;
+        }
+        self->routed = routed;
+        self->routed_capacity = capacity;
+    }
+    self->routed[self->routed_count].read_at = self->read_at;
+    self->routed[self->routed_count].count = 1;
+    self->routed_count++;
+}
+
+// records how long every message routed during this iteration took, from
+// being read to its fan-out being flushed (or, with io_uring, queued for the
+// kernel), which takes a single look at the clock however many there were
+void record_fanout_latency(struct shard *self) {
+    if (self->routed_count == 0) {
+        return;
+    }
+
+    uint64_t now = rate_limit_now();
+    for (int r = 0; r < self->routed_count; r++) {
+        histogram_record(&self->metrics->fanout_latency, (now - self->routed[r].read_at) / 1000,
+            self->routed[r].count);
+    }
+    self->routed_count = 0;
+}
+
+// writes every shard's counters (summed), and the server's, in the prometheus text format
+void shards_write_metrics(FILE *out) {
+    struct shard_metrics total;
+    memset(&total, 0, sizeof(total));
+
+    for (int s = 0; s < num_shards; s++) {
+        struct shard_metrics *metrics = shards[s].metrics;
+        total.accepted += metrics_read(&metrics->accepted);
+        total.handshakes_refused += metrics_read(&metrics->handshakes_refused);
+        total.handshakes_timed_out += metrics_read(&metrics->handshakes_timed_out);
+        total.joins += metrics_read(&metrics->joins);
+        total.joins_refused += metrics_read(&metrics->joins_refused);
+        total.leaves += metrics_read(&metrics->leaves);
+        for (int op = 0; op < OP_COUNT; op++) {
+            total.received[op] += metrics_read(&metrics->received[op]);
+        }
+        total.sent += metrics_read(&metrics->sent);
+        total.bytes_received += metrics_read(&metrics->bytes_received);
+        total.bytes_sent += metrics_read(&metrics->bytes_sent);
+        total.handshakes += metrics_read(&metrics->handshakes);
+        total.queued_bytes += metrics_read(&metrics->queued_bytes);
+        histogram_merge(&total.fanout_latency, &metrics->fanout_latency);
+        histogram_merge(&total.handshake_time, &metrics->handshake_time);
+    }
+
+    metrics_write_family(out, "tinychat_connections_accepted_total", "counter", "Connections accepted.");
+    metrics_write_value(out, "tinychat_connections_accepted_total", NULL, total.accepted);
+    metrics_write_family(out, "tinychat_handshakes_refused_total", "counter",
+        "Connections closed because too many handshakes were in progress.");
+    metrics_write_value(out, "tinychat_handshakes_refused_total", NULL, total.handshakes_refused);
+    metrics_write_family(out, "tinychat_handshakes_timed_out_total", "counter",
+        "Connections closed for not sending /join in time.");
+    metrics_write_value(out, "tinychat_handshakes_timed_out_total", NULL, total.handshakes_timed_out);
+    metrics_write_family(out, "tinychat_handshakes", "gauge", "Handshakes in progress.");
+    metrics_write_value(out, "tinychat_handshakes", NULL, total.handshakes);
+
+    metrics_write_family(out, "tinychat_joins_total", "counter", "Users joined.");
+    metrics_write_value(out, "tinychat_joins_total", NULL, total.joins);
+    metrics_write_family(out, "tinychat_joins_refused_total", "counter", "Join requests refused.");
+    metrics_write_value(out, "tinychat_joins_refused_total", NULL, total.joins_refused);
+    metrics_write_family(out, "tinychat_leaves_total", "counter", "Users left (or disconnected).");
+    metrics_write_value(out, "tinychat_leaves_total", NULL, total.leaves);
+    metrics_write_family(out, "tinychat_users", "gauge", "Users logged in.");
+    metrics_write_value(out, "tinychat_users", NULL, total.joins - total.leaves);
+
+    // received messages are broken down by their command word (without the slash)
+    metrics_write_family(out, "tinychat_messages_received_total", "counter", "Messages received, by type.");
+    for (int op = 0; op < OP_COUNT; op++) {
+        const char *word = protocol_command_word(op);
+        char labels[64];
+        snprintf(labels, sizeof(labels), "type=\"%s\"", word[0] == '/' ? word + 1 : "text");
+        metrics_write_value(out, "tinychat_messages_received_total", labels, total.received[op]);
+    }
+    metrics_write_family(out, "tinychat_messages_sent_total", "counter", "Messages queued for a user.");
+    metrics_write_value(out, "tinychat_messages_sent_total", NULL, total.sent);
+    metrics_write_family(out, "tinychat_received_bytes_total", "counter", "Bytes received from users.");
+    metrics_write_value(out, "tinychat_received_bytes_total", NULL, total.bytes_received);
+    metrics_write_family(out, "tinychat_sent_bytes_total", "counter", "Bytes sent to users.");
+    metrics_write_value(out, "tinychat_sent_bytes_total", NULL, total.bytes_sent);
+    metrics_write_family(out, "tinychat_queued_bytes", "gauge", "Bytes queued for users, but not yet sent.");
+    metrics_write_value(out, "tinychat_queued_bytes", NULL, total.queued_bytes);
+
+    uint64_t mailbox_drops = 0;
+    for (int s = 0; s < num_shards; s++) {
+        mailbox_drops += mailbox_dropped(&shards[s].mailbox);
+    }
+
+    struct rate_limit_stats rate;
+    shards_get_rate_limit_stats(&rate);
+    struct slow_consumer_stats slow;
+    shards_get_slow_consumer_stats(&slow);
+
+    metrics_write_family(out, "tinychat_messages_delayed_total", "counter",
+        "Messages held back by the rate limit.");
+    metrics_write_value(out, "tinychat_messages_delayed_total", NULL, rate.delayed);
+    metrics_write_family(out, "tinychat_messages_dropped_total", "counter", "Messages dropped, by reason.");
+    metrics_write_value(out, "tinychat_messages_dropped_total", "reason=\"rate_limit\"", rate.dropped);
+    metrics_write_value(out, "tinychat_messages_dropped_total", "reason=\"slow_consumer\"", slow.dropped);
+    metrics_write_value(out, "tinychat_messages_dropped_total", "reason=\"mailbox\"", mailbox_drops);
+    metrics_write_family(out, "tinychat_disconnects_total", "counter", "Users disconnected, by reason.");
+    metrics_write_value(out, "tinychat_disconnects_total", "reason=\"rate_limit\"", rate.disconnected);
+    metrics_write_value(out, "tinychat_disconnects_total", "reason=\"slow_consumer\"", slow.disconnected);
+
+    // note: the slab's counters are kept per process, so with workers they
+    // would only ever cover the supervisor
+    if (!workers) {
+        struct slab_stats slab;
+        slab_get_stats(&slab);
+        metrics_write_family(out, "tinychat_slab_allocations_total", "counter",
+            "Message buffer allocations, by where they were served from.");
+        metrics_write_value(out, "tinychat_slab_allocations_total", "from=\"cache\"", slab.hits);
+        metrics_write_value(out, "tinychat_slab_allocations_total", "from=\"depot\"", slab.misses);
+        metrics_write_value(out, "tinychat_slab_allocations_total", "from=\"malloc\"", slab.oversize);
+        metrics_write_family(out, "tinychat_slab_chunks_total", "counter", "Chunks carved into message buffers.");
+        metrics_write_value(out, "tinychat_slab_chunks_total", NULL, slab.slabs);
+    }
+
+    metrics_write_histogram(out, "tinychat_fanout_latency_seconds",
+        "Time from a message being read to its fan-out being flushed.", &total.fanout_latency);
+    metrics_write_histogram(out, "tinychat_handshake_seconds",
+        "Time from a connection being accepted to its join.", &total.handshake_time);
+}
+
+
+
+//
+// DELIVERY function(s)
+// messages are queued on each recipient's outbound queue, and every queue
+// that was touched is flushed once at the end of the event loop iteration, so
+// a burst of messages to the same user goes out with a single writev()
+//
+
+// tells epoll which of local user i's socket events to report: whether it is
+// readable (unless the user is throttled), and whether it is writable (while
+// their outbound queue is backed up)
+void update_events(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+
+    struct epoll_event ev;
+    ev.events = (user->throttled ? 0 : EPOLLIN) | (user->want_write ? EPOLLOUT : 0);
+    ev.data.u64 = i;
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, user->socket_fd, &ev) < 0) {
+        perror("epoll_ctl() failed");
+    }
+}
+
+// updates whether epoll should report when local user i's socket is writable
+void watch_writable(struct shard *self, int i, int want_write) {
+    struct user *user = &self->user_list.users[i];
+    if (user->want_write == want_write) {
+        return;
+    }
+
+    user->want_write = want_write;
+    update_events(self, i);
+}
+
+// remembers to flush local user i at the end of the iteration
+void mark_dirty(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+
+    if (!user->dirty) {
+        if (self->dirty_count == self->dirty_capacity) {
+            int capacity = self->dirty_capacity == 0 ? 64 : self->dirty_capacity * 2;
+            int *dirty = realloc(self->dirty, capacity * sizeof(int));
+            if (dirty == NULL) {
+                perror("realloc() failed in mark_dirty()");
+                return;
+            }
+            self->dirty = dirty;
+            self->dirty_capacity = capacity;
+        }
+        self->dirty[self->dirty_count++] = i;
+        user->dirty = 1;
+    }
+}
+
+// queues the message for local user i
+void send_to_user(struct shard *self, int i, struct message *message) {
+    struct user *user = &self->user_list.users[i];
+
+    // a user on their way out (but still waiting on the kernel) gets nothing more
+    if (user->closing) {
+        return;
+    }
+
+    // every message is formatted as text, and encoded for binary users as needed
+    if (user->binary && (message = message_binary(message)) == NULL) {
+        return;
+    }
+
+    // a user who has fallen too far behind is dealt with according to the policy
+    if (high_water > 0 && (user->behind || user->outbound.bytes + message->len > high_water)) {
+        user->behind = 1;
+
+        if (slow_policy == SLOW_DISCONNECT) {
+            // note: they are disconnected once the fan-out is over (see flush_dirty())
+            mark_dirty(self, i);
+            return;
+        }
+        if (slow_policy == SLOW_DROP_NEW) {
+            __atomic_fetch_add(&slow_stats->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    if (outbound_queue_push(&user->outbound, message)) {
+        metrics_add(&self->metrics->sent, 1);
+        metrics_add(&self->metrics->queued_bytes, message->len);
+
+        // (with SLOW_DROP_OLDEST) make room by dropping what they have yet to be sent
+        if (user->behind) {
+            size_t queued = user->outbound.bytes;
+            int dropped = outbound_queue_drop_oldest(&user->outbound, low_water);
+            __atomic_fetch_add(&slow_stats->dropped, dropped, __ATOMIC_RELAXED);
+            metrics_add(&self->metrics->queued_bytes, -(uint64_t)(queued - user->outbound.bytes));
+            user->behind = user->outbound.bytes > low_water;
+        }
+        mark_dirty(self, i);
+    }
+}
+
+// notes that local user i has caught up, once their queue drains back under the low water mark
+void check_caught_up(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    if (user->behind && user->outbound.bytes <= low_water) {
+        user->behind = 0;
+    }
+}
+
+// queues the message for every local user except skip_index (if >= 0)
+void deliver_local(struct shard *self, int skip_index, struct message *message) {
+    for (int i = 0; i < self->user_list.capacity; i++) {
+        if (i != skip_index && self->user_list.users[i].taken == 1) {
+            send_to_user(self, i, message);
+        }
+    }
+}
+
+// queues the message for every user on every shard except the local user skip_index
+void deliver_everywhere(struct shard *self, int skip_index, struct message *message) {
+    deliver_local(self, skip_index, message);
+
+    for (int s = 0; s < num_shards; s++) {
+        if (s != self->id) {
+            mailbox_post(&shards[s].mailbox, self->id, MAIL_BROADCAST, -1, NULL, message);
+        }
+    }
+}
+
+// queues the message for every local member of the room "name" except skip_index (if >= 0)
+void deliver_room_local(struct shard *self, const char *name, int skip_index, struct message *message) {
+    struct room *room = room_index_find(&self->rooms, name);
+    if (room == NULL) {
+        return;
+    }
+
+    for (int m = 0; m < room->count; m++) {
+        if (room->members[m] != skip_index) {
+            send_to_user(self, room->members[m], message);
+        }
+    }
+}
+
+// queues the message for every member of the room "name" on every shard, except
+// the local user skip_index
+// note: only the shards with members in the room are posted to
+void deliver_room(struct shard *self, const char *name, int skip_index, struct message *message) {
+    deliver_room_local(self, name, skip_index, message);
+
+    int member_shards[num_shards];
+    int count = room_registry_shards(room_registry, name, member_shards, num_shards);
+
+    for (int m = 0; m < count; m++) {
+        if (member_shards[m] != self->id) {
+            mailbox_post(&shards[member_shards[m]].mailbox, self->id, MAIL_ROOMCAST, -1, name, message);
+        }
+    }
+}
+
+// sends the full userlist to local user i (once, right after they log in)
+void send_user_list(struct shard *self, int i) {
+    struct message *message = directory_format_userlist(directory);
+    if (message != NULL) {
+        send_to_user(self, i, message);
+        message_unref(message);
+    }
+}
+
+// replays the recorded messages sent to room (and every broadcast, if
+// with_broadcasts is set) to local user i
+void send_history(struct shard *self, int i, const char *room, int with_broadcasts) {
+    int count;
+    struct message **messages = history_snapshot(history, room, with_broadcasts, &count);
+    if (messages == NULL) {
+        return;
+    }
+
+    for (int m = 0; m < count; m++) {
+        send_to_user(self, i, messages[m]);
+        message_unref(messages[m]);
+    }
+    free(messages);
+}
+
+// records the message as sent to room in the history, and the log if enabled
+void remember_message(const char *room, struct message *message) {
+    history_append(history, room, message->data, message->len);
+    if (logging) {
+        message_log_append(&message_log, room, message);
+    }
+}
+
+// copies a logged message into the history (when restarting)
+int restore_history(void *context, const char *room, const char *frame, size_t len, uint64_t timestamp) {
+    history_append(history, room, frame, len);
+    return 1;
+}
+
+// queues a logged message for the user catching up, if it was sent to them
+int send_catchup(void *context, const char *room, const char *frame, size_t len, uint64_t timestamp) {
+    struct catchup *catchup = context;
+    if (strcmp(room, HISTORY_BROADCAST) != 0 && find_subscription(catchup->self, catchup->i, room) < 0) {
+        return 1;
+    }
+
+    struct message *message = message_new(frame + FRAME_HEADER_LEN, len - FRAME_HEADER_LEN);
+    if (message != NULL) {
+        send_to_user(catchup->self, catchup->i, message);
+        message_unref(message);
+    }
+
+    catchup->bytes += len;
+    return catchup->bytes < MAX_CATCHUP_BYTES;
+}
+
+// sends the user who joined (local user i) to all other users
+void notify_user_joined(struct shard *self, int i) {
+    struct message *message = message_format("/joined %s", self->user_list.users[i].username);
+    if (message != NULL) {
+        deliver_everywhere(self, i, message);
+        message_unref(message);
+    }
+}
+
+// sends the user who left to all current users
+void notify_user_left(struct shard *self, const char *username) {
+    struct message *message = message_format("/left %s", username);
+    if (message != NULL) {
+        deliver_everywhere(self, -1, message);
+        message_unref(message);
+    }
+}
+
+// delivers all the mail other shards have posted to this shard
+void deliver_mail(struct shard *self) {
+    mailbox_acknowledge(&self->mailbox);
+
+    struct mail mail;
+    while (mailbox_take(&self->mailbox, &mail)) {
+        if (mail.type == MAIL_BROADCAST) {
+            deliver_local(self, mail.index, mail.message);
+        }
+        else if (mail.type == MAIL_WHISPER) {
+            // the recipient may have left (and their slot been reused) since the
+            // mail was posted, so make sure it still belongs to them
+            struct user *user = &self->user_list.users[mail.index];
+            if (user->taken == 1 && strcmp(user->username, mail.name) == 0) {
+                send_to_user(self, mail.index, mail.message);
+            }
+        }
+        else if (mail.type == MAIL_ROOMCAST) {
+            deliver_room_local(self, mail.name, -1, mail.message);
+        }
+        else if (mail.type == MAIL_CLAIMED) {
+            claim_decided(self, mail.index, mail.name, mail.message);
+        }
+
+        message_unref(mail.message);
+    }
+}
+
+// writes as much of local user i's outbound queue as the socket will take
+void flush_user(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    size_t queued = user->outbound.bytes;
+    int ret = outbound_queue_flush(&user->outbound, user->socket_fd);
+    note_sent(self, queued - user->outbound.bytes);
+
+    if (ret < 0) {
+        // the connection to this user was lost, so remove them
+        remove_user(self, i);
+    }
+    else {
+        // wait for the socket to drain if anything is left over
+        watch_writable(self, i, ret == 0);
+        check_caught_up(self, i);
+    }
+}
+
+// (io_uring) submits one send for every user that had messages queued during
+// this iteration, unless one is already in flight (its completion picks up the rest)
+void flush_dirty_uring(struct shard *self) {
+    // every send needs its own header and iovecs, which must stay put until
+    // they are submitted at the top of the next iteration
+    if (self->dirty_count > self->send_capacity) {
+        struct msghdr *msgs = realloc(self->send_msgs, self->dirty_count * sizeof(struct msghdr));
+        if (msgs != NULL) {
+            self->send_msgs = msgs;
+        }
+        struct iovec *iovs = realloc(self->send_iovs, self->dirty_count * MAX_FLUSH_IOVECS * sizeof(struct iovec));
+        if (iovs != NULL) {
+            self->send_iovs = iovs;
+        }
+        if (msgs == NULL || iovs == NULL) {
+            perror("realloc() failed in flush_dirty_uring()");
+            return;
+        }
+        self->send_capacity = self->dirty_count;
+    }
+
+    for (int d = 0; d < self->dirty_count; d++) {
+        int i = self->dirty[d];
+        struct user *user = &self->user_list.users[i];
+
+        if (user->taken != 1 || !user->dirty) {
+            continue;
+        }
+        user->dirty = 0;
+
+        if (user->closing || user->sending || user->outbound.count == 0) {
+            continue;
+        }
+
+        struct msghdr *msg = &self->send_msgs[d];
+        size_t total;
+        memset(msg, 0, sizeof(struct msghdr));
+        msg->msg_iov = &self->send_iovs[d * MAX_FLUSH_IOVECS];
+        msg->msg_iovlen = outbound_queue_prepare(&user->outbound, msg->msg_iov, MAX_FLUSH_IOVECS, &total);
+
+        uring_prep_sendmsg(uring_get_sqe(&self->ring), user->socket_fd, msg, URING_DATA(URING_SEND, i));
+        user->sending = 1;
+        user->pending_ops++;
+    }
+    self->dirty_count = 0;
+}
+
+// flushes every user that had messages queued during this iteration
+void flush_dirty(struct shard *self) {
+    // disconnect whoever fell too far behind first, since that queues a /left
+    // for everyone else (which may append to the list while we walk it)
+    if (high_water > 0 && slow_policy == SLOW_DISCONNECT) {
+        for (int d = 0; d < self->dirty_count; d++) {
+            int i = self->dirty[d];
+            struct user *user = &self->user_list.users[i];
+
+            if (user->taken == 1 && !user->closing && user->behind) {
+                __atomic_fetch_add(&slow_stats->disconnected, 1, __ATOMIC_RELAXED);
+                disconnect_user(self, i, "too far behind");
+            }
+        }
+    }
+
+    if (self->use_uring) {
+        flush_dirty_uring(self);
+        record_fanout_latency(self);
+        return;
+    }
+
+    // note: removing a user queues a /left for everyone else, which may
+    // append to the list while we walk it
+    for (int d = 0; d < self->dirty_count; d++) {
+        int i = self->dirty[d];
+        struct user *user = &self->user_list.users[i];
+
+        if (user->taken == 1 && user->dirty) {
+            user->dirty = 0;
+            flush_user(self, i);
+        }
+    }
+    self->dirty_count = 0;
+    record_fanout_latency(self);
+}
+
+
+
+//
+// ROOM function(s)
+// each user keeps track of the rooms they are in (and where in each room's
+// member list they are), so joining and leaving never scans a whole room
+//
+
+// returns which of local user i's subscriptions is to the room "name", or -1
+int find_subscription(struct shard *self, int i, const char *name) {
+    struct user *user = &self->user_list.users[i];
+    for (int s = 0; s < user->num_rooms; s++) {
+        if (strcmp(user->rooms[s].room->name, name) == 0) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+// subscribes local user i to the room "name"
+// (ret: 1 success, 2 already subscribed, 0 failure, -1 too many rooms)
+int join_room(struct shard *self, int i, const char *name) {
+    struct user *user = &self->user_list.users[i];
+    if (find_subscription(self, i, name) >= 0) {
+        return 2;
+    }
+
+    if (user->num_rooms >= MAX_ROOMS_PER_USER) {
+        return -1;
+    }
+
+    struct room *room = room_index_find_or_create(&self->rooms, name);
+    if (room == NULL) {
+        return 0;
+    }
+
+    int position = room_add_member(room, i);
+    if (position < 0) {
+        if (room->count == 0) {
+            room_index_remove(&self->rooms, room);
+        }
+        return 0;
+    }
+
+    // the first local member means messages to this room must now reach this shard
+    if (room->count == 1) {
+        room_registry_add_shard(room_registry, name, self->id);
+    }
+
+    user->rooms[user->num_rooms].room = room;
+    user->rooms[user->num_rooms].position = position;
+    user->num_rooms++;
+    return 1;
+}
+
+// unsubscribes local user i from their s-th room
+void leave_room(struct shard *self, int i, int s) {
+    struct user *user = &self->user_list.users[i];
+    struct room *room = user->rooms[s].room;
+    int position = user->rooms[s].position;
+
+    // whoever was moved into our place in the room has to know their new position
+    int moved = room_remove_member(room, position);
+    if (moved >= 0) {
+        struct user *other = &self->user_list.users[moved];
+        for (int t = 0; t < other->num_rooms; t++) {
+            if (other->rooms[t].room == room) {
+                other->rooms[t].position = position;
+                break;
+            }
+        }
+    }
+
+    user->num_rooms--;
+    user->rooms[s] = user->rooms[user->num_rooms];
+
+    if (room->count == 0) {
+        room_registry_remove_shard(room_registry, room->name, self->id);
+        room_index_remove(&self->rooms, room);
+    }
+}
+
+// sends the list of every room with members in it to local user i
+void send_room_list(struct shard *self, int i) {
+    struct message *message = room_registry_format_roomlist(room_registry);
+    if (message != NULL) {
+        send_to_user(self, i, message);
+        message_unref(message);
+    }
+}
+
+// tells local user i whether they joined the room "name"
+void send_room_join_response(struct shard *self, int i, const char *name, const char *status) {
+    struct message *message = message_format("/roomjoinresponse %s %s", name, status);
+    if (message != NULL) {
+        send_to_user(self, i, message);
+        message_unref(message);
+    }
+}
+
+
+
+//
+// RATE_LIMIT function(s)
+// every message takes a token from its sender's bucket (and the server's)
+// before it is even parsed. a message over the limit is either dropped, or
+// held back (along with everything sent after it) until there is a token for
+// it again, with the socket left unread meanwhile so that tcp pushes back on
+// the sender (with io_uring, the user's receive is cancelled, and restarted
+// once they are let through again). going over one's own limit is a strike,
+// and a user who runs out of strikes is disconnected.
+//
+
+// disconnects local user i for sending too much
+void disconnect_flooder(struct shard *self, int i) {
+    __atomic_fetch_add(&rate_state->stats.disconnected, 1, __ATOMIC_RELAXED);
+    disconnect_user(self, i, "flooding");
+}
+
+// holds back local user i's messages until resume_at (in nanoseconds)
+void throttle_user(struct shard *self, int i, uint64_t resume_at) {
+    struct user *user = &self->user_list.users[i];
+    uint64_t tick_ns = TIMER_TICK_MS * 1000000ull;
+
+    if (timer_wheel_schedule(&self->timers, USER_TIMER(i, TIMER_RESUME), (resume_at + tick_ns - 1) / tick_ns) &&
+        !user->throttled) {
+        user->throttled = 1;
+        if (!self->use_uring) {
+            update_events(self, i);
+        }
+        else if (user->receiving) {
+            uring_prep_cancel(uring_get_sqe(&self->ring), URING_DATA(URING_RECV, i), URING_DATA(URING_CANCEL, i));
+        }
+    }
+}
+
+// routes local user i's held back messages, once their time has come
+void resume_user(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    if (user->taken != 1 || user->closing || !user->throttled) {
+        return;
+    }
+
+    user->throttled = 0;
+    if (!self->use_uring) {
+        update_events(self, i);
+    }
+
+    // (a held back message's latency is counted from its release)
+    self->read_at = rate_limit_now();
+    route_frames(self, i);
+
+    // (io_uring) start reading again, unless what was held back already
+    // throttled the user again
+    if (self->use_uring && user->taken == 1 && !user->closing && !user->throttled && !user->receiving) {
+        start_receiving(self, i);
+    }
+}
+
+// takes a token for local user i's next message
+// (ret: 1 let it through, 0 hold it back, -1 drop it, -2 the user was disconnected)
+int admit_message(struct shard *self, int i) {
+    if (!rate_limiting) {
+        return 1;
+    }
+
+    struct user *user = &self->user_list.users[i];
+    uint64_t now = rate_limit_now();
+    uint64_t retry_at = rate_limit_take(&user_limit, &user->rate_full_at, now);
+
+    if (retry_at != 0) {
+        if (rate_limit_take(&strike_limit, &user->strikes_full_at, now) != 0) {
+            disconnect_flooder(self, i);
+            return -2;
+        }
+    }
+    else if ((retry_at = rate_limit_take_shared(&global_limit, &rate_state->global_full_at, now)) != 0) {
+        // the server as a whole is over its limit, which is nobody's fault in particular
+        rate_limit_refund(&user_limit, &user->rate_full_at);
+    }
+
+    if (retry_at == 0) {
+        return 1;
+    }
+
+    if (rate_drop) {
+        __atomic_fetch_add(&rate_state->stats.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    __atomic_fetch_add(&rate_state->stats.delayed, 1, __ATOMIC_RELAXED);
+    throttle_user(self, i, retry_at);
+    return 0;
+}
+
+// copies the rate limiting counters (summed across every shard) into stats
+void shards_get_rate_limit_stats(struct rate_limit_stats *stats) {
+    stats->delayed = __atomic_load_n(&rate_state->stats.delayed, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&rate_state->stats.dropped, __ATOMIC_RELAXED);
+    stats->disconnected = __atomic_load_n(&rate_state->stats.disconnected, __ATOMIC_RELAXED);
+}
+
+// copies the slow consumer counters (summed across every shard) into stats
+void shards_get_slow_consumer_stats(struct slow_consumer_stats *stats) {
+    stats->dropped = __atomic_load_n(&slow_stats->dropped, __ATOMIC_RELAXED);
+    stats->disconnected = __atomic_load_n(&slow_stats->disconnected, __ATOMIC_RELAXED);
+}
+
+
+
+//
+// TIMER function(s)
+// every shard keeps its timers on a hierarchical timing wheel (see
+// timer_wheel.h), so arming and cancelling one costs the same however many
+// users there are, and the shard only wakes up when one is due.
+//
+// a user's heartbeat timer is not moved every time they send something;
+// it only notes when they were last heard from, and the timer works out
+// what is due (if anything) when it goes off.
+//
+
+// returns the current tick
+uint64_t current_tick(void) {
+    return rate_limit_now() / (TIMER_TICK_MS * 1000000ull);
+}
+
+// notes that local user i was just heard from
+void heard_from_user(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    user->last_heard = self->timers.now;
+    user->pinged = 0;
+}
+
+// schedules local user i's heartbeat timer for the next time they will have been quiet for too long
+void schedule_heartbeat(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    uint64_t due = 0;
+
+    if (idle_ticks > 0) {
+        due = user->last_heard + idle_ticks;
+    }
+    if (ping_ticks > 0 && !user->pinged && (due == 0 || user->last_heard + ping_ticks < due)) {
+        due = user->last_heard + ping_ticks;
+    }
+
+    if (due != 0) {
+        timer_wheel_schedule(&self->timers, USER_TIMER(i, TIMER_HEARTBEAT), due);
+    }
+}
+
+// pings local user i if they have been quiet a while, or disconnects them if
+// they have been quiet too long
+void check_heartbeat(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    if (user->taken != 1 || user->closing) {
+        return;
+    }
+
+    uint64_t quiet = self->timers.now - user->last_heard;
+    if (idle_ticks > 0 && quiet >= idle_ticks) {
+        disconnect_user(self, i, "timed out");
+        return;
+    }
+
+    if (ping_ticks > 0 && !user->pinged && quiet >= ping_ticks) {
+        struct message *message = message_format("/ping");
+        if (message != NULL) {
+            send_to_user(self, i, message);
+            message_unref(message);
+        }
+        user->pinged = 1;
+    }
+
+    schedule_heartbeat(self, i);
+}
+
+// handles the timer that went off
+void expire_timer(void *context, int id) {
+    struct shard *self = context;
+    int i = id / TIMERS_PER_USER;
+
+    if (id % TIMERS_PER_USER == TIMER_HEARTBEAT) {
+        check_heartbeat(self, i);
+    }
+    else if (id % TIMERS_PER_USER == TIMER_RESUME) {
+        resume_user(self, i);
+    }
+    else if (id % TIMERS_PER_USER == TIMER_CATCHUP) {
+        continue_catchup(self, i);
+    }
+    else {
+        expire_handshake(self, i);
+    }
+}
+
+// handles every timer that is due
+void run_timers(struct shard *self) {
+    timer_wheel_advance(&self->timers, current_tick(), expire_timer, self);
+}
+
+// returns how long (in milliseconds) until the next timer is due (or -1 if there are none)
+int next_timer_ms(struct shard *self) {
+    int64_t ticks = timer_wheel_next(&self->timers);
+    if (ticks < 0) {
+        return -1;
+    }
+
+    uint64_t due_ns = (self->timers.now + ticks) * TIMER_TICK_MS * 1000000ull;
+    uint64_t now = rate_limit_now();
+    return due_ns > now ? (int)((due_ns - now + 999999) / 1000000) : 0;
+}
+
+
+
+//
+// EVENT_LOOP function(s)
+// each shard owns its client sockets directly and multiplexes them with epoll,
+// so it only wakes up when a socket actually has something to say
+//
+
+// (io_uring) frees the slot of local user i, once they are closing and the
+// kernel is done with them
+void release_user_if_idle(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    if (user->closing && user->pending_ops == 0) {
+        metrics_add(&self->metrics->queued_bytes, -(uint64_t)user->outbound.bytes);
+        user_list_remove_user(&self->user_list, i);
+    }
+}
+
+// (io_uring) starts receiving everything local user i sends
+void start_receiving(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    uring_prep_recv_multishot(uring_get_sqe(&self->ring), user->socket_fd, URING_BUFFER_GROUP,
+        URING_DATA(URING_RECV, i));
+    user->pending_ops++;
+    user->receiving = 1;
+}
+
+// removes the local user i from the shard and the directory
+void remove_user(struct shard *self, int i) {
+    char username[MAX_USERNAME_LEN + 1];
+    strcpy(username, self->user_list.users[i].username);
+
+    while (self->user_list.users[i].num_rooms > 0) {
+        leave_room(self, i, self->user_list.users[i].num_rooms - 1);
+    }
+
+    directory_remove(directory, username);
+    if (clustered) {
+        cluster_announce_leave(&cluster, username);
+    }
+
+    timer_wheel_cancel(&self->timers, USER_TIMER(i, TIMER_HEARTBEAT));
+    timer_wheel_cancel(&self->timers, USER_TIMER(i, TIMER_RESUME));
+    timer_wheel_cancel(&self->timers, USER_TIMER(i, TIMER_CATCHUP));
+    metrics_add(&self->metrics->leaves, 1);
+
+    if (self->use_uring) {
+        // the kernel may still be using the user's socket and outbound queue,
+        // so only give up the slot once their last request completes
+        self->user_list.users[i].closing = 1;
+        shutdown(self->user_list.users[i].socket_fd, SHUT_RDWR);
+        release_user_if_idle(self, i);
+    }
+    else {
+        metrics_add(&self->metrics->queued_bytes, -(uint64_t)self->user_list.users[i].outbound.bytes);
+        user_list_remove_user(&self->user_list, i);
+    }
+
+    // notify all users that this user has left
+    notify_user_left(self, username);
+}
+
+// removes local user i, saying why
+void disconnect_user(struct shard *self, int i, const char *reason) {
+    printf("user %s disconnected (%s)\n", self->user_list.users[i].username, reason);
+    remove_user(self, i);
+}
+
+// frees handshake h's slot, closing its socket unless it was handed over to a
+// user (and giving back the username a join held while its claim was decided)
+void end_handshake(struct shard *self, int h, int handed_over) {
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    if (handshake->claiming) {
+        directory_remove_from_shard(directory, handshake->username, self->id);
+    }
+
+    timer_wheel_cancel(&self->timers, HANDSHAKE_TIMER(h));
+    handshake_list_remove(&self->handshakes, h, handed_over);
+    metrics_add(&self->metrics->handshakes, -(uint64_t)1);
+}
+
+// responds to handshake h's join request, and gives up the handshake
+// note: the response is written at most once, and never waited on (a fresh
+// socket has room for a response this short, and a peer that doesn't read it
+// mustn't hold up the shard)
+void refuse_join(struct shard *self, int h, const char *response) {
+    char frame[FRAME_HEADER_LEN + BUFFER_SIZE];
+    size_t len = strnlen(response, BUFFER_SIZE);
+    frame_put_header(frame, len);
+    memcpy(frame + FRAME_HEADER_LEN, response, len);
+
+    if (send(self->handshakes.handshakes[h].socket_fd, frame, FRAME_HEADER_LEN + len,
+        MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        perror("write() failed while responding to join request");
+    }
+    metrics_add(&self->metrics->joins_refused, 1);
+    end_handshake(self, h, 0);
+}
+
+// gives up the username claimed by a join that then failed
+void release_username(const char *username) {
+    directory_remove(directory, username);
+    if (clustered) {
+        cluster_release(&cluster, username);
+    }
+}
+
+// completes handshake h's join, once its username's claim is decided (claimed
+// is 1 claimed, -1 username taken, 0 the owner could not be reached), adding
+// the user to the userlist (and the epoll set) if it succeeds
+void finish_join(struct shard *self, int h, int claimed) {
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    if (claimed != 1) {
+        refuse_join(self, h, claimed < 0 ? "/joinresponse username_taken" : "/joinresponse unavailable");
+        return;
+    }
+
+    // (another join may have taken the last free slot while this one waited)
+    int index_to_add = user_list_get_free_index(&self->user_list);
+    if (index_to_add < 0) {
+        if (clustered) {
+            cluster_release(&cluster, handshake->username);
+        }
+        refuse_join(self, h, "/joinresponse server_full");
+        return;
+    }
+
+    // hand the socket (and the decoder, holding whatever followed the /join)
+    // over to the user
+    char username[MAX_USERNAME_LEN + 1];
+    strcpy(username, handshake->username);
+    int binary = handshake->binary;
+    int incoming_fd = handshake->socket_fd;
+    struct frame_decoder decoder = handshake->decoder;
+    uint64_t accepted_at = handshake->accepted_at;
+    handshake->claiming = 0;
+    end_handshake(self, h, 1);
+
+    // from now on the socket is only ever touched when epoll says it is ready
+    // (or by the kernel itself, with io_uring)
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = index_to_add;
+
+    if (!self->use_uring && epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, incoming_fd, &ev) < 0) {
+        perror("failed to register user socket");
+        release_username(username);
+        close(incoming_fd);
+        frame_decoder_free(&decoder);
+        metrics_add(&self->metrics->joins_refused, 1);
+        return;
+    }
+
+    directory_update(directory, username, self->id, index_to_add);
+    user_list_add_user(&self->user_list, index_to_add, username, incoming_fd, &decoder);
+    metrics_add(&self->metrics->joins, 1);
+    histogram_record(&self->metrics->handshake_time, (rate_limit_now() - accepted_at) / 1000, 1);
+
+    // notify the user that they are connected succesfully
+    // note: this is queued ahead of everything else for them, and in text,
+    // since they only switch to binary once they have read it
+    self->user_list.users[index_to_add].binary = 0;
+    struct message *response = message_format("%s",
+        binary ? "/joinresponse ok " PROTOCOL_BINARY_VERSION : "/joinresponse ok");
+    if (response != NULL) {
+        send_to_user(self, index_to_add, response);
+        message_unref(response);
+    }
+    self->user_list.users[index_to_add].binary = binary;
+    heard_from_user(self, index_to_add);
+    schedule_heartbeat(self, index_to_add);
+    if (self->use_uring) {
+        start_receiving(self, index_to_add);
+    }
+
+    // send the new user everyone who is already here, then tell everyone else
+    // about the new user (from here on, everyone keeps their own list up to date)
+    send_user_list(self, index_to_add);
+    notify_user_joined(self, index_to_add);
+    if (clustered) {
+        cluster_announce_join(&cluster, username);
+    }
+
+    // everyone starts out in the default room
+    if (join_room(self, index_to_add, DEFAULT_ROOM) == 1) {
+        send_room_join_response(self, index_to_add, DEFAULT_ROOM, "ok");
+    }
+
+    // then catch them up on what was said before they arrived
+    send_history(self, index_to_add, DEFAULT_ROOM, 1);
+}
+
+// starts the join of handshake h, whose /join frame is join: checks the
+// username and claims it, then completes the join (see finish_join()) once
+// the claim is decided, which in a cluster may take another node's answer
+void accept_user(struct shard *self, int h, char *join) {
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    int err;
+
+    // join is of format: /join <username> [<protocol versions>]
+    // newer clients follow their username with the (comma separated) protocol
+    // versions they speak, and get the binary protocol if it is among them
+    char *name = join + strlen("/join") + 1;
+    char *versions = strchr(name, ' ');
+    handshake->binary = 0;
+    if (versions != NULL) {
+        *versions++ = '\0';
+        char *saveptr;
+        for (char *version = strtok_r(versions, ",", &saveptr); version != NULL;
+            version = strtok_r(NULL, ",", &saveptr)) {
+            handshake->binary |= strcmp(version, PROTOCOL_BINARY_VERSION) == 0;
+        }
+    }
+
+    // the directory stores usernames in fixed size buffers, so refuse anything
+    // the client itself would have refused
+    if (!is_valid_username(name, &err)) {
+        refuse_join(self, h, "/joinresponse invalid_username");
+        return;
+    }
+    strcpy(handshake->username, name);
+
+    // the username is held (but not yet filed under a user) until its claim is decided
+    int added = user_list_get_free_index(&self->user_list) < 0 ? -2 :
+        directory_add(directory, handshake->username, self->id, DIRECTORY_PENDING);
+
+    if (added == -1) {
+        refuse_join(self, h, "/joinresponse username_taken");
+        return;
+    }
+
+    if (added == -2) {
+        refuse_join(self, h, "/joinresponse server_full");
+        return;
+    }
+    handshake->claiming = 1;
+
+    // in a cluster, the username must also be free on every other node
+    int claimed = clustered ? cluster_claim(&cluster, handshake->username, self->id, h, &handshake->ticket) : 1;
+    if (claimed != 0) {
+        finish_join(self, h, claimed == 1);
+        return;
+    }
+
+    // the owner's answer arrives in the mailbox (see claim_decided()), and the
+    // socket is left alone until then (epoll only reports errors on it now)
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.u64 = HANDSHAKE_TAG(h);
+
+    if (!self->use_uring && epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, handshake->socket_fd, &ev) < 0) {
+        perror("failed to register user socket");
+        metrics_add(&self->metrics->joins_refused, 1);
+        end_handshake(self, h, 0);
+    }
+}
+
+// finishes the join in handshake slot h once the link thread posts the
+// verdict on its claim ("<ticket> <result>"), unless it was given up on
+void claim_decided(struct shard *self, int h, const char *username, struct message *verdict) {
+    unsigned ticket;
+    int result;
+    if (sscanf(verdict->data + FRAME_HEADER_LEN, "%u %d", &ticket, &result) != 2) {
+        return;
+    }
+
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    if (handshake->taken == 1 && handshake->claiming && handshake->ticket == ticket &&
+        strcmp(handshake->username, username) == 0) {
+        finish_join(self, h, result);
+        return;
+    }
+
+    // the owner granted a username no join here is waiting on any more, so
+    // hand it back (unless another join on this node holds it by now, since
+    // the owner grants a node the same username as often as it asks)
+    if (result == 1 && directory_add(directory, username, self->id, DIRECTORY_PENDING) == 1) {
+        cluster_release(&cluster, username);
+        directory_remove(directory, username);
+    }
+}
+
+// reads whatever handshake h's socket has to say, and starts the join once
+// its /join frame is in (or waits for more)
+void continue_handshake(struct shard *self, int h) {
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    char *join;
+    size_t join_len;
+    int ret;
+
+    // a join waiting on its claim isn't read from, so its socket is only
+    // reported if something went wrong with it
+    if (handshake->claiming) {
+        printf("user's connection failed while their join was decided\n");
+        metrics_add(&self->metrics->joins_refused, 1);
+        end_handshake(self, h, 0);
+        return;
+    }
+
+    while (1) {
+        // (a connection that hasn't joined yet only ever gets a /join's worth of memory)
+        size_t pending;
+        if (frame_decoder_peek_len(&handshake->decoder, &pending) && pending > MAX_JOIN_LEN) {
+            printf("user sent a handshake frame of %zu bytes, connection refused\n", pending);
+            metrics_add(&self->metrics->joins_refused, 1);
+            end_handshake(self, h, 0);
+            return;
+        }
+
+        if ((ret = frame_decoder_next(&handshake->decoder, &join, &join_len)) != 0) {
+            break;
+        }
+
+        ssize_t nread = frame_decoder_read(&handshake->decoder, handshake->socket_fd);
+        if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // (with io_uring, only once the kernel says there is more)
+            if (self->use_uring) {
+                uring_prep_poll(uring_get_sqe(&self->ring), handshake->socket_fd, URING_DATA(URING_HANDSHAKE, h));
+                handshake->polling = 1;
+            }
+            return;
+        }
+
+        if (nread <= 0) {
+            if (nread < 0) {
+                perror("read() failed");
+            }
+            end_handshake(self, h, 0);
+            return;
+        }
+    }
+
+    if (ret < 0 || strncmp(join, "/join ", strlen("/join ")) != 0) {
+        printf("user did not send /join command as expected\n");
+        metrics_add(&self->metrics->joins_refused, 1);
+        end_handshake(self, h, 0);
+        return;
+    }
+
+    accept_user(self, h, join);
+}
+
+// starts the /join handshake on a freshly accepted socket, which the event
+// loop then reads from like any other until the /join is in
+void start_handshake(struct shard *self, int incoming_fd) {
+    // past the cap, a connection is refused outright, so a flood of
+    // connections that never join can't hold up the ones that do for long
+    metrics_add(&self->metrics->accepted, 1);
+    int h = handshake_list_add(&self->handshakes, incoming_fd);
+    if (h < 0) {
+        printf("too many handshakes in progress, connection refused\n");
+        metrics_add(&self->metrics->handshakes_refused, 1);
+        close(incoming_fd);
+        return;
+    }
+    self->handshakes.handshakes[h].accepted_at = rate_limit_now();
+    metrics_add(&self->metrics->handshakes, 1);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = HANDSHAKE_TAG(h);
+
+    if (fcntl(incoming_fd, F_SETFL, O_NONBLOCK) < 0 ||
+        (!self->use_uring && epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, incoming_fd, &ev) < 0)) {
+        perror("failed to register user socket");
+        end_handshake(self, h, 0);
+        return;
+    }
+
+    if (handshake_ticks > 0) {
+        timer_wheel_schedule(&self->timers, HANDSHAKE_TIMER(h), self->timers.now + handshake_ticks);
+    }
+
+    // the /join has often arrived along with the connection
+    continue_handshake(self, h);
+}
+
+// gives up on handshake h, once it has had as long as it gets to send its /join
+void expire_handshake(struct shard *self, int h) {
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    if (handshake->taken != 1 || handshake->closing) {
+        return;
+    }
+
+    printf(handshake->claiming ? "user's join was not decided in time\n" : "user did not send /join in time\n");
+    metrics_add(&self->metrics->handshakes_timed_out, 1);
+
+    // (io_uring) the kernel may still be polling the socket, so wake the poll
+    // up, and only give up the slot once it completes
+    if (handshake->polling) {
+        handshake->closing = 1;
+        shutdown(handshake->socket_fd, SHUT_RDWR);
+        return;
+    }
+    end_handshake(self, h, 0);
+}
+
+// copies the (not nul-terminated) field into out, which holds up to max characters
+// (ret: 1 success, 0 the field is empty or too long)
+int copy_field(char *out, size_t max, const char *field, size_t len) {
+    if (len == 0 || len > max) {
+        return 0;
+    }
+    memcpy(out, field, len);
+    out[len] = '\0';
+    return 1;
+}
+
+// passes the trace of a packet (if it has one) on to the message it was
+// reformatted into, stamped with when the server read it and is fanning it out
+// note: a trace only reaches binary users, and users on other workers (or
+// nodes) are sent the message without it
+void trace_message(struct shard *self, struct message *outgoing, const struct protocol_packet *packet) {
+    if (!(packet->flags & PROTOCOL_FLAG_TRACE)) {
+        return;
+    }
+
+    // (the read was timed on the monotonic clock, so carry it over)
+    struct protocol_trace trace = packet->trace;
+    trace.server_sent = protocol_trace_now();
+    trace.server_received = trace.server_sent - (rate_limit_now() - self->read_at);
+    message_trace(outgoing, &trace);
+}
+
+// sends local user i's whisper to its recipient
+void route_whisper(struct shard *self, int i, const struct protocol_packet *packet) {
+    char recipient[MAX_USERNAME_LEN + 1];
+    if (!copy_field(recipient, MAX_USERNAME_LEN, packet->target, packet->target_len)) {
+        return;
+    }
+
+    int recipient_shard, recipient_index;
+
+    // note: the client does not allow whispering to non-
+    // connected users, so this check is unnecessary... in theory...
+    if (directory_lookup(directory, recipient, &recipient_shard, &recipient_index)) {
+        // reformat the message to send it out
+        struct message *outgoing = message_format("/whispered %s %.*s", self->user_list.users[i].username,
+            (int)packet->payload_len, packet->payload);
+        if (outgoing == NULL) {
+            return;
+        }
+        trace_message(self, outgoing, packet);
+
+        if (recipient_shard >= CLUSTER_SHARD_BASE) {
+            cluster_relay(&cluster, recipient_shard - CLUSTER_SHARD_BASE, MAIL_WHISPER, recipient, outgoing);
+        }
+        else if (recipient_shard != self->id) {
+            mailbox_post(&shards[recipient_shard].mailbox, self->id, MAIL_WHISPER, recipient_index,
+                recipient, outgoing);
+        }
+        else {
+            send_to_user(self, recipient_index, outgoing);
+        }
+        message_unref(outgoing);
+    }
+}
+
+// sends local user i's broadcast to everyone else
+void route_broadcast(struct shard *self, int i, const struct protocol_packet *packet) {
+    // reformat the message to send it out (once, for every recipient)
+    struct message *outgoing = message_format("/broadcasted %s %.*s", self->user_list.users[i].username,
+        (int)packet->payload_len, packet->payload);
+    if (outgoing == NULL) {
+        return;
+    }
+    trace_message(self, outgoing, packet);
+
+    deliver_everywhere(self, i, outgoing);
+    if (clustered) {
+        cluster_relay(&cluster, -1, MAIL_BROADCAST, NULL, outgoing);
+    }
+    remember_message(HISTORY_BROADCAST, outgoing);
+    message_unref(outgoing);
+}
+
+// sends local user i's message to the other members of the room
+void route_roomcast(struct shard *self, int i, const struct protocol_packet *packet) {
+    char room[MAX_ROOM_NAME_LEN + 1];
+    if (!copy_field(room, MAX_ROOM_NAME_LEN, packet->target, packet->target_len)) {
+        return;
+    }
+
+    // only members may send to a room
+    if (find_subscription(self, i, room) < 0) {
+        return;
+    }
+
+    struct message *outgoing = message_format("/roomcasted %s %s %.*s", room, self->user_list.users[i].username,
+        (int)packet->payload_len, packet->payload);
+    if (outgoing == NULL) {
+        return;
+    }
+    trace_message(self, outgoing, packet);
+
+    deliver_room(self, room, i, outgoing);
+    if (clustered) {
+        cluster_relay(&cluster, -1, MAIL_ROOMCAST, room, outgoing);
+    }
+    remember_message(room, outgoing);
+    message_unref(outgoing);
+}
+
+// adds local user i to the room
+void route_roomjoin(struct shard *self, int i, const struct protocol_packet *packet) {
+    char room[MAX_ROOM_NAME_LEN + 1];
+    int err;
+
+    if (!copy_field(room, MAX_ROOM_NAME_LEN, packet->target, packet->target_len) ||
+        !is_valid_room_name(room, &err)) {
+        send_room_join_response(self, i, "-", "invalid_room_name");
+        return;
+    }
+
+    int joined = join_room(self, i, room);
+    send_room_join_response(self, i, room, joined > 0 ? "ok" : joined == -1 ? "too_many_rooms" : "failed");
+
+    // catch new members up on what was said in the room before they arrived
+    if (joined == 1) {
+        send_history(self, i, room, 0);
+    }
+}
+
+// removes local user i from the room
+void route_roomleave(struct shard *self, int i, const struct protocol_packet *packet) {
+    char room[MAX_ROOM_NAME_LEN + 1];
+    if (!copy_field(room, MAX_ROOM_NAME_LEN, packet->target, packet->target_len)) {
+        return;
+    }
+
+    int s = find_subscription(self, i, room);
+    if (s >= 0) {
+        leave_room(self, i, s);
+    }
+}
+
+// sends local user i the list of rooms
+void route_roomlist(struct shard *self, int i, const struct protocol_packet *packet) {
+    send_room_list(self, i);
+}
+
+// scans the next step of local user i's /catchup, and schedules the one after
+// it for the next tick, until the catchup has sent or scanned all it may (or
+// reached the end of the log)
+void continue_catchup(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    if (user->taken != 1 || user->closing || !user->catching_up) {
+        return;
+    }
+
+    size_t step = user->catchup_budget < CATCHUP_STEP_BYTES ? user->catchup_budget : CATCHUP_STEP_BYTES;
+    size_t left = step;
+    struct catchup catchup = {self, i, user->catchup_bytes};
+    int more = message_log_replay_from(&message_log, &user->catchup_at, user->catchup_since, &left,
+        send_catchup, &catchup);
+    user->catchup_budget -= step - left;
+    user->catchup_bytes = catchup.bytes;
+
+    if (!more || user->catchup_budget == 0 ||
+        !timer_wheel_schedule(&self->timers, USER_TIMER(i, TIMER_CATCHUP), self->timers.now + 1)) {
+        user->catching_up = 0;
+    }
+}
+
+// replays the logged broadcasts (and messages in local user i's rooms) sent
+// since the given time, in milliseconds since the epoch
+// note: the log is read a step at a time (see continue_catchup()), and a new
+// /catchup replaces one still in progress
+void route_catchup(struct shard *self, int i, const struct protocol_packet *packet) {
+    if (!logging) {
+        return;
+    }
+
+    // note: the payload ends the frame, so it is nul-terminated
+    struct user *user = &self->user_list.users[i];
+    user->catchup_since = strtoull(packet->payload, NULL, 10);
+    message_log_seek(&message_log, user->catchup_since, &user->catchup_at);
+    user->catchup_budget = MAX_CATCHUP_SCAN_BYTES;
+    user->catchup_bytes = 0;
+    user->catching_up = 1;
+
+    timer_wheel_cancel(&self->timers, USER_TIMER(i, TIMER_CATCHUP));
+    continue_catchup(self, i);
+}
+
+// the handler for each command a user may send (anything else is ignored)
+static void (*const route_handlers[OP_COUNT])(struct shard *self, int i, const struct protocol_packet *packet) = {
+    [OP_WHISPER] = route_whisper,
+    [OP_BROADCAST] = route_broadcast,
+    [OP_ROOMCAST] = route_roomcast,
+    [OP_ROOMJOIN] = route_roomjoin,
+    [OP_ROOMLEAVE] = route_roomleave,
+    [OP_ROOMLIST] = route_roomlist,
+    [OP_CATCHUP] = route_catchup,
+    // add other commands here, if any
+};
+
+// decodes the frame sent by local user i (in whichever protocol they speak)
+// and hands it to the handler for its command
+void route_message(struct shard *self, int i, const char *payload, size_t len) {
+    struct protocol_packet packet;
+    if (!protocol_read(self->user_list.users[i].binary, payload, len, &packet)) {
+        printf("user %s sent a malformed packet\n", self->user_list.users[i].username);
+        return;
+    }
+
+    metrics_add(&self->metrics->received[packet.opcode], 1);
+    note_routed(self);
+    if (route_handlers[packet.opcode] != NULL) {
+        route_handlers[packet.opcode](self, i, &packet);
+    }
+}
+
+// reads everything pending from local user i and routes every complete message
+void read_from_user(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+    ssize_t nread;
+
+    if ((nread = frame_decoder_read(&user->decoder, user->socket_fd)) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        perror("read() failed");
+    }
+
+    if (nread <= 0) {
+        // the connection to this user was lost, so remove them
+        remove_user(self, i);
+        return;
+    }
+
+    self->read_at = rate_limit_now();
+    metrics_add(&self->metrics->bytes_received, nread);
+    heard_from_user(self, i);
+    route_frames(self, i);
+}
+
+// routes every complete message buffered for local user i (that the rate limit lets through)
+void route_frames(struct shard *self, int i) {
+    struct user *user = &self->user_list.users[i];
+
+    // a throttled user's messages wait in the decoder, up to a point
+    if (user->throttled) {
+        size_t limit = self->use_uring ? MAX_THROTTLED_URING_BYTES : MAX_THROTTLED_BYTES;
+        if (user->decoder.end - user->decoder.start > limit) {
+            disconnect_flooder(self, i);
+        }
+        return;
+    }
+
+    // a single read may hold several messages, or only part of one
+    char *payload;
+    size_t len;
+    int ret;
+    while ((ret = frame_decoder_ready(&user->decoder)) == 1) {
+        int admitted = admit_message(self, i);
+        if (admitted == 0 || admitted == -2) {
+            return;
+        }
+
+        frame_decoder_next(&user->decoder, &payload, &len);
+        if (admitted == 1) {
+            route_message(self, i, payload, len);
+        }
+    }
+
+    if (ret < 0) {
+        printf("user %s sent an oversized frame\n", user->username);
+        remove_user(self, i);
+    }
+}
+
+// waits for incoming connections, messages and mail (with epoll), forever
+void *shard_run_epoll_loop(struct shard *self) {
+    while (1) {
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int nevents;
+
+        // sleep until a socket is ready (or a timer is due)
+        if ((nevents = epoll_wait(self->epoll_fd, events, MAX_EPOLL_EVENTS, next_timer_ms(self))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait() failed");
+            exit(-1);
+        }
+
+        run_timers(self);
+
+        // handle every ready socket, since framing keeps messages apart on the wire
+        for (int e = 0; e < nevents; e++) {
+            if (events[e].data.u64 == LISTENER_TAG) {
+                // accept every user that is trying to connect
+                int incoming_fd;
+                while ((incoming_fd = accept(self->listen_fd, NULL, NULL)) != -1) {
+                    start_handshake(self, incoming_fd);
+                }
+            }
+            else if (events[e].data.u64 == MAILBOX_TAG) {
+                deliver_mail(self);
+            }
+            else if (events[e].data.u64 >= HANDSHAKE_TAG_BASE) {
+                int h = (int)(uint32_t)events[e].data.u64;
+                if (self->handshakes.handshakes[h].taken == 1) {
+                    continue_handshake(self, h);
+                }
+            }
+            else {
+                int i = (int)events[e].data.u64;
+
+                if (self->user_list.users[i].taken == 1 && (events[e].events & EPOLLOUT)) {
+                    flush_user(self, i);
+                }
+                if (self->user_list.users[i].taken == 1 && (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    read_from_user(self, i);
+                }
+            }
+        }
+
+        // send out everything that was queued while handling the events
+        flush_dirty(self);
+    }
+
+    return NULL;
+}
+
+
+
+//
+// URING function(s)
+// with io_uring the kernel accepts, receives and sends on the shard's behalf,
+// and the shard only handles completions. every send queued during an
+// iteration (a whole fan-out) is handed over with the next wait, in a single
+// system call.
+//
+
+// handles a completed (or ongoing) multishot receive for local user i
+void handle_recv(struct shard *self, int i, int res, unsigned flags) {
+    struct user *user = &self->user_list.users[i];
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        int fed = res <= 0 || user->closing ||
+            frame_decoder_feed(&user->decoder, uring_buffer(&self->ring, bid), res);
+        uring_recycle_buffer(&self->ring, bid);
+
+        if (!fed) {
+            perror("frame_decoder_feed() failed");
+            remove_user(self, i);
+        }
+        else if (res > 0 && !user->closing) {
+            self->read_at = rate_limit_now();
+            metrics_add(&self->metrics->bytes_received, res);
+            heard_from_user(self, i);
+            route_frames(self, i);
+        }
+    }
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        user->pending_ops--;
+        user->receiving = 0;
+
+        if (!user->closing) {
+            if (res > 0 || res == -ENOBUFS || res == -ECANCELED) {
+                // the receive was only cut short (e.g. every buffer was in use, or
+                // it was cancelled since the user was throttled), so start over
+                // (for a throttled user, once resume_user() lets them through again)
+                if (!user->throttled) {
+                    start_receiving(self, i);
+                }
+            }
+            else {
+                // the connection to this user was lost, so remove them
+                remove_user(self, i);
+            }
+        }
+    }
+
+    release_user_if_idle(self, i);
+}
+
+// handles a completed send for local user i
+void handle_send(struct shard *self, int i, int res) {
+    struct user *user = &self->user_list.users[i];
+    user->sending = 0;
+    user->pending_ops--;
+
+    if (!user->closing) {
+        if (res < 0 && res != -EAGAIN && res != -EINTR) {
+            // the connection to this user was lost, so remove them
+            remove_user(self, i);
+        }
+        else {
+            // a short send leaves the rest queued, to go out with the next batch
+            outbound_queue_consume(&user->outbound, res > 0 ? res : 0);
+            note_sent(self, res > 0 ? res : 0);
+            check_caught_up(self, i);
+            if (user->outbound.count > 0) {
+                mark_dirty(self, i);
+            }
+        }
+    }
+
+    release_user_if_idle(self, i);
+}
+
+// handles a completed poll for handshake h's socket
+void handle_handshake_poll(struct shard *self, int h) {
+    struct handshake *handshake = &self->handshakes.handshakes[h];
+    handshake->polling = 0;
+
+    if (handshake->closing) {
+        end_handshake(self, h, 0);
+    }
+    else {
+        continue_handshake(self, h);
+    }
+}
+
+// waits for completions, forever
+void *shard_run_uring_loop(struct shard *self) {
+    while (1) {
+        // wake up in time for the next timer, unless a timeout that soon is already in flight
+        int timeout = next_timer_ms(self);
+        uint64_t due = self->timers.now + timer_wheel_next(&self->timers);
+        if (timeout >= 0 && (self->timer_due == 0 || due < self->timer_due)) {
+            self->timer.tv_sec = timeout / 1000;
+            self->timer.tv_nsec = (timeout % 1000) * 1000000;
+            uring_prep_timeout(uring_get_sqe(&self->ring), &self->timer, URING_DATA(URING_TIMER, (uint32_t)due));
+            self->timer_due = due;
+        }
+
+        // submit everything queued during the last iteration, and sleep until something completes
+        if (uring_submit(&self->ring, 1) < 0 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter() failed");
+            exit(-1);
+        }
+
+        run_timers(self);
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&self->ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&self->ring);
+
+            switch (URING_KIND(data)) {
+                case URING_ACCEPT:
+                    if (res >= 0) {
+                        start_handshake(self, res);
+                    }
+                    else {
+                        errno = -res;
+                        perror("accept() failed");
+                    }
+                    if (!(flags & IORING_CQE_F_MORE)) {
+                        uring_prep_accept_multishot(uring_get_sqe(&self->ring), self->listen_fd,
+                            URING_DATA(URING_ACCEPT, 0));
+                    }
+                    break;
+                case URING_MAILBOX:
+                    deliver_mail(self);
+                    if (!(flags & IORING_CQE_F_MORE)) {
+                        uring_prep_poll_multishot(uring_get_sqe(&self->ring), self->mailbox.event_fd,
+                            URING_DATA(URING_MAILBOX, 0));
+                    }
+                    break;
+                case URING_RECV:
+                    handle_recv(self, URING_INDEX(data), res, flags);
+                    break;
+                case URING_SEND:
+                    handle_send(self, URING_INDEX(data), res);
+                    break;
+                case URING_HANDSHAKE:
+                    handle_handshake_poll(self, URING_INDEX(data));
+                    break;
+                case URING_PROBE:
+                    if (flags & IORING_CQE_F_BUFFER) {
+                        uring_recycle_buffer(&self->ring, flags >> IORING_CQE_BUFFER_SHIFT);
+                    }
+                    break;
+                case URING_TIMER:
+                    // (only the latest timeout counts, the others just wake us up early)
+                    if ((uint32_t)self->timer_due == (uint32_t)URING_INDEX(data)) {
+                        self->timer_due = 0;
+                    }
+                    break;
+            }
+        }
+
+        // queue a send for everything that was queued while handling the completions
+        flush_dirty(self);
+    }
+
+    return NULL;
+}
+
+// sets up the shard's io_uring instance, making sure the kernel supports
+// multishot receives into provided buffers before committing to it
+// (ret: 1 success, 0 failure)
+int shard_initialize_uring(struct shard *self) {
+    if (!uring_initialize(&self->ring, URING_ENTRIES)) {
+        return 0;
+    }
+    if (!uring_register_buffers(&self->ring, URING_BUFFER_GROUP, URING_BUFFERS, FRAME_READ_CHUNK)) {
+        uring_free(&self->ring);
+        return 0;
+    }
+
+    // receive a single byte over a socket pair
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        perror("socketpair() failed");
+        uring_free(&self->ring);
+        return 0;
+    }
+
+    uring_prep_recv_multishot(uring_get_sqe(&self->ring), pair[0], URING_BUFFER_GROUP,
+        URING_DATA(URING_PROBE, 0));
+    int works = 0;
+    if (write(pair[1], "", 1) == 1 && uring_submit(&self->ring, 1) >= 0) {
+        struct io_uring_cqe *cqe = uring_peek_cqe(&self->ring);
+        works = cqe != NULL && cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER) &&
+            (cqe->flags & IORING_CQE_F_MORE);
+    }
+
+    // the probe's final completion is skipped over by the event loop
+    shutdown(pair[0], SHUT_RDWR);
+    close(pair[0]);
+    close(pair[1]);
+
+    if (!works) {
+        printf("io_uring does not support multishot receives\n");
+        uring_free(&self->ring);
+        return 0;
+    }
+
+    uring_prep_accept_multishot(uring_get_sqe(&self->ring), self->listen_fd, URING_DATA(URING_ACCEPT, 0));
+    uring_prep_poll_multishot(uring_get_sqe(&self->ring), self->mailbox.event_fd, URING_DATA(URING_MAILBOX, 0));
+    return 1;
+}
+
+// runs the shard's event loop, forever
+void *shard_run_loop(void *arg) {
+    struct shard *self = arg;
+    return self->use_uring ? shard_run_uring_loop(self) : shard_run_epoll_loop(self);
+}
+
+
+
+//
+// WORKER function(s)
+// with --workers, each shard runs in its own (pre-forked) process, so a crash
+// only takes down that shard's users. the supervisor (the original process)
+// cleans up after a worker that died and forks a replacement, which picks up
+// the same listening socket (and whatever connections are waiting on it).
+//
+
+// forks the worker that runs shard s
+void spawn_worker(int s) {
+    // don't let the worker inherit (and print again) anything still buffered
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork() failed");
+        return;
+    }
+
+    if (pid == 0) {
+        // don't outlive the supervisor
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() == 1) {
+            exit(-1);
+        }
+
+        if (!shard_initialize_events(&shards[s])) {
+            exit(-1);
+        }
+        shard_run_loop(&shards[s]);
+        exit(0);
+    }
+
+    worker_pids[s] = pid;
+}
+
+// releases everything the dead worker running shard s held in shared memory,
+// and tells every other shard its users have left
+void reclaim_worker(int s) {
+    mailbox_clear(&shards[s].mailbox);
+    room_registry_remove_shard_everywhere(room_registry, s);
+
+    // the worker's handshakes and queues went with it (and with the worker
+    // gone, the supervisor is the only writer of its counters)
+    struct shard_metrics *metrics = shards[s].metrics;
+    metrics_add(&metrics->handshakes, -metrics_read(&metrics->handshakes));
+    metrics_add(&metrics->queued_bytes, -metrics_read(&metrics->queued_bytes));
+
+    int count;
+    char *usernames = directory_remove_shard(directory, s, &count);
+    if (usernames == NULL) {
+        return;
+    }
+    metrics_add(&metrics->leaves, count);
+
+    for (int u = 0; u < count; u++) {
+        struct message *message = message_format("/left %s", usernames + u * (MAX_USERNAME_LEN + 1));
+        if (message == NULL) {
+            continue;
+        }
+
+        // the supervisor posts through the last ring of every mailbox
+        for (int t = 0; t < num_shards; t++) {
+            if (t != s) {
+                mailbox_post(&shards[t].mailbox, num_shards, MAIL_BROADCAST, -1, NULL, message);
+            }
+        }
+        message_unref(message);
+    }
+
+    free(usernames);
+}
+
+// forks every worker, then restarts any that die, forever
+void workers_run(void) {
+    if ((worker_pids = calloc(num_shards, sizeof(pid_t))) == NULL) {
+        perror("calloc() failed");
+        exit(-1);
+    }
+
+    for (int s = 0; s < num_shards; s++) {
+        spawn_worker(s);
+    }
+
+    while (1) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno != EINTR) {
+                perror("wait() failed");
+                exit(-1);
+            }
+            continue;
+        }
+
+        for (int s = 0; s < num_shards; s++) {
+            if (worker_pids[s] == pid) {
+                printf("worker %d (pid %d) died, restarting it\n", s, (int)pid);
+                reclaim_worker(s);
+                spawn_worker(s);
+                break;
+            }
+        }
+    }
+}
+
+
+
+//
+// CLUSTER function(s)
+// the link thread hands whatever arrives from the other nodes to the shards'
+// mailboxes, like any other mail
+//
+
+// posts the message to every shard, for all of its users
+void post_to_every_shard(int type, const char *name, struct message *message) {
+    for (int s = 0; s < num_shards; s++) {
+        mailbox_post(&shards[s].mailbox, 0, type, -1, name, message);
+    }
+}
+
+// delivers a message relayed from another node to its local recipients
+void deliver_relayed(int type, const char *name, struct message *message) {
+    if (type == MAIL_WHISPER) {
+        int shard, index;
+        if (directory_lookup(directory, name, &shard, &index) && shard < num_shards) {
+            mailbox_post(&shards[shard].mailbox, 0, MAIL_WHISPER, index, name, message);
+        }
+    }
+    else if (type == MAIL_ROOMCAST) {
+        // only the shards with members in the room are posted to
+        int member_shards[num_shards];
+        int count = room_registry_shards(room_registry, name, member_shards, num_shards);
+        for (int m = 0; m < count; m++) {
+            mailbox_post(&shards[member_shards[m]].mailbox, 0, MAIL_ROOMCAST, -1, name, message);
+        }
+        remember_message(name, message);
+    }
+    else {
+        post_to_every_shard(MAIL_BROADCAST, NULL, message);
+        remember_message(HISTORY_BROADCAST, message);
+    }
+}
+
+// hands the verdict on a join's claim to the shard whose handshake slot the join is in
+void post_claim_verdict(int shard, int slot, uint32_t ticket, const char *username, int result) {
+    struct message *verdict = message_format("%u %d", ticket, result);
+    int posted = 0;
+    if (verdict != NULL) {
+        posted = mailbox_post(&shards[shard].mailbox, 0, MAIL_CLAIMED, slot, username, verdict);
+        message_unref(verdict);
+    }
+
+    // (the join gives up once its deadline passes, so a granted username it
+    // never hears about is handed back here)
+    if (!posted && result == 1) {
+        cluster_release(&cluster, username);
+    }
+}
+
+// tells every local user that a user on another node joined
+void notify_remote_joined(const char *username) {
+    struct message *message = message_format("/joined %s", username);
+    if (message != NULL) {
+        post_to_every_shard(MAIL_BROADCAST, NULL, message);
+        message_unref(message);
+    }
+}
+
+// tells every local user that a user on another node left
+void notify_remote_left(const char *username) {
+    struct message *message = message_format("/left %s", username);
+    if (message != NULL) {
+        post_to_every_shard(MAIL_BROADCAST, NULL, message);
+        message_unref(message);
+    }
+}
+
+
+
+//
+// SHARD function(s)
+//
+
+// creates the shard's listening socket (bound with SO_REUSEPORT) and mailbox
+// (ret: 1 success, 0 failure)
+int shard_initialize(struct shard *self, int id, const struct server_config *config) {
+    self->id = id;
+    timer_wheel_initialize(&self->timers, current_tick());
+    if (!user_list_initialize(&self->user_list, config->max_users) ||
+        !handshake_list_initialize(&self->handshakes, config->max_handshakes) ||
+        !room_index_initialize(&self->rooms)) {
+        return 0;
+    }
+
+    // initialize the socket
+    // note: socket is non-blocking so we can drain every pending connection per wakeup
+    if ((self->listen_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+        perror("socket() failed");
+        return 0;
+    }
+
+    // set the socket to allow reuse of the same address, and to share the port
+    // with the listening sockets of the other shards
+    if (setsockopt(self->listen_fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEADDR) failed");
+        return 0;
+    }
+
+    if (setsockopt(self->listen_fd, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEPORT) failed");
+        return 0;
+    }
+
+    // create an address structure based on the port
+    // note: INADDR_ANY binds to any local ip address (typically there is only one,
+    // unless the host has multiple wifi cards, or wifi+ethernet)
+    struct sockaddr_in addr;
+    addr.sin_family = PF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(config->port);
+
+    // bind the socket to the address structure
+    if (bind(self->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("bind() failed");
+        return 0;
+    }
+
+    // set the socket to listen for incoming connections
+    if (listen(self->listen_fd, SOMAXCONN) < 0) {
+        perror("listen() failed");
+        return 0;
+    }
+
+    // with workers, every other shard (and the supervisor) gets its own ring in the mailbox
+    if (!mailbox_initialize(&self->mailbox, workers ? num_shards + 1 : 0)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+// creates the shard's epoll (or io_uring) instance
+// note: with workers, this happens in the worker (after the fork), so that
+// each worker owns its instance outright
+// (ret: 1 success, 0 failure)
+int shard_initialize_events(struct shard *self) {
+    // fall back to epoll if the kernel can't do what we need from io_uring
+    if (use_uring) {
+        if (shard_initialize_uring(self)) {
+            self->use_uring = 1;
+            return 1;
+        }
+        printf("shard %d: io_uring unavailable, falling back to epoll\n", self->id);
+    }
+
+    // create the epoll instance and register the listening socket and mailbox with it
+    if ((self->epoll_fd = epoll_create1(0)) < 0) {
+        perror("epoll_create1() failed");
+        return 0;
+    }
+
+    struct epoll_event listen_ev;
+    listen_ev.events = EPOLLIN;
+    listen_ev.data.u64 = LISTENER_TAG;
+
+    struct epoll_event mailbox_ev;
+    mailbox_ev.events = EPOLLIN;
+    mailbox_ev.data.u64 = MAILBOX_TAG;
+
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->listen_fd, &listen_ev) < 0 ||
+        epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->mailbox.event_fd, &mailbox_ev) < 0) {
+        perror("epoll_ctl() failed");
+        return 0;
+    }
+
+    return 1;
+}
+
+// creates one shard per thread (or worker) listening on the configured port,
+// sharing at most max_users users
+int shards_initialize(const struct server_config *config) {
+    workers = config->num_workers > 0;
+    use_uring = config->use_uring;
+
+    // a user who goes over their limit gets a strike, and gets one back every second
+    rate_limit_initialize(&user_limit, config->rate_limit, config->rate_burst);
+    rate_limit_initialize(&global_limit, config->global_rate_limit, config->global_rate_limit);
+    rate_limit_initialize(&strike_limit, config->max_strikes > 0 ? 1 : 0, config->max_strikes);
+    rate_limiting = rate_limit_enabled(&user_limit) || rate_limit_enabled(&global_limit);
+    rate_drop = config->rate_drop;
+
+    high_water = config->high_water;
+    low_water = config->low_water;
+    slow_policy = config->slow_policy;
+
+    ping_ticks = (uint64_t)config->ping_interval * 1000 / TIMER_TICK_MS;
+    idle_ticks = (uint64_t)config->idle_timeout * 1000 / TIMER_TICK_MS;
+    handshake_ticks = (uint64_t)config->handshake_timeout * 1000 / TIMER_TICK_MS;
+
+    // workers share the directory, room registry, history and rate limiting
+    // state (and counters) through memory mapped before they are forked
+    if ((directory = shared_alloc(sizeof(struct directory), workers)) == NULL ||
+        (room_registry = shared_alloc(sizeof(struct room_registry), workers)) == NULL ||
+        (history = shared_alloc(sizeof(struct history), workers)) == NULL ||
+        (rate_state = shared_alloc(sizeof(struct rate_limit_state), workers)) == NULL ||
+        (slow_stats = shared_alloc(sizeof(struct slow_consumer_stats), workers)) == NULL) {
+        return 0;
+    }
+
+    // in a cluster, the directory also holds the users on every other node
+    int num_nodes = config->cluster_nodes != NULL ? cluster_count_nodes(config->cluster_nodes) : 1;
+
+    if (!directory_initialize(directory, config->max_users * (num_nodes > 0 ? num_nodes : 1), workers) ||
+        !room_registry_initialize(room_registry, config->max_users * MAX_ROOMS_PER_USER, workers) ||
+        !history_initialize(history, config->history_bytes, workers)) {
+        return 0;
+    }
+
+    // pick up the history from before the restart
+    if (config->log_directory != NULL) {
+        if (!message_log_open(&message_log, config->log_directory, config->log_sync_ms)) {
+            return 0;
+        }
+        message_log_replay_tail(&message_log, config->history_bytes, restore_history, NULL);
+        logging = 1;
+    }
+
+    // join the cluster, relaying what arrives from the other nodes to the shards
+    if (config->cluster_nodes != NULL) {
+        struct cluster_handlers handlers = { deliver_relayed, notify_remote_joined, notify_remote_left,
+            post_claim_verdict };
+        if (!cluster_initialize(&cluster, config->cluster_nodes, config->node, directory, &handlers)) {
+            return 0;
+        }
+        clustered = 1;
+    }
+
+    num_shards = workers ? config->num_workers : config->num_threads;
+    if ((shards = calloc(num_shards, sizeof(struct shard))) == NULL) {
+        perror("calloc() failed");
+        return 0;
+    }
+
+    struct shard_metrics *metrics = shared_alloc(num_shards * sizeof(struct shard_metrics), workers);
+    if (metrics == NULL) {
+        return 0;
+    }
+
+    for (int s = 0; s < num_shards; s++) {
+        shards[s].metrics = &metrics[s];
+        if (!shard_initialize(&shards[s], s, config) || (!workers && !shard_initialize_events(&shards[s]))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// runs every shard, each on its own thread (shard 0 runs on the calling
+// thread), or each in its own worker process
+void shards_run(void) {
+    if (workers) {
+        workers_run();
+    }
+
+    if (clustered && !cluster_start(&cluster)) {
+        exit(-1);
+    }
+
+    for (int s = 1; s < num_shards; s++) {
+        if (pthread_create(&shards[s].thread, NULL, shard_run_loop, &shards[s]) != 0) {
+            perror("pthread_create() failed");
+            exit(-1);
+        }
+    }
+
+    shards[0].thread = pthread_self();
+    shard_run_loop(&shards[0]);
+}
@@ -0,0 +1,181 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cluster.h"
+#include "common.h"
+#include "directory.h"
+#include "handshake.h"
+#include "history.h"
+#include "mailbox.h"
+#include "message.h"
+#include "message_log.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "rate_limit.h"
+#include "rooms.h"
+#include "slab.h"
+#include "timer_wheel.h"
+#include "uring.h"
+#include "user_list.h"
+
+// a shard's counters (see metrics.h), which only the shard itself writes
+struct shard_metrics {
+    // connections accepted, and what became of their handshakes
+    uint64_t accepted;
+    uint64_t handshakes_refused;
+    uint64_t handshakes_timed_out;
+    uint64_t joins;
+    uint64_t joins_refused;
+    uint64_t leaves;
+
+    // traffic: messages received (by opcode), messages queued for a user,
+    // and bytes each way
+    uint64_t received[OP_COUNT];
+    uint64_t sent;
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+
+    // gauges: handshakes in progress, and bytes queued for users (but not yet sent)
+    uint64_t handshakes;
+    uint64_t queued_bytes;
+
+    // how long from a message being read to its fan-out being flushed, and
+    // from a connection being accepted to its join
+    struct histogram fanout_latency;
+    struct histogram handshake_time;
+};
+
+// a read that routed messages during the current iteration
+struct routed_read {
+    uint64_t read_at;
+    uint64_t count;
+};
+
+// a shard is one reactor thread. it owns its own listening socket (the kernel
+// spreads incoming connections across shards via SO_REUSEPORT), its own epoll
+// instance (or io_uring instance) and the sockets of the users it accepted.
+// messages for users that live on another shard are posted to that shard's
+// mailbox.
+//
+// shards can also run as pre-forked worker processes (one shard each) rather
+// than threads, sharing what they need to through shared memory.
+//
+// several servers can also be joined into a cluster (see cluster.h), in which
+// case messages for users on another node are handed to the link thread.
+
+struct shard {
+    int id;
+    int listen_fd;
+    int epoll_fd;
+    pthread_t thread;
+    struct mailbox mailbox;
+    struct user_list user_list;
+    struct handshake_list handshakes;
+    struct room_index rooms;
+    int *dirty;
+    int dirty_count;
+    int dirty_capacity;
+
+    // the shard's counters (in shared memory, with workers), when the
+    // latest read happened, and the reads that routed messages during this
+    // iteration (their latency is recorded once the fan-out is flushed)
+    struct shard_metrics *metrics;
+    uint64_t read_at;
+    struct routed_read *routed;
+    int routed_count;
+    int routed_capacity;
+
+    // the shard's timers, and (with io_uring) the tick the latest timeout in
+    // flight is for (or 0)
+    struct timer_wheel timers;
+    uint64_t timer_due;
+    struct __kernel_timespec timer;
+
+    // io_uring backend (if use_uring is set), and the send headers for the
+    // current iteration
+    int use_uring;
+    struct uring ring;
+    struct msghdr *send_msgs;
+    struct iovec *send_iovs;
+    int send_capacity;
+};
+
+// what happens to a user whose outbound queue goes past the high water mark:
+// they are disconnected, their oldest messages are dropped (down to the low
+// water mark), or new messages for them are dropped (until they are back
+// under the low water mark)
+#define SLOW_DISCONNECT 0
+#define SLOW_DROP_OLDEST 1
+#define SLOW_DROP_NEW 2
+
+// counters for what was done about users who fell behind
+struct slow_consumer_stats {
+    uint64_t dropped;        // messages dropped (oldest or new)
+    uint64_t disconnected;   // users disconnected
+};
+
+// the server's configuration, as given on the command line
+struct server_config {
+    int port;
+    int num_threads;
+    int num_workers;
+    int max_users;
+    size_t history_bytes;
+    const char *log_directory;
+    int log_sync_ms;
+    int use_uring;
+    const char *cluster_nodes;
+    int node;
+
+    // rate limiting (messages a second, and 0 for no limit)
+    int rate_limit;
+    int rate_burst;
+    int global_rate_limit;
+    int rate_drop;
+    int max_strikes;
+
+    // slow consumers (a high water mark of 0 lets outbound queues grow without bound)
+    size_t high_water;
+    size_t low_water;
+    int slow_policy;
+
+    // timeouts, in seconds (0 for none)
+    int ping_interval;
+    int idle_timeout;
+    int handshake_timeout;
+
+    // the most connections each shard lets be mid-handshake at once
+    int max_handshakes;
+};
+
+// creates one shard per thread (or worker) listening on the configured port,
+// sharing at most max_users users
+// (ret: 1 success, 0 failure)
+int shards_initialize(const struct server_config *config);
+
+// copies the rate limiting counters (summed across every shard) into stats
+void shards_get_rate_limit_stats(struct rate_limit_stats *stats);
+
+// copies the slow consumer counters (summed across every shard) into stats
+void shards_get_slow_consumer_stats(struct slow_consumer_stats *stats);
+
+// writes every shard's counters (summed), and the server's, in the prometheus text format
+void shards_write_metrics(FILE *out);
+
+// runs every shard, each on its own thread (shard 0 runs on the calling
+// thread), or each in its own worker process
+// note: never returns
+void shards_run(void);
+
+#endif  // SHARD_H_
@@ -0,0 +1,53 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "shared.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/mman.h>
+
+// returns size bytes of zeroed memory, shared with forked workers if shared is set
+void *shared_alloc(size_t size, int shared) {
+    if (!shared) {
+        void *memory = calloc(1, size);
+        if (memory == NULL) {
+            perror("calloc() failed in shared_alloc()");
+        }
+        return memory;
+    }
+
+    // anonymous mappings start zeroed
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("mmap() failed in shared_alloc()");
+        return NULL;
+    }
+    return memory;
+}
+
+// initialize the lock (so forked workers can share it, if shared is set)
+void shared_mutex_initialize(pthread_mutex_t *lock, int shared) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (shared) {
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    }
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// locks the lock, taking it over if its previous owner died holding it
+void shared_mutex_lock(pthread_mutex_t *lock) {
+    if (pthread_mutex_lock(lock) == EOWNERDEAD) {
+        // note: every critical section is short, so whatever the dead worker was
+        // in the middle of is the lesser evil compared to losing the lock for good
+        pthread_mutex_consistent(lock);
+    }
+}
@@ -0,0 +1,31 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef SHARED_H_
+#define SHARED_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+// memory and locks that can be shared between the server's worker processes
+// (--workers) as well as its threads. anything allocated as shared before the
+// workers are forked is mapped at the same address in every one of them.
+//
+// shared locks are robust: if a worker dies while holding one, the next
+// locker takes it over rather than deadlocking the others.
+
+// returns size bytes of zeroed memory, mapped so forked workers share it if
+// shared is set (or NULL)
+// note: the memory is never freed
+void *shared_alloc(size_t size, int shared);
+
+// initialize the lock (so forked workers can share it, if shared is set)
+void shared_mutex_initialize(pthread_mutex_t *lock, int shared);
+
+// locks the lock, taking it over if its previous owner died holding it
+void shared_mutex_lock(pthread_mutex_t *lock);
+
+#endif  // SHARED_H_
@@ -0,0 +1,204 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "slab.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// every block starts with this header. while the block is free it links it
+// into a free list, and while it is in use it remembers the block's class.
+union slab_header {
+    union slab_header *next;
+    struct {
+        int size_class;
+    } used;
+    max_align_t align;
+};
+
+// the class for blocks too large for any class
+#define OVERSIZE_CLASS -1
+
+// a thread's own free lists and counters
+struct slab_cache {
+    union slab_header *free[SLAB_NUM_CLASSES];
+    int count[SLAB_NUM_CLASSES];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t oversize;
+    struct slab_cache *next;
+};
+
+// the depot's free lists, every thread's cache (for the counters) and the
+// number of slabs carved so far, all guarded by a single lock
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static union slab_header *depot[SLAB_NUM_CLASSES];
+static struct slab_cache *caches = NULL;
+static uint64_t slabs = 0;
+
+static __thread struct slab_cache *cache = NULL;
+
+// returns the size of blocks of class c (header included)
+static size_t class_size(int c) {
+    return sizeof(union slab_header) + ((size_t)SLAB_MIN_SIZE << c);
+}
+
+// returns the smallest class that holds size bytes
+static int size_class(size_t size) {
+    int c = 0;
+    while (c < SLAB_NUM_CLASSES && ((size_t)SLAB_MIN_SIZE << c) < size) {
+        c++;
+    }
+    return c < SLAB_NUM_CLASSES ? c : OVERSIZE_CLASS;
+}
+
+// returns the calling thread's cache, creating it on first use (or NULL)
+static struct slab_cache *slab_cache(void) {
+    if (cache == NULL) {
+        if ((cache = calloc(1, sizeof(struct slab_cache))) == NULL) {
+            perror("calloc() failed in slab_cache()");
+            return NULL;
+        }
+
+        pthread_mutex_lock(&depot_lock);
+        cache->next = caches;
+        caches = cache;
+        pthread_mutex_unlock(&depot_lock);
+    }
+    return cache;
+}
+
+// moves up to a batch of blocks of class c from the depot (carving a new slab
+// if it is empty) into the thread's cache
+// note: the caller must hold the depot lock
+static void slab_refill(struct slab_cache *cache, int c) {
+    if (depot[c] == NULL) {
+        char *chunk = malloc(SLAB_CHUNK_SIZE);
+        if (chunk == NULL) {
+            perror("malloc() failed in slab_refill()");
+            return;
+        }
+        slabs++;
+
+        for (size_t offset = 0; offset + class_size(c) <= SLAB_CHUNK_SIZE; offset += class_size(c)) {
+            union slab_header *block = (union slab_header *)(chunk + offset);
+            block->next = depot[c];
+            depot[c] = block;
+        }
+    }
+
+    for (int b = 0; b < SLAB_BATCH && depot[c] != NULL; b++) {
+        union slab_header *block = depot[c];
+        depot[c] = block->next;
+
+        block->next = cache->free[c];
+        cache->free[c] = block;
+        cache->count[c]++;
+    }
+}
+
+// returns a block of at least size bytes (or NULL)
+void *slab_alloc(size_t size) {
+    int c = size_class(size);
+    struct slab_cache *cache = slab_cache();
+
+    if (c == OVERSIZE_CLASS || cache == NULL) {
+        union slab_header *block = malloc(sizeof(union slab_header) + size);
+        if (block == NULL) {
+            perror("malloc() failed in slab_alloc()");
+            return NULL;
+        }
+        block->used.size_class = OVERSIZE_CLASS;
+        if (cache != NULL) {
+            __atomic_store_n(&cache->oversize, cache->oversize + 1, __ATOMIC_RELAXED);
+        }
+        return block + 1;
+    }
+
+    if (cache->free[c] != NULL) {
+        __atomic_store_n(&cache->hits, cache->hits + 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_store_n(&cache->misses, cache->misses + 1, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&depot_lock);
+        slab_refill(cache, c);
+        pthread_mutex_unlock(&depot_lock);
+
+        if (cache->free[c] == NULL) {
+            return NULL;
+        }
+    }
+
+    union slab_header *block = cache->free[c];
+    cache->free[c] = block->next;
+    cache->count[c]--;
+
+    block->used.size_class = c;
+    return block + 1;
+}
+
+// returns the number of bytes the block can actually hold
+size_t slab_capacity(const void *block) {
+    const union slab_header *header = (const union slab_header *)block - 1;
+    // note: oversize blocks don't remember their size, so claim no slack
+    return header->used.size_class == OVERSIZE_CLASS ? 0 : (size_t)SLAB_MIN_SIZE << header->used.size_class;
+}
+
+// gives the block back to the pool
+void slab_free(void *block) {
+    if (block == NULL) {
+        return;
+    }
+
+    union slab_header *header = (union slab_header *)block - 1;
+    int c = header->used.size_class;
+    struct slab_cache *cache = slab_cache();
+
+    if (c == OVERSIZE_CLASS || cache == NULL) {
+        if (c == OVERSIZE_CLASS) {
+            free(header);
+        }
+        // (a block that can't be cached is simply leaked, rather than mixed up with malloc()'s)
+        return;
+    }
+
+    header->next = cache->free[c];
+    cache->free[c] = header;
+    cache->count[c]++;
+
+    // hand a batch back once the cache is full, so blocks freed by one thread
+    // (e.g. the last recipient's) can be reused by another
+    if (cache->count[c] > SLAB_CACHE_BLOCKS) {
+        pthread_mutex_lock(&depot_lock);
+        for (int b = 0; b < SLAB_BATCH; b++) {
+            union slab_header *moved = cache->free[c];
+            cache->free[c] = moved->next;
+            cache->count[c]--;
+
+            moved->next = depot[c];
+            depot[c] = moved;
+        }
+        pthread_mutex_unlock(&depot_lock);
+    }
+}
+
+// copies the counters into stats
+void slab_get_stats(struct slab_stats *stats) {
+    stats->hits = 0;
+    stats->misses = 0;
+    stats->oversize = 0;
+
+    pthread_mutex_lock(&depot_lock);
+    for (struct slab_cache *c = caches; c != NULL; c = c->next) {
+        stats->hits += __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&c->misses, __ATOMIC_RELAXED);
+        stats->oversize += __atomic_load_n(&c->oversize, __ATOMIC_RELAXED);
+    }
+    stats->slabs = slabs;
+    pthread_mutex_unlock(&depot_lock);
+}
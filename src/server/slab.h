@@ -0,0 +1,59 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a pooled allocator for message buffers. requests are rounded up to one of a
+// few fixed size classes, and freed blocks are kept (never zeroed) on the
+// freeing thread's own free lists, so the common case takes no lock at all.
+//
+// each thread's cache holds at most SLAB_CACHE_BLOCKS blocks of every class.
+// past that, a batch is handed back to a shared depot, which is also where an
+// empty cache refills from; only when the depot is empty too is a new slab of
+// blocks carved out of fresh memory. blocks are never given back to the
+// system, so the pool settles at the server's peak usage.
+//
+// requests larger than the largest class go straight to malloc().
+
+// the smallest and largest size classes (every power of two in between is one too)
+#define SLAB_MIN_SIZE 64
+#define SLAB_MAX_SIZE 4096
+#define SLAB_NUM_CLASSES 7
+
+// the most blocks of each class a thread keeps to itself, and how many move
+// between a thread and the depot at once
+#define SLAB_CACHE_BLOCKS 256
+#define SLAB_BATCH 32
+
+// the size of the chunks slabs are carved out of
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+// counters summed across every thread
+struct slab_stats {
+    uint64_t hits;       // allocations served from the thread's own cache
+    uint64_t misses;     // allocations that had to go to the depot (or carve a new slab)
+    uint64_t oversize;   // allocations too large for any class
+    uint64_t slabs;      // chunks carved into blocks so far
+};
+
+// returns a block of at least size bytes (or NULL)
+// note: the block is not zeroed
+void *slab_alloc(size_t size);
+
+// returns the number of bytes the block can actually hold
+size_t slab_capacity(const void *block);
+
+// gives the block back to the pool
+void slab_free(void *block);
+
+// copies the counters into stats
+void slab_get_stats(struct slab_stats *stats);
+
+#endif  // SLAB_H_
@@ -0,0 +1,207 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "timer_wheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// the number of ticks each slot on the level spans
+#define LEVEL_SPAN(level) ((uint64_t)1 << (TIMER_WHEEL_BITS * (level)))
+
+// initialize the wheel, starting at tick now
+void timer_wheel_initialize(struct timer_wheel *wheel, uint64_t now) {
+    wheel->now = now;
+    wheel->count = 0;
+    for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        for (int s = 0; s < TIMER_WHEEL_SLOTS; s++) {
+            wheel->heads[l][s] = -1;
+        }
+        wheel->occupied[l] = 0;
+    }
+    wheel->nodes = NULL;
+    wheel->capacity = 0;
+}
+
+// makes room for timer id
+// (ret: 1 success, 0 failure)
+static int timer_wheel_reserve(struct timer_wheel *wheel, int id) {
+    if (id < wheel->capacity) {
+        return 1;
+    }
+
+    int capacity = wheel->capacity == 0 ? 64 : wheel->capacity;
+    while (capacity <= id) {
+        capacity *= 2;
+    }
+
+    struct timer_node *nodes = realloc(wheel->nodes, capacity * sizeof(struct timer_node));
+    if (nodes == NULL) {
+        perror("realloc() failed in timer_wheel_reserve()");
+        return 0;
+    }
+
+    for (int n = wheel->capacity; n < capacity; n++) {
+        nodes[n].level = -1;
+    }
+    wheel->nodes = nodes;
+    wheel->capacity = capacity;
+    return 1;
+}
+
+// hangs timer id in the slot for its expiry (which must not have passed)
+static void timer_wheel_place(struct timer_wheel *wheel, int id) {
+    struct timer_node *node = &wheel->nodes[id];
+    uint64_t delta = node->expires - wheel->now;
+
+    // find the lowest level that reaches far enough, clamping anything
+    // further out than the top level reaches
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(level + 1)) {
+        level++;
+    }
+    if (delta >= LEVEL_SPAN(TIMER_WHEEL_LEVELS)) {
+        node->expires = wheel->now + LEVEL_SPAN(TIMER_WHEEL_LEVELS) - 1;
+    }
+
+    int slot = (node->expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    node->level = level;
+    node->slot = slot;
+    node->prev = -1;
+    node->next = wheel->heads[level][slot];
+    if (node->next >= 0) {
+        wheel->nodes[node->next].prev = id;
+    }
+    wheel->heads[level][slot] = id;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+// takes timer id out of its slot
+static void timer_wheel_unlink(struct timer_wheel *wheel, int id) {
+    struct timer_node *node = &wheel->nodes[id];
+
+    if (node->prev >= 0) {
+        wheel->nodes[node->prev].next = node->next;
+    }
+    else {
+        wheel->heads[node->level][node->slot] = node->next;
+        if (node->next < 0) {
+            wheel->occupied[node->level] &= ~((uint64_t)1 << node->slot);
+        }
+    }
+    if (node->next >= 0) {
+        wheel->nodes[node->next].prev = node->prev;
+    }
+    node->level = -1;
+}
+
+// (re)schedules timer id to expire at tick expires
+int timer_wheel_schedule(struct timer_wheel *wheel, int id, uint64_t expires) {
+    if (!timer_wheel_reserve(wheel, id)) {
+        return 0;
+    }
+
+    if (wheel->nodes[id].level >= 0) {
+        timer_wheel_unlink(wheel, id);
+    }
+    else {
+        wheel->count++;
+    }
+
+    wheel->nodes[id].expires = expires > wheel->now ? expires : wheel->now + 1;
+    timer_wheel_place(wheel, id);
+    return 1;
+}
+
+// cancels timer id (if it is scheduled)
+void timer_wheel_cancel(struct timer_wheel *wheel, int id) {
+    if (timer_wheel_pending(wheel, id)) {
+        timer_wheel_unlink(wheel, id);
+        wheel->count--;
+    }
+}
+
+// returns whether timer id is scheduled
+int timer_wheel_pending(const struct timer_wheel *wheel, int id) {
+    return id < wheel->capacity && wheel->nodes[id].level >= 0;
+}
+
+// moves every timer in the level's slot down to the levels below
+static void timer_wheel_cascade(struct timer_wheel *wheel, int level, int slot) {
+    int id = wheel->heads[level][slot];
+    wheel->heads[level][slot] = -1;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+
+    while (id >= 0) {
+        int next = wheel->nodes[id].next;
+        timer_wheel_place(wheel, id);
+        id = next;
+    }
+}
+
+// advances the wheel to tick now, calling expire for every timer that expired on the way
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now, void (*expire)(void *context, int id),
+    void *context) {
+
+    while (wheel->now < now) {
+        // jump straight past ticks with nothing at all to do
+        if (wheel->count == 0) {
+            wheel->now = now;
+            return;
+        }
+
+        uint64_t tick = ++wheel->now;
+
+        // every time a level comes round, empty the next slot of the level
+        // above into it (starting from the top, so timers can fall several levels)
+        for (int l = TIMER_WHEEL_LEVELS - 1; l > 0; l--) {
+            if ((tick & (LEVEL_SPAN(l) - 1)) == 0) {
+                timer_wheel_cascade(wheel, l, (tick >> (TIMER_WHEEL_BITS * l)) & SLOT_MASK);
+            }
+        }
+
+        // then expire everything due now
+        // note: a timer rescheduled by expire() always lands in a later slot
+        int slot = tick & SLOT_MASK;
+        int id;
+        while ((id = wheel->heads[0][slot]) >= 0) {
+            timer_wheel_unlink(wheel, id);
+            wheel->count--;
+            expire(context, id);
+        }
+    }
+}
+
+// returns how many ticks until the wheel next has something to do
+int64_t timer_wheel_next(const struct timer_wheel *wheel) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+
+    // the next level 0 slot with timers in it...
+    int64_t next = -1;
+    uint64_t occupied = wheel->occupied[0];
+    if (occupied != 0) {
+        int from = (wheel->now + 1) & SLOT_MASK;
+        uint64_t rotated = (occupied >> from) | (from == 0 ? 0 : occupied << (TIMER_WHEEL_SLOTS - from));
+        next = __builtin_ctzll(rotated) + 1;
+    }
+
+    // ...or the next time level 0 comes round, if anything waits on a higher level
+    uint64_t higher = 0;
+    for (int l = 1; l < TIMER_WHEEL_LEVELS; l++) {
+        higher |= wheel->occupied[l];
+    }
+    if (higher != 0) {
+        int64_t cascade = TIMER_WHEEL_SLOTS - (wheel->now & SLOT_MASK);
+        if (next < 0 || cascade < next) {
+            next = cascade;
+        }
+    }
+    return next;
+}
@@ -0,0 +1,74 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+
+// a hierarchical timing wheel. time is counted in ticks, and every timer
+// hangs in one of TIMER_WHEEL_SLOTS slots on one of TIMER_WHEEL_LEVELS
+// levels: level 0 holds the timers due within the next TIMER_WHEEL_SLOTS
+// ticks (one slot per tick), and every level above holds timers
+// TIMER_WHEEL_SLOTS times further out, at a TIMER_WHEEL_SLOTS times coarser
+// grain. every time a level comes round, the next slot of the level above is
+// emptied into it, so a timer moves down at most once per level before it
+// expires.
+//
+// scheduling and cancelling a timer is O(1), and advancing the wheel only
+// touches the timers that expire (or move down a level), however many there
+// are in all.
+//
+// timers are known by small integer ids (e.g. a user's index) rather than by
+// pointer, so whatever they belong to is free to move in memory. the slots
+// are lists linked through an array of nodes indexed by id, which grows to
+// fit the largest id scheduled.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// a timer, linked into the slot it hangs in (level is -1 while it is not scheduled)
+struct timer_node {
+    uint64_t expires;
+    int next;
+    int prev;
+    int level;
+    int slot;
+};
+
+struct timer_wheel {
+    uint64_t now;
+    int count;
+    int heads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct timer_node *nodes;
+    int capacity;
+};
+
+// initialize the wheel, starting at tick now
+void timer_wheel_initialize(struct timer_wheel *wheel, uint64_t now);
+
+// (re)schedules timer id to expire at tick expires (or at the next tick, if
+// that has already passed)
+// (ret: 1 success, 0 failure)
+int timer_wheel_schedule(struct timer_wheel *wheel, int id, uint64_t expires);
+
+// cancels timer id (if it is scheduled)
+void timer_wheel_cancel(struct timer_wheel *wheel, int id);
+
+// returns whether timer id is scheduled
+int timer_wheel_pending(const struct timer_wheel *wheel, int id);
+
+// advances the wheel to tick now, calling expire for every timer that expired
+// on the way (in order), which may schedule or cancel timers itself
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now, void (*expire)(void *context, int id),
+    void *context);
+
+// returns how many ticks until the wheel next has something to do (or -1 if no timer is scheduled)
+int64_t timer_wheel_next(const struct timer_wheel *wheel);
+
+#endif  // TIMER_WHEEL_H_
@@ -0,0 +1,264 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "uring.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// the number of completions the kernel can queue before it has to hold on to
+// them itself (multishot requests can post many completions per submission)
+#define CQ_ENTRIES_PER_SQE 8
+
+// sets up the ring with room for entries submissions
+int uring_initialize(struct uring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * CQ_ENTRIES_PER_SQE;
+
+    if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+        perror("io_uring_setup() failed");
+        return 0;
+    }
+
+    // submissions may be reused as soon as they are submitted, and completions
+    // must never be dropped
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE;
+    if ((params.features & required) != required) {
+        printf("io_uring is missing required features\n");
+        uring_free(ring);
+        return 0;
+    }
+
+    // the submission and completion rings share a single mapping
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+    char *rings = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        perror("mmap() failed for io_uring rings");
+        uring_free(ring);
+        return 0;
+    }
+    ring->rings = rings;
+    ring->rings_size = ring_size;
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap() failed for io_uring submissions");
+        ring->sqes = NULL;
+        uring_free(ring);
+        return 0;
+    }
+
+    ring->sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring->sq_array = (unsigned *)(rings + params.sq_off.array);
+    ring->sq_mask = *(unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+
+    return 1;
+}
+
+// registers count buffers of size bytes each as buffer group group
+int uring_register_buffers(struct uring *ring, unsigned short group, unsigned count, unsigned size) {
+    // the kernel requires a power of two number of entries
+    if (count == 0 || (count & (count - 1)) != 0) {
+        return 0;
+    }
+
+    ring->buf_ring = mmap(NULL, count * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        perror("mmap() failed for io_uring buffer ring");
+        ring->buf_ring = NULL;
+        return 0;
+    }
+    ring->buf_entries = count;
+
+    if ((ring->buffers = malloc((size_t)count * size)) == NULL) {
+        perror("malloc() failed in uring_register_buffers()");
+        return 0;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register(IORING_REGISTER_PBUF_RING) failed");
+        return 0;
+    }
+
+    ring->buf_size = size;
+    ring->buf_tail = 0;
+    for (unsigned bid = 0; bid < count; bid++) {
+        uring_recycle_buffer(ring, bid);
+    }
+    return 1;
+}
+
+// closes the ring and frees everything that was set up for it
+void uring_free(struct uring *ring) {
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_entries * sizeof(struct io_uring_buf));
+    }
+    free(ring->buffers);
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->rings != NULL) {
+        munmap(ring->rings, ring->rings_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+}
+
+// returns the next free submission entry
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    while (ring->sqe_tail - head >= ring->sq_entries) {
+        if (uring_submit(ring, 0) < 0 && errno != EINTR && errno != EBUSY) {
+            perror("io_uring_enter() failed");
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned index = ring->sqe_tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// hands every pending submission to the kernel, and waits for at least wait_nr completions
+int uring_submit(struct uring *ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    return syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, NULL, 0);
+}
+
+// returns the oldest unseen completion (or NULL)
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+// marks the completion returned by uring_peek_cqe() as seen
+void uring_cqe_seen(struct uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// returns the provided buffer bid
+char *uring_buffer(struct uring *ring, unsigned short bid) {
+    return ring->buffers + (size_t)bid * ring->buf_size;
+}
+
+// gives the provided buffer bid back to the kernel
+void uring_recycle_buffer(struct uring *ring, unsigned short bid) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(ring, bid);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// prepares a multishot accept on the listening socket fd
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+// prepares a multishot poll for fd becoming readable
+void uring_prep_poll_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = user_data;
+}
+
+// prepares a single poll for fd becoming readable
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = user_data;
+}
+
+// prepares a multishot receive on fd, into buffers from group
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, unsigned short group, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+// cancels the request that was submitted with user data target
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
+
+// prepares a sendmsg on fd
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+}
+
+// prepares a timeout that completes (with -ETIME) once ts has passed
+void uring_prep_timeout(struct io_uring_sqe *sqe, const struct __kernel_timespec *ts, uint64_t user_data) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+}
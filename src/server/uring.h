@@ -0,0 +1,114 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// a minimal io_uring instance, talking to the kernel directly through the
+// io_uring_setup/enter/register system calls (so the server has no library
+// dependency beyond the kernel headers).
+//
+// submissions are only handed to the kernel on uring_submit(), so everything
+// prepared during an event loop iteration (e.g. a whole broadcast fan-out)
+// goes out in a single system call.
+//
+// the ring can also own a provided buffer ring: a pool of fixed size buffers
+// the kernel picks from as data arrives, so multishot receives need no
+// buffer of their own until they actually complete.
+
+struct uring {
+    int fd;
+
+    // the mappings of the rings and of the submission entries
+    void *rings;
+    size_t rings_size;
+    size_t sqes_size;
+
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;
+    struct io_uring_sqe *sqes;
+
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // provided buffers
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    unsigned buf_entries;
+    unsigned buf_size;
+    unsigned short buf_tail;
+};
+
+// sets up the ring with room for entries submissions
+// (ret: 1 success, 0 failure (io_uring is unavailable or too old))
+int uring_initialize(struct uring *ring, unsigned entries);
+
+// registers count buffers of size bytes each as buffer group group
+// (ret: 1 success, 0 failure)
+int uring_register_buffers(struct uring *ring, unsigned short group, unsigned count, unsigned size);
+
+// closes the ring and frees everything that was set up for it, however far
+// uring_initialize() and uring_register_buffers() got
+void uring_free(struct uring *ring);
+
+// returns the next free submission entry, handing the pending ones to the
+// kernel first if the queue is full
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+// hands every pending submission to the kernel, and waits for at least
+// wait_nr completions
+// (ret: number of submissions consumed, -1 on error (see errno))
+int uring_submit(struct uring *ring, unsigned wait_nr);
+
+// returns the oldest unseen completion (or NULL)
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+// marks the completion returned by uring_peek_cqe() as seen
+void uring_cqe_seen(struct uring *ring);
+
+// returns the provided buffer bid
+char *uring_buffer(struct uring *ring, unsigned short bid);
+
+// gives the provided buffer bid back to the kernel
+void uring_recycle_buffer(struct uring *ring, unsigned short bid);
+
+// prepares a multishot accept on the listening socket fd
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+
+// prepares a multishot poll for fd becoming readable
+void uring_prep_poll_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+
+// prepares a single poll for fd becoming readable
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+
+// prepares a multishot receive on fd, into buffers from group
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, unsigned short group, uint64_t user_data);
+
+// cancels the request that was submitted with user data target (a multishot
+// one then completes for the last time, with -ECANCELED)
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data);
+
+// prepares a sendmsg on fd
+// note: msg (and its iovecs) only have to stay valid until the next uring_submit()
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg, uint64_t user_data);
+
+// prepares a timeout that completes (with -ETIME) once ts has passed
+// note: ts only has to stay valid until the next uring_submit()
+void uring_prep_timeout(struct io_uring_sqe *sqe, const struct __kernel_timespec *ts, uint64_t user_data);
+
+#endif  // URING_H_
@@ -0,0 +1,117 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#include "user_list.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the number of slots a user list starts out with
+#define INITIAL_CAPACITY 16
+
+// initializes the slots [from, to) and chains them onto the free list
+static void user_list_initialize_slots(struct user_list *list, int from, int to) {
+    for (int i = to - 1; i >= from; i--) {
+        strcpy(list->users[i].username, "");
+        list->users[i].socket_fd = -1;
+        frame_decoder_initialize(&list->users[i].decoder);
+        outbound_queue_initialize(&list->users[i].outbound);
+        list->users[i].num_rooms = 0;
+        list->users[i].dirty = 0;
+        list->users[i].want_write = 0;
+        list->users[i].sending = 0;
+        list->users[i].pending_ops = 0;
+        list->users[i].closing = 0;
+        list->users[i].receiving = 0;
+        list->users[i].behind = 0;
+        list->users[i].rate_full_at = 0;
+        list->users[i].strikes_full_at = 0;
+        list->users[i].throttled = 0;
+        list->users[i].pinged = 0;
+        list->users[i].last_heard = 0;
+        list->users[i].catching_up = 0;
+        list->users[i].binary = 0;
+        list->users[i].taken = 0;
+        list->users[i].next_free = list->free_head;
+        list->free_head = i;
+    }
+}
+
+// initialize user list
+int user_list_initialize(struct user_list *list, int max_capacity) {
+    list->capacity = max_capacity < INITIAL_CAPACITY ? max_capacity : INITIAL_CAPACITY;
+    list->max_capacity = max_capacity;
+    list->free_head = -1;
+
+    if ((list->users = malloc(list->capacity * sizeof(struct user))) == NULL) {
+        perror("malloc() failed in user_list_initialize()");
+        return 0;
+    }
+
+    user_list_initialize_slots(list, 0, list->capacity);
+    return 1;
+}
+
+// returns an empty position, i, or -1 if the list is full
+int user_list_get_free_index(struct user_list *list) {
+    if (list->free_head < 0 && list->capacity < list->max_capacity) {
+        int capacity = list->capacity * 2 < list->max_capacity ? list->capacity * 2 : list->max_capacity;
+        struct user *users = realloc(list->users, capacity * sizeof(struct user));
+        if (users == NULL) {
+            perror("realloc() failed in user_list_get_free_index()");
+            return -1;
+        }
+
+        list->users = users;
+        user_list_initialize_slots(list, list->capacity, capacity);
+        list->capacity = capacity;
+    }
+
+    return list->free_head;
+}
+
+// claims the position returned by user_list_get_free_index() for the user
+void user_list_add_user(struct user_list *list, int i, const char *username, int socket_fd,
+    struct frame_decoder *decoder) {
+
+    list->free_head = list->users[i].next_free;
+
+    strcpy(list->users[i].username, username);
+    list->users[i].socket_fd = socket_fd;
+    list->users[i].decoder = *decoder;
+    list->users[i].taken = 1;
+    list->users[i].next_free = -1;
+}
+
+// removes the user at position i from the list
+void user_list_remove_user(struct user_list *list, int i) {
+    if (i >= 0 && i < list->capacity && list->users[i].taken == 1) {
+        strcpy(list->users[i].username, "");
+        close(list->users[i].socket_fd);
+        list->users[i].socket_fd = -1;
+        frame_decoder_free(&list->users[i].decoder);
+        outbound_queue_free(&list->users[i].outbound);
+        list->users[i].num_rooms = 0;
+        list->users[i].dirty = 0;
+        list->users[i].want_write = 0;
+        list->users[i].sending = 0;
+        list->users[i].pending_ops = 0;
+        list->users[i].closing = 0;
+        list->users[i].receiving = 0;
+        list->users[i].behind = 0;
+        list->users[i].rate_full_at = 0;
+        list->users[i].strikes_full_at = 0;
+        list->users[i].throttled = 0;
+        list->users[i].pinged = 0;
+        list->users[i].catching_up = 0;
+        list->users[i].binary = 0;
+        list->users[i].taken = 0;
+        list->users[i].next_free = list->free_head;
+        list->free_head = i;
+    }
+}
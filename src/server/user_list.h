@@ -0,0 +1,97 @@
+//
+// 2018-2019 Daniel Shervheim
+// danielshervheim@gmail.com
+// github.com/danielshervheim
+//
+
+#ifndef USER_LIST_H_
+#define USER_LIST_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "message_log.h"
+#include "outbound.h"
+#include "rooms.h"
+
+// a room a user is in, and their position in that room's member list
+struct subscription {
+    struct room *room;
+    int position;
+};
+
+// the user struct
+struct user {
+    char username[MAX_USERNAME_LEN + 1];
+    int socket_fd;
+    struct frame_decoder decoder;
+    struct outbound_queue outbound;
+    struct subscription rooms[MAX_ROOMS_PER_USER];
+    int num_rooms;
+    int binary;
+    int dirty;
+    int want_write;
+    int sending;
+    int pending_ops;
+    int closing;
+
+    // (io_uring) whether a multishot receive is in flight for the user
+    int receiving;
+
+    // whether the user's outbound queue went past the high water mark (and
+    // has not yet drained back under the low water mark)
+    int behind;
+
+    // rate limiting (see rate_limit.h): when the user's bucket is next full,
+    // when their strikes for going over it are, and whether the rest of what
+    // they sent is held back
+    uint64_t rate_full_at;
+    uint64_t strikes_full_at;
+    int throttled;
+
+    // heartbeats: the tick the user was last heard from, and whether they
+    // have been sent a /ping since
+    uint64_t last_heard;
+    int pinged;
+
+    // a /catchup in progress: where its read of the log is up to, when the
+    // messages it replays were sent since, and how much it may still scan
+    // and has sent so far
+    int catching_up;
+    struct log_position catchup_at;
+    uint64_t catchup_since;
+    size_t catchup_budget;
+    size_t catchup_bytes;
+
+    int taken;
+    int next_free;
+};
+
+// the user list is a table of user slots that grows (by doubling) as users
+// join, up to max_capacity. free slots are chained into a free list, so
+// finding one never requires a scan.
+struct user_list {
+    struct user *users;
+    int capacity;
+    int max_capacity;
+    int free_head;
+};
+
+// initialize user list
+// (ret: 1 success, 0 failure)
+int user_list_initialize(struct user_list *list, int max_capacity);
+
+// returns an empty position, i, or -1 if the list is full
+// note: the position is only claimed once user_list_add_user() is called
+int user_list_get_free_index(struct user_list *list);
+
+// claims the position returned by user_list_get_free_index() for the user
+void user_list_add_user(struct user_list *list, int i, const char *username, int socket_fd,
+    struct frame_decoder *decoder);
+
+// removes the user at position i from the list
+// note: the user must have left all their rooms already
+// note: closing the socket also removes it from the epoll set
+void user_list_remove_user(struct user_list *list, int i);
+
+#endif  // USER_LIST_H_